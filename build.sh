@@ -0,0 +1,9 @@
+#!/bin/sh
+# Builds the headless renderer and the other command-line tools for POSIX systems (see build.bat for Windows).
+compilerFlags="-std=c99 -O2 -g -Wall -Wextra -Wno-unused-parameter -Wno-unused-function -ffp-contract=off"
+mkdir -p build
+cd build
+${CC:-cc} $compilerFlags ../headless.c -o headless -lm -lpthread
+${CC:-cc} $compilerFlags ../texture_bench.c -o texture_bench -lm -lpthread
+${CC:-cc} $compilerFlags ../render_bench.c -o render_bench -lm -lpthread
+${CC:-cc} $compilerFlags ../obj2mesh.c -o obj2mesh -lm -lpthread
@@ -0,0 +1,302 @@
+// Headless POSIX renderer: renders frames with no window and writes them out
+// as TGA files. Run with -help for the options.
+
+#include "posix_platform.c"
+
+#define MAX_CAMERAS 256
+
+void printUsage(void) {
+  fprintf(stderr,
+          "usage: headless [options]\n"
+          "  -mesh FILE         OBJ or binary .mesh (african_head.obj)\n"
+          "  -texture FILE      diffuse TGA (african_head_diffuse.tga)\n"
+          "  -normalmap FILE    normal map TGA (african_head_nm.tga)\n"
+          "  -size WxH          backbuffer resolution, up to %dx%d (500x500)\n"
+          "  -camera X,Y,Z      camera position, may be repeated (1,1,4)\n"
+          "  -target X,Y,Z      camera target (0,0,0)\n"
+          "  -orbit N           add N cameras circling the target at the first camera's distance\n"
+          "  -grid N            draw the mesh as an N x N grid of turned instances around the origin\n"
+          "  -lod PIXELS        build LODs and draw each instance with the coarsest one whose vertices move at most PIXELS\n"
+          "  -ortho             disable perspective\n"
+          "  -notexture         shade with lighting only\n"
+          "  -nonormalmap       texture without lighting\n"
+          "  -nobackface        disable back-face and normal cone culling\n"
+          "  -deferred          rasterize a visibility buffer, then shade each pixel once\n"
+          "  -msaa N            anti-aliasing samples per pixel: 1, 4 or 8, forward shading only (1)\n"
+          "  -threads N         worker threads (one per CPU)\n"
+          "  -filter MODE       texture filter: nearest, mipmap or trilinear (mipmap)\n"
+          "  -layout LAYOUT     texture memory layout: linear, tiled or morton (%s)\n"
+          "  -fblayout LAYOUT   render target memory layout: linear or tiled (%s)\n"
+          "  -resolve MODE      color output: clamp, gamma or reinhard (%s)\n"
+          "  -simd LEVEL        pixel and vertex kernels: auto, scalar, sse4, avx2 or avx512 (auto)\n"
+          "  -repeat N          render every view N times and report timings (1)\n"
+          "  -o FILE            output TGA, printf pattern gets the view index (out%%03d.tga)\n"
+          "  -nooutput          don't write images\n"
+          "  -hud               draw the stats and last frame's profile overlay, timed with the frame\n"
+          "  -profile           print each view's last frame by stage, with its counters\n"
+          "  -trace FILE        write the profiler's recent events as Chrome trace JSON\n",
+          MAX_BACKBUFFER_SIZE, MAX_BACKBUFFER_SIZE, textureLayoutNames[textureLayout],
+          framebufferLayoutNames[framebufferLayout], colorResolveNames[colorResolve]);
+}
+
+bool parseVec3(char *str, Vec3 *v) {
+  return sscanf(str, "%f,%f,%f", &v->x, &v->y, &v->z) == 3;
+}
+
+int main(int argc, char **argv) {
+  char *meshPath = "african_head.obj";
+  char *texturePath = "african_head_diffuse.tga";
+  char *normalMapPath = "african_head_nm.tga";
+  char *outputPattern = "out%03d.tga";
+  char *tracePath = NULL;
+  bool writeOutput = true;
+  bool printProfile = false;
+  bool drawOverlay = false;
+  int width = 500;
+  int height = 500;
+  int repeat = 1;
+  int orbit = 0;
+  int grid = 0;
+  bool buildLods = false;
+  int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  SimdLevel simdLevel = SIMD_AUTO;
+
+  Camera cameras[MAX_CAMERAS];
+  int numCameras = 0;
+  Vec3 target = makeVec3(0, 0, 0);
+  bool perspectiveEnabled = true;
+
+  for (int i = 1; i < argc; ++i) {
+    char *arg = argv[i];
+    char *value = (i+1 < argc) ? argv[i+1] : NULL;
+    bool ok = true;
+
+    if (!strcmp(arg, "-mesh") && value) { meshPath = value; ++i; }
+    else if (!strcmp(arg, "-texture") && value) { texturePath = value; ++i; }
+    else if (!strcmp(arg, "-normalmap") && value) { normalMapPath = value; ++i; }
+    else if (!strcmp(arg, "-size") && value) {
+      ok = sscanf(value, "%dx%d", &width, &height) == 2 && width > 0 && height > 0 &&
+           width <= MAX_BACKBUFFER_SIZE && height <= MAX_BACKBUFFER_SIZE;
+      ++i;
+    }
+    else if (!strcmp(arg, "-camera") && value) {
+      ok = numCameras < MAX_CAMERAS && parseVec3(value, &cameras[numCameras].pos);
+      ++numCameras;
+      ++i;
+    }
+    else if (!strcmp(arg, "-target") && value) { ok = parseVec3(value, &target); ++i; }
+    else if (!strcmp(arg, "-orbit") && value) { orbit = atoi(value); ok = orbit > 0; ++i; }
+    else if (!strcmp(arg, "-grid") && value) { grid = atoi(value); ok = grid > 0; ++i; }
+    else if (!strcmp(arg, "-lod") && value) { lodPixelError = (float)atof(value); ok = lodPixelError > 0; buildLods = true; ++i; }
+    else if (!strcmp(arg, "-ortho")) { perspectiveEnabled = false; }
+    else if (!strcmp(arg, "-notexture")) { isTextured = false; }
+    else if (!strcmp(arg, "-nonormalmap")) { normalMapEnabled = false; }
+    else if (!strcmp(arg, "-nobackface")) { backfaceCullingEnabled = false; }
+    else if (!strcmp(arg, "-deferred")) { deferredShading = true; }
+    else if (!strcmp(arg, "-msaa") && value) { msaaSamples = atoi(value); ok = msaaSamples == 1 || msaaSamples == 4 || msaaSamples == 8; ++i; }
+    else if (!strcmp(arg, "-threads") && value) { numThreads = atoi(value); ok = numThreads > 0 && numThreads <= MAX_WORKERS; ++i; }
+    else if (!strcmp(arg, "-filter") && value) {
+      ok = false;
+      for (int filter = 0; filter < TEXTURE_FILTER_COUNT; ++filter) {
+        if (!strcmp(value, textureFilterNames[filter])) {
+          textureFilter = filter;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-fblayout") && value) {
+      ok = false;
+      for (int layout = 0; layout < FRAMEBUFFER_LAYOUT_COUNT; ++layout) {
+        if (!strcmp(value, framebufferLayoutNames[layout])) {
+          framebufferLayout = layout;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-resolve") && value) {
+      ok = false;
+      for (int resolve = 0; resolve < COLOR_RESOLVE_COUNT; ++resolve) {
+        if (!strcmp(value, colorResolveNames[resolve])) {
+          colorResolve = resolve;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-layout") && value) {
+      ok = false;
+      for (int layout = 0; layout < TEXTURE_LAYOUT_COUNT; ++layout) {
+        if (!strcmp(value, textureLayoutNames[layout])) {
+          textureLayout = layout;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-simd") && value) {
+      ok = false;
+      for (int level = 0; level < SIMD_COUNT; ++level) {
+        if (!strcmp(value, simdLevelNames[level])) {
+          simdLevel = level;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-repeat") && value) { repeat = atoi(value); ok = repeat > 0; ++i; }
+    else if (!strcmp(arg, "-o") && value) { outputPattern = value; ++i; }
+    else if (!strcmp(arg, "-nooutput")) { writeOutput = false; }
+    else if (!strcmp(arg, "-hud")) { drawOverlay = true; }
+    else if (!strcmp(arg, "-profile")) { printProfile = true; }
+    else if (!strcmp(arg, "-trace") && value) { tracePath = value; ++i; }
+    else ok = false;
+
+    if (!ok) {
+      fprintf(stderr, "bad argument: %s\n", arg);
+      printUsage();
+      return 1;
+    }
+  }
+  if (deferredShading && msaaSamples > 1) {
+    fprintf(stderr, "-msaa needs forward shading, not -deferred\n");
+    return 1;
+  }
+
+  if (numCameras == 0) {
+    cameras[numCameras++].pos = makeVec3(1.0f, 1.0f, 4.0f);
+  }
+  if (orbit) {
+    Vec3 offset = subVec3(cameras[0].pos, target);
+    float radius = sqrtf(offset.x*offset.x + offset.z*offset.z);
+    for (int i = 0; i < orbit && numCameras < MAX_CAMERAS; ++i) {
+      float angle = 2.0f*3.14159265f*(float)i/(float)orbit;
+      cameras[numCameras++].pos = makeVec3(target.x + radius*sinf(angle), target.y + offset.y, target.z + radius*cosf(angle));
+    }
+  }
+  for (int i = 0; i < numCameras; ++i) {
+    cameras[i].target = target;
+    cameras[i].perspectiveEnabled = perspectiveEnabled;
+    cameras[i].isCameraEnabled = true;
+  }
+
+  if (numThreads < 1) numThreads = 1;
+  if (numThreads > MAX_WORKERS) numThreads = MAX_WORKERS;
+  initWorkers(numThreads);
+
+  f64 loadStart = platformGetSeconds();
+  Mesh mesh = readMesh(meshPath);
+  if (!mesh.faces) return 1;
+  Texture texture = readTGAFile(texturePath);
+  Texture normalMap = readTGAFile(normalMapPath);
+  if (!texture.pixels || !normalMap.pixels) return 1;
+  if (drawOverlay) loadFont("font.bmp");
+  if (buildLods) buildLodChain(&mesh);
+  f64 loadEnd = platformGetSeconds();
+  printf("loaded assets in %.1f ms\n", (loadEnd - loadStart)*1000.0);
+
+  // one mesh and material, instanced once per grid cell or else drawn once
+  // where it is
+  Scene scene = {0};
+  MeshHandle meshHandle = addSceneMesh(&scene, &mesh);
+  MaterialHandle material = addSceneMaterial(&scene, texture, normalMap);
+  if (material == MATERIAL_NONE) return 1;
+  if (grid) {
+    Mat4 *models = malloc(grid*grid*sizeof(*models));
+    float spacing = 2.5f*mesh.bounds.radius;
+    for (int z = 0; z < grid; ++z) {
+      for (int x = 0; x < grid; ++x) {
+        Vec3 position = makeVec3((x - 0.5f*(grid-1))*spacing, 0, (z - 0.5f*(grid-1))*spacing);
+        float angle = (float)((x*7 + z*13) % 16)*(2.0f*3.14159265f/16.0f);
+        models[x + z*grid] = getModelMat4(position, angle, 1.0f);
+      }
+    }
+    drawMeshInstanced(&scene, meshHandle, material, models, grid*grid);
+    free(models);
+  } else {
+    Mat4 model = getIdentityMat4();
+    drawMeshInstanced(&scene, meshHandle, material, &model, 1);
+  }
+
+  SimdLevel vertexSimdLevel = initVertexKernels(simdLevel);
+  simdLevel = initPixelKernels(simdLevel);
+  if (!initBackbuffer(width, height)) return 1;
+
+  f64 totalTime = 0;
+  for (int i = 0; i < numCameras; ++i) {
+    f64 bestTime = DBL_MAX;
+    for (int j = 0; j < repeat; ++j) {
+      PROFILE_NEXT_FRAME();
+      PROFILE_BEGIN(frame, 0);
+      f64 frameStart = platformGetSeconds();
+      renderScene(&cameras[i], &scene);
+      if (drawOverlay) {
+        PROFILE_BEGIN(hud, 0);
+        drawHud((f32)(platformGetSeconds() - frameStart), true);
+        PROFILE_END(hud, 0);
+      }
+      f64 frameTime = platformGetSeconds() - frameStart;
+      PROFILE_END(frame, 0);
+      if (frameTime < bestTime) bestTime = frameTime;
+      totalTime += frameTime;
+    }
+
+    if (writeOutput) {
+      char outputPath[1024];
+      snprintf(outputPath, sizeof(outputPath), outputPattern, i);
+      PROFILE_BEGIN(present, 0);
+      bool written = writeTGAFile(outputPath, backbuffer, backbufferWidth, backbufferHeight);
+      PROFILE_END(present, 0);
+      if (!written) {
+        fprintf(stderr, "can't write %s\n", outputPath);
+        return 1;
+      }
+      printf("view %d: best %.3f ms -> %s\n", i, bestTime*1000.0, outputPath);
+    } else {
+      printf("view %d: best %.3f ms\n", i, bestTime*1000.0);
+    }
+    CullStats *s = &cullStats;
+    printf("  culled %u/%u meshes, %u/%u meshlets (%u outside, %u back-facing), transformed %u/%u vertices\n",
+           s->meshesCulled, s->meshes, s->meshletsOutside + s->meshletsBackfacing, s->meshlets, s->meshletsOutside, s->meshletsBackfacing,
+           s->verticesTransformed, s->vertices);
+    printf("  faces %u: %u in culled meshlets, %u outside, %u back-facing, %u degenerate, %u clipped -> %u triangles\n",
+           s->faces, s->facesInCulledMeshlets, s->facesOutside, s->facesBackfacing, s->facesDegenerate, s->facesClipped,
+           s->trianglesBinned);
+    if (buildLods) {
+      printf("  %u/%u meshes simplified, %u faces instead of %u at full detail\n", s->meshesSimplified, s->meshes,
+             s->faces, s->facesFullDetail);
+    }
+    if (deferredShading) {
+      printf("  shaded %u pixels for %u depth writes, %u overdrawn pixels not shaded\n",
+             shadingStats.shadedPixels, shadingStats.depthWrites, shadingStats.depthWrites - shadingStats.shadedPixels);
+    }
+    if (printProfile) {
+      ProfileStage stages[PROFILE_MAX_STAGES];
+      int numStages = getProfileStages(profileFrame, stages, PROFILE_MAX_STAGES);
+      for (int j = 0; j < numStages; ++j) {
+        ProfileStage *stage = &stages[j];
+        if (stage->isCounter) {
+          printf("  %-20s %9.*f\n", stage->name, stage->seconds == floor(stage->seconds) ? 0 : 2, stage->seconds);
+        } else {
+          printf("  %*s%-*s %9.3f ms", 2*stage->depth, "", 20 - 2*stage->depth, stage->name, stage->seconds*1000.0);
+          if (stage->count > 1) printf(" in %u scopes", stage->count);
+          printf("\n");
+        }
+      }
+    }
+  }
+
+  if (tracePath) {
+    if (!writeProfileTrace(tracePath)) {
+      fprintf(stderr, "can't write %s\n", tracePath);
+      return 1;
+    }
+    printf("wrote trace to %s\n", tracePath);
+  }
+
+  int numFrames = numCameras*repeat;
+  printf("%d frames, %dx%d, %d threads, %s pixels, %s vertices, avg %.3f ms/frame\n", numFrames, width, height, numThreads,
+         simdLevelNames[simdLevel], simdLevelNames[vertexSimdLevel], totalTime*1000.0/numFrames);
+  return 0;
+}
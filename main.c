@@ -1,23 +1,6 @@
 #include <windows.h>
-#include <stdint.h>
-#include <assert.h>
-#include <stdio.h>
-#include <math.h>
-#include <stdbool.h>
-#include <float.h>
-
-typedef uint8_t u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef uint64_t u64;
-
-typedef int8_t i8;
-typedef int16_t i16;
-typedef int32_t i32;
-typedef int64_t i64;
-
-typedef float f32;
-typedef double f64;
+
+#include "renderer.c"
 
 void debugPrint(char *format, ...) {
   va_list argptr;
@@ -28,675 +11,154 @@ void debugPrint(char *format, ...) {
   OutputDebugString(str);
 }
 
-#if 1
-#define BACKBUFFER_WIDTH 500
-#define WINDOW_SCALE 1
-#else
-#define BACKBUFFER_WIDTH 100
-#define WINDOW_SCALE 8
-#endif
-
-#define BACKBUFFER_HEIGHT BACKBUFFER_WIDTH
-#define BACKBUFFER_BYTES (BACKBUFFER_WIDTH * BACKBUFFER_HEIGHT * sizeof(uint32_t))
-#define WINDOW_WIDTH (BACKBUFFER_WIDTH * WINDOW_SCALE)
-#define WINDOW_HEIGHT (BACKBUFFER_HEIGHT * WINDOW_SCALE)
-
-#define WHITE 0xFFFFFFFF
-#define RED   0xFFFF0000
-#define GREEN 0xFF00FF00
-
-typedef struct {
-  float x, y, z;
-} Vec3;
-
-Vec3 crossVec3(Vec3 a, Vec3 b) {
-  Vec3 r;
-  r.x = a.y*b.z - b.y*a.z;
-  r.y = b.x*a.z - a.x*b.z;
-  r.z = a.x*b.y - a.y*b.x;
-  return r;
-}
-
-Vec3 subVec3(Vec3 a, Vec3 b) {
-  Vec3 r;
-  r.x = a.x - b.x;
-  r.y = a.y - b.y;
-  r.z = a.z - b.z;
-  return r;
-}
-
-Vec3 makeVec3(float x, float y, float z) {
-  Vec3 r;
-  r.x = x;
-  r.y = y;
-  r.z = z;
-  return r;
-}
-
-float dotVec3(Vec3 a, Vec3 b) {
-  return a.x*b.x + a.y*b.y + a.z*b.z;
-}
-
-float lengthSquaredVec3(Vec3 v) {
-  return dotVec3(v,v);
-}
-
-float lengthVec3(Vec3 v) {
-  return sqrtf(lengthSquaredVec3(v));
-}
-
-Vec3 scaleVec3(Vec3 v, float a) {
-  return makeVec3(v.x*a, v.y*a, v.z*a);
-}
-
-Vec3 normalizeVec3(Vec3 v) {
-  return scaleVec3(v, 1.0f / lengthVec3(v));
-}
-
-typedef struct {
-  float x, y, z, w;
-} Vec4;
-
-Vec4 makeVec4(float x, float y, float z, float w) {
-  Vec4 r;
-  r.x = x;
-  r.y = y;
-  r.z = z;
-  r.w = w;
-  return r;
-}
-
-typedef struct {
-  float d[4][4];
-} Mat4;
-
-Mat4 makeMat4(float d00, float d01, float d02, float d03,
-              float d10, float d11, float d12, float d13,
-              float d20, float d21, float d22, float d23,
-              float d30, float d31, float d32, float d33) {
-  Mat4 m;
-  m.d[0][0] = d00; m.d[0][1] = d01; m.d[0][2] = d02; m.d[0][3] = d03;
-  m.d[1][0] = d10; m.d[1][1] = d11; m.d[1][2] = d12; m.d[1][3] = d13;
-  m.d[2][0] = d20; m.d[2][1] = d21; m.d[2][2] = d22; m.d[2][3] = d23;
-  m.d[3][0] = d30; m.d[3][1] = d31; m.d[3][2] = d32; m.d[3][3] = d33;
-  return m;
-}
-
-Mat4 getIdentityMat4() {
-  return makeMat4(1,0,0,0,
-                  0,1,0,0,
-                  0,0,1,0,
-                  0,0,0,1);
-}
-
-Mat4 mulMat4(Mat4 m, Mat4 n) {
-  Mat4 r;
+PlatformFile platformReadEntireFile(char *filePath) {
+  PlatformFile result = {0};
+  BOOL success;
 
-  r.d[0][0] = m.d[0][0]*n.d[0][0] + m.d[0][1]*n.d[1][0] + m.d[0][2]*n.d[2][0] + m.d[0][3]*n.d[3][0];
-  r.d[0][1] = m.d[0][0]*n.d[0][1] + m.d[0][1]*n.d[1][1] + m.d[0][2]*n.d[2][1] + m.d[0][3]*n.d[3][1];
-  r.d[0][2] = m.d[0][0]*n.d[0][2] + m.d[0][1]*n.d[1][2] + m.d[0][2]*n.d[2][2] + m.d[0][3]*n.d[3][2];
-  r.d[0][3] = m.d[0][0]*n.d[0][3] + m.d[0][1]*n.d[1][3] + m.d[0][2]*n.d[2][3] + m.d[0][3]*n.d[3][3];
+  HANDLE fileHandle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) return result;
 
-  r.d[1][0] = m.d[1][0]*n.d[0][0] + m.d[1][1]*n.d[1][0] + m.d[1][2]*n.d[2][0] + m.d[1][3]*n.d[3][0];
-  r.d[1][1] = m.d[1][0]*n.d[0][1] + m.d[1][1]*n.d[1][1] + m.d[1][2]*n.d[2][1] + m.d[1][3]*n.d[3][1];
-  r.d[1][2] = m.d[1][0]*n.d[0][2] + m.d[1][1]*n.d[1][2] + m.d[1][2]*n.d[2][2] + m.d[1][3]*n.d[3][2];
-  r.d[1][3] = m.d[1][0]*n.d[0][3] + m.d[1][1]*n.d[1][3] + m.d[1][2]*n.d[2][3] + m.d[1][3]*n.d[3][3];
+  LARGE_INTEGER fileSize;
+  success = GetFileSizeEx(fileHandle, &fileSize);
+  assert(success);
 
-  r.d[2][0] = m.d[2][0]*n.d[0][0] + m.d[2][1]*n.d[1][0] + m.d[2][2]*n.d[2][0] + m.d[2][3]*n.d[3][0];
-  r.d[2][1] = m.d[2][0]*n.d[0][1] + m.d[2][1]*n.d[1][1] + m.d[2][2]*n.d[2][1] + m.d[2][3]*n.d[3][1];
-  r.d[2][2] = m.d[2][0]*n.d[0][2] + m.d[2][1]*n.d[1][2] + m.d[2][2]*n.d[2][2] + m.d[2][3]*n.d[3][2];
-  r.d[2][3] = m.d[2][0]*n.d[0][3] + m.d[2][1]*n.d[1][3] + m.d[2][2]*n.d[2][3] + m.d[2][3]*n.d[3][3];
+  result.contents = malloc(fileSize.LowPart);
+  result.size = fileSize.LowPart;
 
-  r.d[3][0] = m.d[3][0]*n.d[0][0] + m.d[3][1]*n.d[1][0] + m.d[3][2]*n.d[2][0] + m.d[3][3]*n.d[3][0];
-  r.d[3][1] = m.d[3][0]*n.d[0][1] + m.d[3][1]*n.d[1][1] + m.d[3][2]*n.d[2][1] + m.d[3][3]*n.d[3][1];
-  r.d[3][2] = m.d[3][0]*n.d[0][2] + m.d[3][1]*n.d[1][2] + m.d[3][2]*n.d[2][2] + m.d[3][3]*n.d[3][2];
-  r.d[3][3] = m.d[3][0]*n.d[0][3] + m.d[3][1]*n.d[1][3] + m.d[3][2]*n.d[2][3] + m.d[3][3]*n.d[3][3];
+  DWORD numBytesRead;
+  success = ReadFile(fileHandle, result.contents, fileSize.LowPart, &numBytesRead, NULL);
+  assert(success);
+  assert(numBytesRead == fileSize.LowPart);
 
-  return r;
+  CloseHandle(fileHandle);
+  return result;
 }
 
-Vec4 mulMatVec4(Mat4 m, Vec4 v) {
-  Vec4 r;
-  r.x = m.d[0][0]*v.x + m.d[0][1]*v.y + m.d[0][2]*v.z + m.d[0][3]*v.w;
-  r.y = m.d[1][0]*v.x + m.d[1][1]*v.y + m.d[1][2]*v.z + m.d[1][3]*v.w;
-  r.z = m.d[2][0]*v.x + m.d[2][1]*v.y + m.d[2][2]*v.z + m.d[2][3]*v.w;
-  r.w = m.d[3][0]*v.x + m.d[3][1]*v.y + m.d[3][2]*v.z + m.d[3][3]*v.w;
-  return r;
+void platformFreeFile(PlatformFile file) {
+  free(file.contents);
 }
 
-float determinantMat4(Mat4 m) {
-  float det =
-    m.d[0][3]*m.d[1][2]*m.d[2][1]*m.d[3][0] - m.d[0][2]*m.d[1][3]*m.d[2][1]*m.d[3][0] - m.d[0][3]*m.d[1][1]*m.d[2][2]*m.d[3][0] + m.d[0][1]*m.d[1][3]*m.d[2][2]*m.d[3][0]+
-    m.d[0][2]*m.d[1][1]*m.d[2][3]*m.d[3][0] - m.d[0][1]*m.d[1][2]*m.d[2][3]*m.d[3][0] - m.d[0][3]*m.d[1][2]*m.d[2][0]*m.d[3][1] + m.d[0][2]*m.d[1][3]*m.d[2][0]*m.d[3][1]+
-    m.d[0][3]*m.d[1][0]*m.d[2][2]*m.d[3][1] - m.d[0][0]*m.d[1][3]*m.d[2][2]*m.d[3][1] - m.d[0][2]*m.d[1][0]*m.d[2][3]*m.d[3][1] + m.d[0][0]*m.d[1][2]*m.d[2][3]*m.d[3][1]+
-    m.d[0][3]*m.d[1][1]*m.d[2][0]*m.d[3][2] - m.d[0][1]*m.d[1][3]*m.d[2][0]*m.d[3][2] - m.d[0][3]*m.d[1][0]*m.d[2][1]*m.d[3][2] + m.d[0][0]*m.d[1][3]*m.d[2][1]*m.d[3][2]+
-    m.d[0][1]*m.d[1][0]*m.d[2][3]*m.d[3][2] - m.d[0][0]*m.d[1][1]*m.d[2][3]*m.d[3][2] - m.d[0][2]*m.d[1][1]*m.d[2][0]*m.d[3][3] + m.d[0][1]*m.d[1][2]*m.d[2][0]*m.d[3][3]+
-    m.d[0][2]*m.d[1][0]*m.d[2][1]*m.d[3][3] - m.d[0][0]*m.d[1][2]*m.d[2][1]*m.d[3][3] - m.d[0][1]*m.d[1][0]*m.d[2][2]*m.d[3][3] + m.d[0][0]*m.d[1][1]*m.d[2][2]*m.d[3][3];
-  return det;
-}
+PlatformFile platformMapFile(char *filePath) {
+  PlatformFile result = {0};
 
-Mat4 invertMat4(Mat4 m) {
-  Mat4 r;
-  float det = determinantMat4(m);
-  assert(fabs(det) > 0.001f);
-  float invDet = 1.0f / det;
-  r.d[0][0] = invDet * (m.d[1][2]*m.d[2][3]*m.d[3][1] - m.d[1][3]*m.d[2][2]*m.d[3][1] + m.d[1][3]*m.d[2][1]*m.d[3][2] - m.d[1][1]*m.d[2][3]*m.d[3][2] - m.d[1][2]*m.d[2][1]*m.d[3][3] + m.d[1][1]*m.d[2][2]*m.d[3][3]);
-  r.d[0][1] = invDet * (m.d[0][3]*m.d[2][2]*m.d[3][1] - m.d[0][2]*m.d[2][3]*m.d[3][1] - m.d[0][3]*m.d[2][1]*m.d[3][2] + m.d[0][1]*m.d[2][3]*m.d[3][2] + m.d[0][2]*m.d[2][1]*m.d[3][3] - m.d[0][1]*m.d[2][2]*m.d[3][3]);
-  r.d[0][2] = invDet * (m.d[0][2]*m.d[1][3]*m.d[3][1] - m.d[0][3]*m.d[1][2]*m.d[3][1] + m.d[0][3]*m.d[1][1]*m.d[3][2] - m.d[0][1]*m.d[1][3]*m.d[3][2] - m.d[0][2]*m.d[1][1]*m.d[3][3] + m.d[0][1]*m.d[1][2]*m.d[3][3]);
-  r.d[0][3] = invDet * (m.d[0][3]*m.d[1][2]*m.d[2][1] - m.d[0][2]*m.d[1][3]*m.d[2][1] - m.d[0][3]*m.d[1][1]*m.d[2][2] + m.d[0][1]*m.d[1][3]*m.d[2][2] + m.d[0][2]*m.d[1][1]*m.d[2][3] - m.d[0][1]*m.d[1][2]*m.d[2][3]);
-  r.d[1][0] = invDet * (m.d[1][3]*m.d[2][2]*m.d[3][0] - m.d[1][2]*m.d[2][3]*m.d[3][0] - m.d[1][3]*m.d[2][0]*m.d[3][2] + m.d[1][0]*m.d[2][3]*m.d[3][2] + m.d[1][2]*m.d[2][0]*m.d[3][3] - m.d[1][0]*m.d[2][2]*m.d[3][3]);
-  r.d[1][1] = invDet * (m.d[0][2]*m.d[2][3]*m.d[3][0] - m.d[0][3]*m.d[2][2]*m.d[3][0] + m.d[0][3]*m.d[2][0]*m.d[3][2] - m.d[0][0]*m.d[2][3]*m.d[3][2] - m.d[0][2]*m.d[2][0]*m.d[3][3] + m.d[0][0]*m.d[2][2]*m.d[3][3]);
-  r.d[1][2] = invDet * (m.d[0][3]*m.d[1][2]*m.d[3][0] - m.d[0][2]*m.d[1][3]*m.d[3][0] - m.d[0][3]*m.d[1][0]*m.d[3][2] + m.d[0][0]*m.d[1][3]*m.d[3][2] + m.d[0][2]*m.d[1][0]*m.d[3][3] - m.d[0][0]*m.d[1][2]*m.d[3][3]);
-  r.d[1][3] = invDet * (m.d[0][2]*m.d[1][3]*m.d[2][0] - m.d[0][3]*m.d[1][2]*m.d[2][0] + m.d[0][3]*m.d[1][0]*m.d[2][2] - m.d[0][0]*m.d[1][3]*m.d[2][2] - m.d[0][2]*m.d[1][0]*m.d[2][3] + m.d[0][0]*m.d[1][2]*m.d[2][3]);
-  r.d[2][0] = invDet * (m.d[1][1]*m.d[2][3]*m.d[3][0] - m.d[1][3]*m.d[2][1]*m.d[3][0] + m.d[1][3]*m.d[2][0]*m.d[3][1] - m.d[1][0]*m.d[2][3]*m.d[3][1] - m.d[1][1]*m.d[2][0]*m.d[3][3] + m.d[1][0]*m.d[2][1]*m.d[3][3]);
-  r.d[2][1] = invDet * (m.d[0][3]*m.d[2][1]*m.d[3][0] - m.d[0][1]*m.d[2][3]*m.d[3][0] - m.d[0][3]*m.d[2][0]*m.d[3][1] + m.d[0][0]*m.d[2][3]*m.d[3][1] + m.d[0][1]*m.d[2][0]*m.d[3][3] - m.d[0][0]*m.d[2][1]*m.d[3][3]);
-  r.d[2][2] = invDet * (m.d[0][1]*m.d[1][3]*m.d[3][0] - m.d[0][3]*m.d[1][1]*m.d[3][0] + m.d[0][3]*m.d[1][0]*m.d[3][1] - m.d[0][0]*m.d[1][3]*m.d[3][1] - m.d[0][1]*m.d[1][0]*m.d[3][3] + m.d[0][0]*m.d[1][1]*m.d[3][3]);
-  r.d[2][3] = invDet * (m.d[0][3]*m.d[1][1]*m.d[2][0] - m.d[0][1]*m.d[1][3]*m.d[2][0] - m.d[0][3]*m.d[1][0]*m.d[2][1] + m.d[0][0]*m.d[1][3]*m.d[2][1] + m.d[0][1]*m.d[1][0]*m.d[2][3] - m.d[0][0]*m.d[1][1]*m.d[2][3]);
-  r.d[3][0] = invDet * (m.d[1][2]*m.d[2][1]*m.d[3][0] - m.d[1][1]*m.d[2][2]*m.d[3][0] - m.d[1][2]*m.d[2][0]*m.d[3][1] + m.d[1][0]*m.d[2][2]*m.d[3][1] + m.d[1][1]*m.d[2][0]*m.d[3][2] - m.d[1][0]*m.d[2][1]*m.d[3][2]);
-  r.d[3][1] = invDet * (m.d[0][1]*m.d[2][2]*m.d[3][0] - m.d[0][2]*m.d[2][1]*m.d[3][0] + m.d[0][2]*m.d[2][0]*m.d[3][1] - m.d[0][0]*m.d[2][2]*m.d[3][1] - m.d[0][1]*m.d[2][0]*m.d[3][2] + m.d[0][0]*m.d[2][1]*m.d[3][2]);
-  r.d[3][2] = invDet * (m.d[0][2]*m.d[1][1]*m.d[3][0] - m.d[0][1]*m.d[1][2]*m.d[3][0] - m.d[0][2]*m.d[1][0]*m.d[3][1] + m.d[0][0]*m.d[1][2]*m.d[3][1] + m.d[0][1]*m.d[1][0]*m.d[3][2] - m.d[0][0]*m.d[1][1]*m.d[3][2]);
-  r.d[3][3] = invDet * (m.d[0][1]*m.d[1][2]*m.d[2][0] - m.d[0][2]*m.d[1][1]*m.d[2][0] + m.d[0][2]*m.d[1][0]*m.d[2][1] - m.d[0][0]*m.d[1][2]*m.d[2][1] - m.d[0][1]*m.d[1][0]*m.d[2][2] + m.d[0][0]*m.d[1][1]*m.d[2][2]);
-  return r;
-}
+  HANDLE fileHandle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) return result;
 
-Mat4 transposeMat4(Mat4 m) {
-  Mat4 r;
-  for (int i = 0; i < 4; ++i) {
-    for (int j = 0; j < 4; ++j) {
-      r.d[i][j] = m.d[j][i];
+  LARGE_INTEGER fileSize;
+  if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0) {
+    HANDLE mapping = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      result.contents = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (result.contents) result.size = fileSize.LowPart;
+      // the view keeps the mapping and the file alive
+      CloseHandle(mapping);
     }
   }
-  return r;
-}
 
-u32 *backbuffer;
-
-u32 makeU32Color(Vec3 color) {
-  assert(color.x >= 0.0f && color.x <= 1.0f);
-  assert(color.y >= 0.0f && color.y <= 1.0f);
-  assert(color.z >= 0.0f && color.z <= 1.0f);
-  //0xFFRRGGBB
-  u8 r = (u8)(color.x*0xFF);
-  u8 g = (u8)(color.y*0xFF);
-  u8 b = (u8)(color.z*0xFF);
-  uint32_t result = (0xFF << 8*3) | (r << 8*2) | (g << 8*1) | (b << 8*0);
+  CloseHandle(fileHandle);
   return result;
 }
 
-void setPixel(int x, int y, Vec3 color) {
-  /* assert(x >= 0 && x < BACKBUFFER_WIDTH); */
-  /* assert(y >= 0 && y < BACKBUFFER_HEIGHT); */
-
-  if (x >= 0 && x < BACKBUFFER_WIDTH && y >= 0 && y < BACKBUFFER_HEIGHT)
-    backbuffer[y*BACKBUFFER_WIDTH + x] = makeU32Color(color);
+void platformUnmapFile(PlatformFile file) {
+  UnmapViewOfFile(file.contents);
 }
 
-void drawFilledRect(int left, int top, int right, int bottom, Vec3 color) {
-  for (int y = top; y <= bottom; ++y) {
-    for (int x = left; x <= right; ++x) {
-      setPixel(x, y, color);
-    }
-  }
+bool platformWriteEntireFile(char *filePath, void *contents, u32 size) {
+  HANDLE fileHandle = CreateFile(filePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) return false;
+  DWORD numBytesWritten;
+  BOOL success = WriteFile(fileHandle, contents, size, &numBytesWritten, NULL);
+  CloseHandle(fileHandle);
+  return success && numBytesWritten == size;
 }
 
-void drawLine(int x1, int y1, int x2, int y2, Vec3 color) {
-  if (x1 == x2 && y1 == y2) {
-    setPixel(x1, y1, color);
-    return;
-  }
-
-  int xStart, xEnd, yStart, yEnd;
-  int dx = x2 - x1;
-  int dy = y2 - y1;
-
-  if (abs(dx) > abs(dy)) {
-    float m = (float)dy / (float)dx;
-    if (x1 < x2) {
-      xStart = x1;
-      yStart = y1;
-      xEnd = x2;
-      yEnd = y2;
-    } else {
-      xStart = x2;
-      yStart = y2;
-      xEnd = x1;
-      yEnd = y1;
-    }
-    for (int x = xStart; x <= xEnd; ++x) {
-      int y = (int)(m * (x - xStart) + yStart);
-      setPixel(x, y, color);
-    }
-  } else {
-    float m = (float)dx / (float)dy;
-    if (y1 < y2) {
-      xStart = x1;
-      yStart = y1;
-      xEnd = x2;
-      yEnd = y2;
-    } else {
-      xStart = x2;
-      yStart = y2;
-      xEnd = x1;
-      yEnd = y1;
-    }
-    for (int y = yStart; y <= yEnd; ++y) {
-      int x = (int)(m * (y - yStart) + xStart);
-      setPixel(x, y, color);
-    }
-  }
+f64 platformGetSeconds(void) {
+  static LARGE_INTEGER perfcFreq;
+  if (!perfcFreq.QuadPart) QueryPerformanceFrequency(&perfcFreq);
+  LARGE_INTEGER perfc;
+  QueryPerformanceCounter(&perfc);
+  return (f64)perfc.QuadPart / (f64)perfcFreq.QuadPart;
 }
 
-#define SWAP(x,y) {int t=x; x=y; y=t;}
-
-void drawTriangleLineSweep(int x0, int y0, int x1, int y1, int x2, int y2, Vec3 color) {
-  if (y2 < y1) {SWAP(y2, y1); SWAP(x2, x1);}
-  if (y1 < y0) {SWAP(y1, y0); SWAP(x1, x0);}
-  if (y2 < y1) {SWAP(y2, y1); SWAP(x2, x1);}
-  assert(y0 <= y1 && y1 <= y2);
+#define MAX_WORKERS 64
 
-#if 0
-  drawLine(x0, y0, x1, y1, color);
-  drawLine(x1, y1, x2, y2, color);
-  drawLine(x2, y2, x0, y0, color);
+#if PROFILER && MAX_WORKERS > PROFILE_MAX_THREADS
+#error "the profiler needs a ring per worker"
 #endif
 
-  for (int y = y0; y <= y1; ++y) {
-    float tA = (float)(y - y0) / (y1 - y0);
-    int xA = (int)((1.0f - tA)*x0 + tA*x1);
-    float tB = (float)(y - y0) / (y2 - y0);
-    int xB = (int)((1.0f - tB)*x0 + tB*x2);
-    drawLine(xA, y, xB, y, color);
-  }
-
-  for (int y = y1; y <= y2; ++y) {
-    float tA = (float)(y - y1) / (y2 - y1);
-    int xC = (int)((1.0f - tA)*x1 + tA*x2);
-    float tB = (float)(y - y0) / (y2 - y0);
-    int xD = (int)((1.0f - tB)*x0 + tB*x2);
-    drawLine(xC, y, xD, y, color);
-  }
-}
-
-Vec3 getBarycentricCoords(Vec3 A, Vec3 B, Vec3 C, Vec3 P) {
-  Vec3 AB = subVec3(B, A);
-  Vec3 AC = subVec3(C, A);
-  Vec3 PA = subVec3(A, P);
-  Vec3 v1 = makeVec3(AB.x, AC.x, PA.x);
-  Vec3 v2 = makeVec3(AB.y, AC.y, PA.y);
-  Vec3 c = crossVec3(v1, v2);
-  if (fabs(c.z) < 0.00001f) return makeVec3(-1.0f, 1.0f, 1.0f);
-  float u = c.x / c.z;
-  float v = c.y / c.z;
-  float w = 1.0f - u - v;
-  return makeVec3(w, u, v);
-}
-
-#pragma pack(push, 1)
-typedef struct {
-  u16 origin;
-  u16 length;
-  u8 bitsPerEntry;
-} TGAColorMap;
-
 typedef struct {
-  u16 xOrigin;
-  u16 yOrigin;
-  u16 width;
-  u16 height;
-  u8 bitsPerPixel;
-  u8 descriptor;
-} TGAImageSpecification;
-
-typedef struct {
-  u8 numCharsInIdField;
-  u8 colorMapType;
-  u8 imageType;
-  TGAColorMap colorMap;
-  TGAImageSpecification imageSpec;
-} TGAHeader;
-#pragma pack(pop)
-
-typedef struct {
-  Vec3 *pixels;
-  u32 width;
-  u32 height;
-} Texture;
-
-typedef enum {
-  TGADT_RLE_TC = 10, // true color
-  TGADT_RLE_BW = 11, // black & white
-} TGADataType;
-
-Texture readTGAFile(char *filePath) {
-  Texture result;
-  BOOL success;
-
-  HANDLE fileHandle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  assert(fileHandle != INVALID_HANDLE_VALUE);
-
-  LARGE_INTEGER fileSize;
-  success = GetFileSizeEx(fileHandle, &fileSize);
-  assert(success);
-
-  u8 *fileContents = malloc(fileSize.LowPart);
-
-  DWORD numBytesRead;
-  success = ReadFile(fileHandle, fileContents, fileSize.LowPart, &numBytesRead, NULL);
-  assert(success);
-  assert(numBytesRead == fileSize.LowPart);
-
-  TGAHeader *header = (TGAHeader *)fileContents;
-  u8 *data = fileContents + sizeof(TGAHeader);
-  assert(header->imageType == TGADT_RLE_TC || header->imageType == TGADT_RLE_BW);
-  assert(header->imageSpec.bitsPerPixel == 8 || header->imageSpec.bitsPerPixel == 24 || header->imageSpec.bitsPerPixel == 32);
-  assert(header->numCharsInIdField == 0);
-  assert(header->colorMapType == 0);
-  assert(header->imageSpec.xOrigin == 0);
-  assert(header->imageSpec.yOrigin == 0);
-  result.width = header->imageSpec.width;
-  result.height = header->imageSpec.height;
-  result.pixels = malloc(result.width * result.height * sizeof(*result.pixels));
-  Vec3 *tex = result.pixels;
-  Vec3 *texEnd = result.pixels + (result.width*result.height);
-
-  while (tex < texEnd) {
-    bool isRLE = *data & 0x80;
-    u8 length = (*(data++) & 0x7F) + 1;
-    if (isRLE) {
-      Vec3 color;
-      if (header->imageType == TGADT_RLE_TC) {
-        float b = *(data++);
-        float g = *(data++);
-        float r = *(data++);
-        if (header->imageSpec.bitsPerPixel == 32) {
-          data++;
-        }
-        color = makeVec3(r/255.0f, g/255.0f, b/255.0f);
-      } else if (header->imageType == TGADT_RLE_BW) {
-        float c = *(data++);
-        color = makeVec3(c/255.0f, c/255.0f, c/255.0f);
-      }
-      for (int j = 0; j < length; ++j) {
-        *(tex++) = color;
-      }
-    } else {
-      for (int j = 0; j < length; ++j) {
-        Vec3 color;
-        if (header->imageType == TGADT_RLE_TC) {
-          float b = *(data++);
-          float g = *(data++);
-          float r = *(data++);
-          if (header->imageSpec.bitsPerPixel == 32) {
-            data++;
-          }
-          color = makeVec3(r/255.0f, g/255.0f, b/255.0f);
-        } else if (header->imageType == TGADT_RLE_BW) {
-          float c = *(data++);
-          color = makeVec3(c/255.0f, c/255.0f, c/255.0f);
-        }
-        *(tex++) = color;
-      }
+  HANDLE startSemaphore;
+  HANDLE doneEvent;
+  PlatformWorkCallback *callback;
+  void *data;
+  volatile LONG numBusy;
+  int numWorkers;
+} WorkerPool;
+
+WorkerPool workerPool;
+
+DWORD WINAPI workerThreadProc(LPVOID param) {
+  int workerIndex = (int)(intptr_t)param;
+  WorkerPool *pool = &workerPool;
+  for (;;) {
+    WaitForSingleObject(pool->startSemaphore, INFINITE);
+    pool->callback(pool->data, workerIndex);
+    if (InterlockedDecrement(&pool->numBusy) == 0) {
+      SetEvent(pool->doneEvent);
     }
   }
-
-  free(fileContents);
-  return result;
 }
 
-#pragma pack(push, 1)
-typedef struct {
-  char signature[2];
-  u32 fileSize;
-  u16 reserved1;
-  u16 reserved2;
-  u32 imageDataOffset;
-} BitmapFileHeader;
-
-typedef struct {
-  u32 dibHeaderSize;
-  u32 width;
-  u32 height;
-  u16 planes;
-  u16 bitsPerPixel;
-  u32 compression;
-  u32 imageSize;
-  u32 xPixelsPerMeter;
-  u32 yPixelsPerMeter;
-  u32 colorsInColorTable;
-  u32 importantColorCount;
-} DIBHeader;
-
-typedef struct {
-  BitmapFileHeader fileHeader;
-  DIBHeader dibHeader;
-} BMPMainHeader;
-#pragma pack(pop)
-
-Texture readBMPFile(char *filePath) {
-  Texture result;
-  BOOL success;
-
-  HANDLE fileHandle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  assert(fileHandle != INVALID_HANDLE_VALUE);
-
-  LARGE_INTEGER fileSize;
-  success = GetFileSizeEx(fileHandle, &fileSize);
-  assert(success);
-
-  u8 *fileContents = malloc(fileSize.LowPart);
-
-  DWORD numBytesRead;
-  success = ReadFile(fileHandle, fileContents, fileSize.LowPart, &numBytesRead, NULL);
-  assert(success);
-  assert(numBytesRead == fileSize.LowPart);
-
-  BMPMainHeader *header = (BMPMainHeader *)fileContents;
-  u8 *data = fileContents + header->fileHeader.imageDataOffset;
-  result.width = header->dibHeader.width;
-  result.height = header->dibHeader.height;
-  result.pixels = malloc(result.width * result.height * sizeof(*result.pixels));
-  Vec3 *tex = result.pixels;
-  Vec3 *texEnd = result.pixels + (result.width*result.height);
-
-  while (tex < texEnd) {
-    Vec3 color;
-    float b = *(data++);
-    float g = *(data++);
-    float r = *(data++);
-    color = makeVec3(r/255.0f, g/255.0f, b/255.0f);
-    *(tex++) = color;
+void initWorkers(void) {
+  WorkerPool *pool = &workerPool;
+  SYSTEM_INFO systemInfo;
+  GetSystemInfo(&systemInfo);
+  pool->numWorkers = systemInfo.dwNumberOfProcessors;
+  if (pool->numWorkers > MAX_WORKERS) pool->numWorkers = MAX_WORKERS;
+  pool->startSemaphore = CreateSemaphore(NULL, 0, MAX_WORKERS, NULL);
+  pool->doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  for (int i = 1; i < pool->numWorkers; ++i) {
+    HANDLE thread = CreateThread(NULL, 0, workerThreadProc, (LPVOID)(intptr_t)i, 0, NULL);
+    assert(thread);
+    CloseHandle(thread);
   }
-
-  free(fileContents);
-  return result;
 }
 
-float zBuffer[BACKBUFFER_WIDTH*BACKBUFFER_HEIGHT];
-bool isTextured = true;
-bool normalMapEnabled = true;
-Vec3 lightDir;
-
-void drawTriangleBarycentric(float x0, float y0, float z0, float u0, float v0,
-                             float x1, float y1, float z1, float u1, float v1,
-                             float x2, float y2, float z2, float u2, float v2,
-                             Texture texture, Texture normalMap) {
-  float minX = x0;
-  if (x1 < minX) minX = x1;
-  if (x2 < minX) minX = x2;
-
-  float minY = y0;
-  if (y1 < minY) minY = y1;
-  if (y2 < minY) minY = y2;
-
-  float maxX = x0;
-  if (x1 > maxX) maxX = x1;
-  if (x2 > maxX) maxX = x2;
-
-  float maxY = y0;
-  if (y1 > maxY) maxY = y1;
-  if (y2 > maxY) maxY = y2;
-
-  Vec3 A = makeVec3(x0, y0, 0);
-  Vec3 B = makeVec3(x1, y1, 0);
-  Vec3 C = makeVec3(x2, y2, 0);
-
-  int minXi = (int)(minX + 0.5f);
-  int maxXi = (int)(maxX + 0.5f);
-  int minYi = (int)(minY + 0.5f);
-  int maxYi = (int)(maxY + 0.5f);
-
-  for (int y = minYi; y <= maxYi; ++y) {
-    for (int x = minXi; x <= maxXi; ++x) {
-      if (x < 0 || x >= BACKBUFFER_WIDTH) continue;
-      if (y < 0 || y >= BACKBUFFER_HEIGHT) continue;
-      Vec3 p = makeVec3((float)x, (float)y, 0);
-      Vec3 b = getBarycentricCoords(A, B, C, p);
-      if (b.x < 0 || b.y < 0 || b.z < 0) continue;
-      float z = z0*b.x + z1*b.y + z2*b.z;
-      int i = x + BACKBUFFER_WIDTH*y;
-      assert(i >= 0 && i < BACKBUFFER_WIDTH*BACKBUFFER_HEIGHT);
-      if (z > zBuffer[i]) {
-        zBuffer[i] = z;
-
-        // texture
-        float u = u0*b.x + u1*b.y + u2*b.z;
-        float v = v0*b.x + v1*b.y + v2*b.z;
-        int tx = (int)(u*(texture.width-1));
-        int ty = (int)(v*(texture.height-1));
-        Vec3 texColor = texture.pixels[tx + ty*texture.width];
-
-        assert(normalMap.width == texture.width);
-        assert(normalMap.height == texture.height);
-        Vec3 normal = normalMap.pixels[tx + ty*texture.width];
-        normal = normalizeVec3(normal);
-
-        float intensity = -dotVec3(normal, lightDir);
-        if (intensity < 0) intensity = 0;
+int platformGetWorkerCount(void) {
+  return workerPool.numWorkers;
+}
 
-#if 0
-        if (intensity > 0.75f) intensity = 1.0f;
-        else if (intensity > 0.5f) intensity = 0.75f;
-        else if (intensity > 0.25f) intensity = 0.5f;
-        else if (intensity > 0) intensity = 0.25f;
-#endif
+void platformRunOnWorkers(PlatformWorkCallback *callback, void *data) {
+  WorkerPool *pool = &workerPool;
+  if (pool->numWorkers > 1) {
+    pool->callback = callback;
+    pool->data = data;
+    pool->numBusy = pool->numWorkers-1;
+    ReleaseSemaphore(pool->startSemaphore, pool->numWorkers-1, NULL);
+  }
 
-        Vec3 color;
+  callback(data, 0);
 
-        if (isTextured) {
-          if (normalMapEnabled) {
-            color = scaleVec3(texColor, intensity);
-          } else {
-            color = texColor;
-          }
-        } else {
-          color = makeVec3(intensity,intensity,intensity);
-        }
-        setPixel(x, y, color);
-      }
-    }
+  if (pool->numWorkers > 1) {
+    WaitForSingleObject(pool->doneEvent, INFINITE);
   }
 }
 
-typedef struct {
-  int v[3];
-  int vt[3];
-  int vn[3];
-} Face;
-
-#define NUM_VERTICES 1258
-Vec3 vertices[NUM_VERTICES];
-Vec3 normals[NUM_VERTICES];
-
-#define NUM_FACES 2492
-Face faces[NUM_FACES];
-
-#define NUM_TEX_VERTS 1339
-Vec3 texVerts[NUM_TEX_VERTS];
-
-void readObjFile() {
-  BOOL success;
-
-  HANDLE fileHandle = CreateFile("african_head.obj", GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  assert(fileHandle != INVALID_HANDLE_VALUE);
-
-  LARGE_INTEGER fileSize;
-  success = GetFileSizeEx(fileHandle, &fileSize);
-  assert(success);
-
-  char *fileContents = malloc(fileSize.LowPart);
-
-  DWORD numBytesRead;
-  success = ReadFile(fileHandle, fileContents, fileSize.LowPart, &numBytesRead, NULL);
-  assert(success);
-  assert(numBytesRead == fileSize.LowPart);
-
-  char *p = fileContents;
-  char *end = fileContents + fileSize.LowPart;
-
-  Vec3 *v = vertices;
-  Vec3 *vt = texVerts;
-  Vec3 *vn = normals;
-  Face *f = faces;
-
-  while (p < end) {
-    char line[64];
-    int lineSize = 0;
-
-    while (*p != '\n' && p < end) {
-      line[lineSize++] = *(p++);
-    }
-    line[lineSize] = '\0';
-    ++p;
-
-    if (lineSize > 2) {
-      if (line[0] == 'v' && line[1] == ' ') {
-        int numAssigned = sscanf_s(line, "v %f %f %f", &v->x, &v->y, &v->z);
-        assert(numAssigned == 3);
-        ++v;
-      }
-      else if (line[0] == 'v' && line[1] == 't' && line[2] == ' ') {
-        int numAssigned = sscanf_s(line, "vt %f %f %f", &vt->x, &vt->y, &vt->z);
-        assert(numAssigned == 3);
-        ++vt;
-      }
-      else if (line[0] == 'v' && line[1] == 'n' && line[2] == ' ') {
-        int numAssigned = sscanf_s(line, "vn %f %f %f", &vn->x, &vn->y, &vn->z);
-        assert(numAssigned == 3);
-        ++vn;
-      }
-      else if (line[0] == 'f' && line[1] == ' ') {
-        int numAssigned = sscanf_s(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &f->v[0], &f->vt[0], &f->vn[0], &f->v[1], &f->vt[1], &f->vn[1], &f->v[2], &f->vt[2], &f->vn[2]);
-        assert(numAssigned == 9);
-        f->v[0] -= 1;
-        f->v[1] -= 1;
-        f->v[2] -= 1;
-        f->vt[0] -= 1;
-        f->vt[1] -= 1;
-        f->vt[2] -= 1;
-        f->vn[0] -= 1;
-        f->vn[1] -= 1;
-        f->vn[2] -= 1;
-        assert(f->v[0] >= 0 && f->v[0] < NUM_VERTICES);
-        assert(f->v[1] >= 0 && f->v[1] < NUM_VERTICES);
-        assert(f->v[2] >= 0 && f->v[2] < NUM_VERTICES);
-        assert(f->vt[0] >= 0 && f->vt[0] < NUM_TEX_VERTS);
-        assert(f->vt[1] >= 0 && f->vt[1] < NUM_TEX_VERTS);
-        assert(f->vt[2] >= 0 && f->vt[2] < NUM_TEX_VERTS);
-        assert(f->vn[0] >= 0 && f->vn[0] < NUM_VERTICES);
-        assert(f->vn[1] >= 0 && f->vn[1] < NUM_VERTICES);
-        assert(f->vn[2] >= 0 && f->vn[2] < NUM_VERTICES);
-        ++f;
-      }
-    }
-  }
+i32 platformAtomicIncrement(volatile i32 *value) {
+  return InterlockedIncrement((volatile LONG *)value);
+}
 
-  assert(v == vertices + NUM_VERTICES);
-  assert(f == faces + NUM_FACES);
+#if 1
+#define BACKBUFFER_WIDTH 500
+#define WINDOW_SCALE 1
+#else
+#define BACKBUFFER_WIDTH 100
+#define WINDOW_SCALE 8
+#endif
 
-  free(fileContents);
-}
+#define BACKBUFFER_HEIGHT BACKBUFFER_WIDTH
 
-typedef enum {BUTTON_EXIT, BUTTON_ACTION, BUTTON_F1, BUTTON_F2, BUTTON_F3, BUTTON_F4, BUTTON_F5, BUTTON_F6, BUTTON_F7, BUTTON_COUNT} Button;
+typedef enum {BUTTON_EXIT, BUTTON_ACTION, BUTTON_F1, BUTTON_F2, BUTTON_F3, BUTTON_F4, BUTTON_F5, BUTTON_F6, BUTTON_F7, BUTTON_F8, BUTTON_F9, BUTTON_F11, BUTTON_F12, BUTTON_COUNT} Button;
 
 bool buttonIsDown[BUTTON_COUNT];
 bool buttonWasDown[BUTTON_COUNT];
@@ -705,74 +167,6 @@ bool buttonIsPressed(Button button) {
   return buttonIsDown[button] && !buttonWasDown[button];
 }
 
-Mat4 getLookAtMat(Vec3 eye, Vec3 center, Vec3 up) {
-  Vec3 z = normalizeVec3(subVec3(eye, center));
-  Vec3 x = normalizeVec3(crossVec3(up, z));
-  Vec3 y = crossVec3(z, x);
-  Mat4 mInv = makeMat4(x.x, x.y, x.z, 0,
-                       y.x, y.y, y.z, 0,
-                       z.x, z.y, z.z, 0,
-                         0,   0,   0, 1);
-  Mat4 tr = makeMat4(1, 0, 0, -center.x,
-                     0, 1, 0, -center.y,
-                     0, 0, 1, -center.z,
-                     0, 0, 0,         1);
-  return mulMat4(mInv, tr);
-}
-
-Texture fontTexture;
-
-void drawTexture(Texture texture, bool stretch) {
-  for (u32 i = 0; i < texture.width*texture.height; ++i) {
-    if (stretch) {
-      f32 tx = (f32)(i % texture.width) / (texture.width-1);
-      f32 ty = (f32)(i / texture.width) / (texture.height-1);
-      u32 x = (u32)(tx*(BACKBUFFER_WIDTH-1));
-      u32 y = (u32)(ty*(BACKBUFFER_HEIGHT-1));
-      Vec3 color = texture.pixels[i];
-      setPixel(x, y, color);
-    } else {
-      int x = i % texture.width;
-      int y = i / texture.width;
-      Vec3 color = texture.pixels[i];
-      setPixel(x, y, color);
-    }
-  }
-}
-
-int charWidth = 8;
-int charHeight = 16;
-
-void drawLetter(char letter, int destX, int destY) {
-  int numCols = fontTexture.width / charWidth;
-  //int numRows = fontTexture.height / charHeight;
-  int row = letter / numCols;
-  int col = letter % numCols;
-  for (int i = 0; i < charHeight; ++i) {
-    for (int j = 0; j < charWidth; ++j) {
-      int tx = col * charWidth + j;
-      int ty = fontTexture.height - (row * charHeight + i);
-      Vec3 c = fontTexture.pixels[tx + ty*fontTexture.width];
-      if (c.x == 1.0f) {
-        int x = destX + j;
-        int y = destY - i;
-        setPixel(x, y, c);
-      }
-    }
-  }
-}
-
-void drawText(int destX, int destY, char *format, ...) {
-  va_list argptr;
-  va_start(argptr, format);
-  char str[1024];
-  vsprintf_s(str, sizeof(str), format, argptr);
-  va_end(argptr);
-
-  for (int ch = 0; str[ch]; ++ch) {
-    drawLetter(str[ch], destX + charWidth*ch, BACKBUFFER_HEIGHT-destY);
-  }
-}
 
 LRESULT CALLBACK wndProc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lparam) {
   switch (msg) {
@@ -787,7 +181,14 @@ LRESULT CALLBACK wndProc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 
 int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdShow) {
   UNREFERENCED_PARAMETER(prevInst);
-  UNREFERENCED_PARAMETER(cmdLine);
+
+  // a "WxH" command line overrides the backbuffer size
+  int width, height;
+  if (sscanf(cmdLine, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0 ||
+      width > MAX_BACKBUFFER_SIZE || height > MAX_BACKBUFFER_SIZE) {
+    width = BACKBUFFER_WIDTH;
+    height = BACKBUFFER_HEIGHT;
+  }
 
   WNDCLASS wndClass = {0};
   wndClass.style = CS_HREDRAW | CS_VREDRAW;
@@ -798,8 +199,8 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
   RegisterClass(&wndClass);
 
   RECT crect = {0};
-  crect.right = WINDOW_WIDTH;
-  crect.bottom = WINDOW_HEIGHT;
+  crect.right = width * WINDOW_SCALE;
+  crect.bottom = height * WINDOW_SCALE;
 
   DWORD wndStyle = WS_OVERLAPPEDWINDOW | WS_VISIBLE;
   AdjustWindowRect(&crect, wndStyle, 0);
@@ -814,11 +215,14 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
   BITMAPINFO bitmapInfo;
 
   {
-    backbuffer = malloc(BACKBUFFER_BYTES);
+    initWorkers();
+    initPixelKernels(SIMD_AUTO);
+    initVertexKernels(SIMD_AUTO);
+    if (!initBackbuffer(width, height)) return 1;
 
     bitmapInfo.bmiHeader.biSize = sizeof(bitmapInfo.bmiHeader);
-    bitmapInfo.bmiHeader.biWidth = BACKBUFFER_WIDTH;
-    bitmapInfo.bmiHeader.biHeight = BACKBUFFER_HEIGHT;
+    bitmapInfo.bmiHeader.biWidth = backbufferWidth;
+    bitmapInfo.bmiHeader.biHeight = backbufferHeight;
     bitmapInfo.bmiHeader.biPlanes = 1;
     bitmapInfo.bmiHeader.biBitCount = 32;
     bitmapInfo.bmiHeader.biCompression = BI_RGB;
@@ -842,21 +246,29 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
   int mousePosX = 0;
   int mousePosY = 0;
 
-  Vec3 cameraPos = makeVec3(1.0f, 1.0f, 4.0f);
-  Vec3 cameraTarget = makeVec3(0, 0, 0);
-  bool isCameraEnabled = true;
+  Camera camera;
+  camera.pos = makeVec3(1.0f, 1.0f, 4.0f);
+  camera.target = makeVec3(0, 0, 0);
+  camera.perspectiveEnabled = true;
+  camera.isCameraEnabled = true;
   //
 
-  readObjFile();
+  Mesh mesh = readMesh("african_head.obj");
+  if (!mesh.faces) return 1;
+  buildLodChain(&mesh);
 
   Texture texture = readTGAFile("african_head_diffuse.tga");
   Texture normalMap = readTGAFile("african_head_nm.tga");
+  if (!texture.pixels || !normalMap.pixels) return 1;
   //Texture specularMap = readTGAFile("african_head_spec.tga");
-  fontTexture = readBMPFile("font.bmp");
+  loadFont("font.bmp");
 
   bool gameIsRunning = true;
+  bool showProfile = false;
 
   while (gameIsRunning) {
+    PROFILE_NEXT_FRAME();
+    PROFILE_BEGIN(frame, 0);
     perfcPrev = perfc;
     QueryPerformanceCounter(&perfc);
     realDt = dt = (float)(perfc.QuadPart - perfcPrev.QuadPart) / (float)perfcFreq.QuadPart;
@@ -904,6 +316,18 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
               case VK_F7:
                 buttonIsDown[BUTTON_F7] = isDown;
                 break;
+              case VK_F8:
+                buttonIsDown[BUTTON_F8] = isDown;
+                break;
+              case VK_F9:
+                buttonIsDown[BUTTON_F9] = isDown;
+                break;
+              case VK_F11:
+                buttonIsDown[BUTTON_F11] = isDown;
+                break;
+              case VK_F12:
+                buttonIsDown[BUTTON_F12] = isDown;
+                break;
             }
           }
           break;
@@ -927,9 +351,8 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
       gameIsRunning = false;
     }
 
-    static bool perspectiveEnabled = true;
     if (buttonIsPressed(BUTTON_F1)) {
-      perspectiveEnabled = !perspectiveEnabled;
+      camera.perspectiveEnabled = !camera.perspectiveEnabled;
     }
     if (buttonIsPressed(BUTTON_F4)) {
       isTextured = !isTextured;
@@ -941,18 +364,37 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
       if (normalMapEnabled) debugPrint("normal map on\n");
       else debugPrint("normal map off\n");
     }
+    if (buttonIsPressed(BUTTON_F7)) {
+      textureFilter = (textureFilter + 1) % TEXTURE_FILTER_COUNT;
+      debugPrint("texture filter: %s\n", textureFilterNames[textureFilter]);
+    }
+    if (buttonIsPressed(BUTTON_F8)) {
+      backfaceCullingEnabled = !backfaceCullingEnabled;
+      if (backfaceCullingEnabled) debugPrint("back-face culling on\n");
+      else debugPrint("back-face culling off\n");
+    }
+    if (buttonIsPressed(BUTTON_F9)) {
+      deferredShading = !deferredShading;
+      if (deferredShading) debugPrint("deferred shading on\n");
+      else debugPrint("deferred shading off\n");
+    }
+    if (buttonIsPressed(BUTTON_F11)) {
+      showProfile = !showProfile;
+    }
+    if (buttonIsPressed(BUTTON_F12)) {
+      if (writeProfileTrace("trace.json")) debugPrint("wrote trace.json\n");
+      else debugPrint("can't write trace.json\n");
+    }
 
     {
       POINT p;
       GetCursorPos(&p);
       ScreenToClient(wnd, &p);
       mousePosX = (int) ((float)p.x / (float)WINDOW_SCALE);
-      mousePosY = (BACKBUFFER_HEIGHT-1) - (int) ((float)p.y / (float)WINDOW_SCALE);
+      mousePosY = (backbufferHeight-1) - (int) ((float)p.y / (float)WINDOW_SCALE);
       //debugPrint("%d,%d\n", mousePosX, mousePosY);
     }
 
-    drawFilledRect(0, 0, BACKBUFFER_WIDTH-1, BACKBUFFER_HEIGHT-1, makeVec3(135.0f/255.0f, 181.0f/255.0f, 218.0f/255.0f));
-
 #if 0
     drawLine(13, 20, 80, 40, WHITE);
     drawLine(85, 40, 18, 20, RED);
@@ -972,118 +414,43 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
 #endif
 
 #if 0
-    for (int i = 0; i < NUM_FACES; ++i) {
-      Face *f = &faces[i];
+    for (u32 i = 0; i < mesh.numFaces; ++i) {
+      Face *f = &mesh.faces[i];
       for (int j = 0; j < 3; ++j) {
-        Vec3 *v0 = &vertices[f->v[j]];
-        Vec3 *v1 = &vertices[f->v[(j+1)%3]];
-        int x0 = (int)((v0->x + 1.0f) * (BACKBUFFER_WIDTH-1) / 2.0f);
-        int y0 = (int)((v0->y + 1.0f) * (BACKBUFFER_HEIGHT-1) / 2.0f);
-        int x1 = (int)((v1->x + 1.0f) * (BACKBUFFER_WIDTH-1) / 2.0f);
-        int y1 = (int)((v1->y + 1.0f) * (BACKBUFFER_HEIGHT-1) / 2.0f);
+        Vec3 *v0 = &mesh.positions[f->v[j]];
+        Vec3 *v1 = &mesh.positions[f->v[(j+1)%3]];
+        int x0 = (int)((v0->x + 1.0f) * (backbufferWidth-1) / 2.0f);
+        int y0 = (int)((v0->y + 1.0f) * (backbufferHeight-1) / 2.0f);
+        int x1 = (int)((v1->x + 1.0f) * (backbufferWidth-1) / 2.0f);
+        int y1 = (int)((v1->y + 1.0f) * (backbufferHeight-1) / 2.0f);
         drawLine(x0, y0, x1, y1, WHITE);
       }
     }
 #endif
 
-    for (int i = 0; i < BACKBUFFER_WIDTH*BACKBUFFER_HEIGHT; ++i) {
-      zBuffer[i] = -9999.0f;
-    }
-
 #if 1
     float cameraStep = 0.5f;
-    lightDir = normalizeVec3(makeVec3(-1,0,-0.4f));
     if (buttonIsDown[BUTTON_F3]) {
-      cameraPos.z += cameraStep;
-      debugPrint("cameraPos.z: %f\n", cameraPos.z);
+      camera.pos.z += cameraStep;
+      debugPrint("cameraPos.z: %f\n", camera.pos.z);
     }
     if (buttonIsDown[BUTTON_F2]) {
-      cameraPos.z -= cameraStep;
-      debugPrint("cameraPos.z: %f\n", cameraPos.z);
+      camera.pos.z -= cameraStep;
+      debugPrint("cameraPos.z: %f\n", camera.pos.z);
     }
     if (buttonIsPressed(BUTTON_F6)) {
-      isCameraEnabled = !isCameraEnabled;
-      debugPrint("isCameraEnabled: %d\n", isCameraEnabled);
-    }
-    float cameraZ = lengthVec3(subVec3(cameraPos, cameraTarget));
-    float r = perspectiveEnabled ? -1.0f/cameraZ : 0.0f;
-    Mat4 projectionMatrix = makeMat4(1,0,0,0,
-                                     0,1,0,0,
-                                     0,0,1,0,
-                                     0,0,r,1);
-    Mat4 viewMat = isCameraEnabled ? getLookAtMat(cameraPos, cameraTarget, makeVec3(0, 1, 0)) : getIdentityMat4();
-
-    Mat4 viewportMat;
-    {
-      float w = BACKBUFFER_WIDTH-1;
-      float h = BACKBUFFER_HEIGHT-1;
-      float d = 255.0f; //map z from [-1,1] to [0,255]
-      viewportMat = makeMat4(w/2.0f,      0,      0, w/2.0f,
-                                  0, h/2.0f,      0, h/2.0f,
-                                  0,      0, d/2.0f, d/2.0f,
-                                  0,      0,      0,      1);
+      camera.isCameraEnabled = !camera.isCameraEnabled;
+      debugPrint("isCameraEnabled: %d\n", camera.isCameraEnabled);
     }
 
-    Mat4 transformMat = mulMat4(viewportMat, mulMat4(projectionMatrix, viewMat));
-    /* Mat4 normalTransformMat = invertMat4(transposeMat4(transformMat)); */
-
-    for (int i = 0; i < NUM_FACES; ++i) {
-      Face *f = &faces[i];
-
-      Vec3 v0orig = vertices[f->v[0]];
-      Vec3 v1orig = vertices[f->v[1]];
-      Vec3 v2orig = vertices[f->v[2]];
-
-      Vec4 v04 = makeVec4(v0orig.x, v0orig.y, v0orig.z, 1.0f);
-      Vec4 v14 = makeVec4(v1orig.x, v1orig.y, v1orig.z, 1.0f);
-      Vec4 v24 = makeVec4(v2orig.x, v2orig.y, v2orig.z, 1.0f);
-
-      Vec4 v0h = mulMatVec4(transformMat, v04);
-      Vec4 v1h = mulMatVec4(transformMat, v14);
-      Vec4 v2h = mulMatVec4(transformMat, v24);
-
-      v0h = makeVec4(v0h.x/v0h.w, v0h.y/v0h.w, v0h.z/v0h.w, v0h.w/v0h.w);
-      v1h = makeVec4(v1h.x/v1h.w, v1h.y/v1h.w, v1h.z/v1h.w, v1h.w/v1h.w);
-      v2h = makeVec4(v2h.x/v2h.w, v2h.y/v2h.w, v2h.z/v2h.w, v2h.w/v2h.w);
-
-      Vec3 *vt0 = &texVerts[f->vt[0]];
-      Vec3 *vt1 = &texVerts[f->vt[1]];
-      Vec3 *vt2 = &texVerts[f->vt[2]];
-
-      float x0 = v0h.x;
-      float y0 = v0h.y;
-      float x1 = v1h.x;
-      float y1 = v1h.y;
-      float x2 = v2h.x;
-      float y2 = v2h.y;
-
-      /* Vec4 n04 = mulMatVec4(normalTransformMat, makeVec4(n0.x, n0.y, n0.z, 0.0f)); */
-      /* Vec4 n14 = mulMatVec4(normalTransformMat, makeVec4(n1.x, n1.y, n1.z, 0.0f)); */
-      /* Vec4 n24 = mulMatVec4(normalTransformMat, makeVec4(n2.x, n2.y, n2.z, 0.0f)); */
-
-      /* n0 = makeVec3(n04.x, n04.y, n04.z); */
-      /* n1 = makeVec3(n14.x, n14.y, n14.z); */
-      /* n2 = makeVec3(n24.x, n24.y, n24.z); */
-
-      /* n0 = normalizeVec3(n0); */
-      /* n1 = normalizeVec3(n1); */
-      /* n2 = normalizeVec3(n2); */
-
-      /* Vec4 lightDir4 = makeVec4(lightDir.x, lightDir.y, lightDir.z, 1.0f); */
-      /* lightDir4 = mulMatVec4(transformMat, lightDir4); */
-      /* Vec3 lightDirNew = makeVec3(lightDir4.x, lightDir4.y, lightDir4.z); */
-
-      drawTriangleBarycentric(x0, y0, v0h.z, vt0->x, vt0->y,
-                              x1, y1, v1h.z, vt1->x, vt1->y,
-                              x2, y2, v2h.z, vt2->x, vt2->y,
-                              texture, normalMap);
-    }
+    renderFrame(&camera, &mesh, texture, normalMap);
 #endif
 
     //drawTexture(font, false);
 
-    drawText(0, 0, "dt: %f", realDt);
-    drawText(0, charHeight, "fps: %f", 1.0f/realDt);
+    PROFILE_BEGIN(hud, 0);
+    drawHud(realDt, showProfile);
+    PROFILE_END(hud, 0);
 
 #if 0
     drawTriangle(10, 70, 50, 160, 70, 80, RED);
@@ -1091,10 +458,13 @@ int CALLBACK WinMain(HINSTANCE inst, HINSTANCE prevInst, LPSTR cmdLine, int cmdS
     drawTriangle(180, 150, 120, 160, 130, 180, GREEN);
 #endif
 
+    PROFILE_BEGIN(present, 0);
     StretchDIBits(deviceContext,
-                  0, 0, WINDOW_WIDTH, WINDOW_HEIGHT,
-                  0, 0, BACKBUFFER_WIDTH, BACKBUFFER_HEIGHT,
+                  0, 0, backbufferWidth * WINDOW_SCALE, backbufferHeight * WINDOW_SCALE,
+                  0, 0, backbufferWidth, backbufferHeight,
                   backbuffer, &bitmapInfo,
                   DIB_RGB_COLORS, SRCCOPY);
+    PROFILE_END(present, 0);
+    PROFILE_END(frame, 0);
   }
 }
@@ -0,0 +1,34 @@
+// Converts an OBJ file to the binary .mesh format (see MeshFileHeader in
+// renderer.c) and reports how long each one takes to load.
+
+#include "posix_platform.c"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: obj2mesh INPUT.obj OUTPUT.mesh\n");
+    return 1;
+  }
+
+  initWorkers((int)sysconf(_SC_NPROCESSORS_ONLN));
+
+  f64 objStart = platformGetSeconds();
+  Mesh mesh = readObjFile(argv[1]);
+  f64 objTime = platformGetSeconds() - objStart;
+
+  if (!writeMeshFile(argv[2], &mesh)) {
+    fprintf(stderr, "can't write %s\n", argv[2]);
+    return 1;
+  }
+  printf("%s: %u positions, %u uvs, %u normals, %u faces\n", argv[1],
+         mesh.numPositions, mesh.numTexCoords, mesh.numNormals, mesh.numFaces);
+  freeMesh(&mesh);
+
+  f64 meshStart = platformGetSeconds();
+  mesh = readMeshFile(argv[2]);
+  f64 meshTime = platformGetSeconds() - meshStart;
+  if (!mesh.faces) return 1;
+  freeMesh(&mesh);
+
+  printf("load times: obj %.3f ms, mesh %.3f ms\n", objTime*1000.0, meshTime*1000.0);
+  return 0;
+}
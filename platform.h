@@ -0,0 +1,30 @@
+// Services the renderer core needs from the host. Each platform layer
+// (main.c for Win32, posix_platform.c for POSIX) includes renderer.c and then
+// implements these.
+
+typedef struct {
+  void *contents;
+  u32 size;
+} PlatformFile;
+
+void debugPrint(char *format, ...);
+
+// Returns a file with contents == NULL if the file can't be opened.
+PlatformFile platformReadEntireFile(char *filePath);
+void platformFreeFile(PlatformFile file);
+// Maps a file read-only instead of copying it. Same failure convention.
+PlatformFile platformMapFile(char *filePath);
+void platformUnmapFile(PlatformFile file);
+bool platformWriteEntireFile(char *filePath, void *contents, u32 size);
+
+f64 platformGetSeconds(void);
+
+// Worker pool. platformRunOnWorkers calls callback once on every worker
+// thread (the calling thread is worker 0) and returns when all are done.
+// Callbacks are expected to pull their own work items with
+// platformAtomicIncrement.
+typedef void PlatformWorkCallback(void *data, int workerIndex);
+
+int platformGetWorkerCount(void);
+void platformRunOnWorkers(PlatformWorkCallback *callback, void *data);
+i32 platformAtomicIncrement(volatile i32 *value); // returns the new value
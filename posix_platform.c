@@ -0,0 +1,180 @@
+// POSIX platform layer shared by the command-line tools (headless.c and the
+// benchmarks). Includes the renderer core and implements platform.h for it.
+
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "renderer.c"
+
+void debugPrint(char *format, ...) {
+  va_list argptr;
+  va_start(argptr, format);
+  vfprintf(stderr, format, argptr);
+  va_end(argptr);
+}
+
+PlatformFile platformReadEntireFile(char *filePath) {
+  PlatformFile result = {0};
+
+  FILE *fileHandle = fopen(filePath, "rb");
+  if (!fileHandle) return result;
+
+  fseek(fileHandle, 0, SEEK_END);
+  long fileSize = ftell(fileHandle);
+  fseek(fileHandle, 0, SEEK_SET);
+  if (fileSize < 0 || fileSize > UINT32_MAX) {
+    fclose(fileHandle);
+    return result;
+  }
+
+  result.contents = malloc(fileSize);
+  result.size = (u32)fileSize;
+
+  if (fread(result.contents, 1, fileSize, fileHandle) != (size_t)fileSize) {
+    free(result.contents);
+    result.contents = NULL;
+    result.size = 0;
+  }
+
+  fclose(fileHandle);
+  return result;
+}
+
+void platformFreeFile(PlatformFile file) {
+  free(file.contents);
+}
+
+PlatformFile platformMapFile(char *filePath) {
+  PlatformFile result = {0};
+
+  int fd = open(filePath, O_RDONLY);
+  if (fd < 0) return result;
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+    void *contents = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (contents != MAP_FAILED) {
+      result.contents = contents;
+      result.size = (u32)fileStat.st_size;
+    }
+  }
+
+  // the mapping keeps the file alive
+  close(fd);
+  return result;
+}
+
+void platformUnmapFile(PlatformFile file) {
+  munmap(file.contents, file.size);
+}
+
+bool platformWriteEntireFile(char *filePath, void *contents, u32 size) {
+  FILE *fileHandle = fopen(filePath, "wb");
+  if (!fileHandle) return false;
+  size_t numBytesWritten = fwrite(contents, 1, size, fileHandle);
+  fclose(fileHandle);
+  return numBytesWritten == size;
+}
+
+f64 platformGetSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+#define MAX_WORKERS 256
+
+#if PROFILER && MAX_WORKERS > PROFILE_MAX_THREADS
+#error "the profiler needs a ring per worker"
+#endif
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t startCond;
+  pthread_cond_t doneCond;
+  PlatformWorkCallback *callback;
+  void *data;
+  u32 generation;
+  int numBusy;
+  int numWorkers;
+} WorkerPool;
+
+WorkerPool workerPool;
+
+void *workerThreadProc(void *param) {
+  int workerIndex = (int)(intptr_t)param;
+  WorkerPool *pool = &workerPool;
+  u32 seenGeneration = 0;
+  for (;;) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->generation == seenGeneration) {
+      pthread_cond_wait(&pool->startCond, &pool->mutex);
+    }
+    seenGeneration = pool->generation;
+    PlatformWorkCallback *callback = pool->callback;
+    void *data = pool->data;
+    pthread_mutex_unlock(&pool->mutex);
+
+    callback(data, workerIndex);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->numBusy == 0) {
+      pthread_cond_signal(&pool->doneCond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }
+  return NULL;
+}
+
+void initWorkers(int numWorkers) {
+  WorkerPool *pool = &workerPool;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->startCond, NULL);
+  pthread_cond_init(&pool->doneCond, NULL);
+  pool->numWorkers = numWorkers;
+  for (int i = 1; i < numWorkers; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, workerThreadProc, (void *)(intptr_t)i)) {
+      // run with the workers there are
+      pool->numWorkers = i;
+      break;
+    }
+    pthread_detach(thread);
+  }
+}
+
+int platformGetWorkerCount(void) {
+  return workerPool.numWorkers;
+}
+
+void platformRunOnWorkers(PlatformWorkCallback *callback, void *data) {
+  WorkerPool *pool = &workerPool;
+  if (pool->numWorkers > 1) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->callback = callback;
+    pool->data = data;
+    pool->numBusy = pool->numWorkers-1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  callback(data, 0);
+
+  if (pool->numWorkers > 1) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->numBusy > 0) {
+      pthread_cond_wait(&pool->doneCond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+i32 platformAtomicIncrement(volatile i32 *value) {
+  return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
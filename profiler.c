@@ -0,0 +1,209 @@
+//
+// Frame profiler: nestable named timers and per-frame counters, recorded
+// into one ring buffer per worker thread (so workers never share a cache
+// line or a lock) and dumped as Chrome trace_event JSON for chrome://tracing
+// or Perfetto. Build with -DPROFILER=0 and every PROFILE_* macro compiles to
+// nothing.
+//
+//   PROFILE_BEGIN(transform, workerIndex);
+//   ...
+//   PROFILE_END(transform, workerIndex);
+//   PROFILE_COUNTER(pixelsTested, count);
+//
+// Names are identifiers so that BEGIN can declare the scope's start time and
+// END can find it; a scope must begin and end in the same block. Code running
+// outside platformRunOnWorkers passes worker 0, the main thread.
+//
+
+#ifndef PROFILER
+#define PROFILER 1
+#endif
+
+// at least the platform layers' MAX_WORKERS, which they check
+#define PROFILE_MAX_THREADS 256
+// events per thread, a few frames' worth of per-tile scopes
+#define PROFILE_RING_SIZE 65536
+#define PROFILE_MAX_STAGES 32
+
+typedef struct {
+  char *name;
+  f64 begin;
+  f64 end;    // counters: the value
+  u32 frame;
+  u16 depth;  // nesting level of the scope on its thread
+  bool isCounter;
+} ProfileEvent;
+
+typedef struct {
+  ProfileEvent *events;
+  u32 numEvents; // total ever recorded; the ring holds the last PROFILE_RING_SIZE
+  u16 depth;
+  // pad to a cache line so neighbouring threads don't share one
+  u8 padding[64 - sizeof(ProfileEvent *) - sizeof(u32) - sizeof(u16)];
+} ProfileThread;
+
+// The array starts on a cache line too, or every padded entry would
+// straddle two.
+#if defined(_MSC_VER)
+#define CACHE_LINE_ALIGNED __declspec(align(64))
+#else
+#define CACHE_LINE_ALIGNED __attribute__((aligned(64)))
+#endif
+
+CACHE_LINE_ALIGNED ProfileThread profileThreads[PROFILE_MAX_THREADS];
+u32 profileFrame;
+
+ProfileEvent *pushProfileEvent(int thread) {
+  assert(thread >= 0 && thread < PROFILE_MAX_THREADS);
+  ProfileThread *t = &profileThreads[thread];
+  if (!t->events) t->events = malloc(PROFILE_RING_SIZE*sizeof(*t->events));
+  ProfileEvent *e = &t->events[t->numEvents++ % PROFILE_RING_SIZE];
+  e->frame = profileFrame;
+  return e;
+}
+
+f64 beginProfileScope(int thread) {
+  assert(thread >= 0 && thread < PROFILE_MAX_THREADS);
+  ++profileThreads[thread].depth;
+  return platformGetSeconds();
+}
+
+void endProfileScope(char *name, f64 begin, int thread) {
+  f64 end = platformGetSeconds();
+  ProfileEvent *e = pushProfileEvent(thread);
+  e->name = name;
+  e->begin = begin;
+  e->end = end;
+  e->depth = --profileThreads[thread].depth;
+  e->isCounter = false;
+}
+
+// Counters are recorded on the main thread, so they go to worker 0's ring.
+void recordProfileCounter(char *name, f64 value) {
+  ProfileEvent *e = pushProfileEvent(0);
+  e->name = name;
+  e->begin = platformGetSeconds();
+  e->end = value;
+  e->depth = profileThreads[0].depth;
+  e->isCounter = true;
+}
+
+#if PROFILER
+#define PROFILE_BEGIN(name, thread) f64 profileBegin_##name = beginProfileScope(thread)
+#define PROFILE_END(name, thread) endProfileScope(#name, profileBegin_##name, thread)
+#define PROFILE_COUNTER(name, value) recordProfileCounter(#name, (f64)(value))
+#define PROFILE_NEXT_FRAME() (++profileFrame)
+// for counting statements that only the profiler needs
+#define PROFILE_COUNT(counter, n) ((counter) += (n))
+#else
+#define PROFILE_BEGIN(name, thread)
+#define PROFILE_END(name, thread)
+#define PROFILE_COUNTER(name, value)
+#define PROFILE_NEXT_FRAME()
+#define PROFILE_COUNT(counter, n)
+#endif
+
+typedef struct {
+  char *name;
+  f64 seconds; // summed over threads, so per-tile stages are CPU time
+  f64 firstBegin;
+  u32 count;
+  u16 depth;   // nesting level on the lowest numbered thread that ran it
+  bool isCounter;
+} ProfileStage;
+
+// Totals per scope name (and the counters' values) for one frame, in the
+// order they first began. Returns the number of stages.
+int getProfileStages(u32 frame, ProfileStage *stages, int maxStages) {
+  int numStages = 0;
+  for (int thread = 0; thread < PROFILE_MAX_THREADS; ++thread) {
+    ProfileThread *t = &profileThreads[thread];
+    u32 first = t->numEvents > PROFILE_RING_SIZE ? t->numEvents - PROFILE_RING_SIZE : 0;
+    // events are pushed in frame order, so the frame's are a run found from
+    // the newest end without walking the whole ring
+    u32 end = t->numEvents;
+    while (end > first && t->events[(end-1) % PROFILE_RING_SIZE].frame > frame) --end;
+    u32 begin = end;
+    while (begin > first && t->events[(begin-1) % PROFILE_RING_SIZE].frame == frame) --begin;
+    for (u32 i = begin; i < end; ++i) {
+      ProfileEvent *e = &t->events[i % PROFILE_RING_SIZE];
+      int s = 0;
+      // names are string literals, so the pointer identifies the scope
+      while (s < numStages && stages[s].name != e->name) ++s;
+      if (s == numStages) {
+        if (numStages == maxStages) continue;
+        ++numStages;
+        stages[s].name = e->name;
+        stages[s].seconds = 0;
+        stages[s].count = 0;
+        stages[s].firstBegin = e->begin;
+        stages[s].depth = e->depth;
+        stages[s].isCounter = e->isCounter;
+      }
+      ProfileStage *stage = &stages[s];
+      if (e->isCounter) stage->seconds = e->end;
+      else stage->seconds += e->end - e->begin;
+      ++stage->count;
+      if (e->begin < stage->firstBegin) stage->firstBegin = e->begin;
+    }
+  }
+  // scopes are recorded when they end, so parents come after their children
+  for (int i = 1; i < numStages; ++i) {
+    ProfileStage stage = stages[i];
+    int j = i;
+    for (; j > 0 && stages[j-1].firstBegin > stage.firstBegin; --j) stages[j] = stages[j-1];
+    stages[j] = stage;
+  }
+  return numStages;
+}
+
+// Writes every event still in the rings as Chrome trace_event JSON: scopes as
+// complete ("X") events on their thread's track, counters as "C" events.
+// Times are microseconds from the oldest event.
+bool writeProfileTrace(char *filePath) {
+  f64 origin = DBL_MAX;
+  u32 maxEvents = 0;
+  for (int thread = 0; thread < PROFILE_MAX_THREADS; ++thread) {
+    ProfileThread *t = &profileThreads[thread];
+    u32 first = t->numEvents > PROFILE_RING_SIZE ? t->numEvents - PROFILE_RING_SIZE : 0;
+    for (u32 i = first; i < t->numEvents; ++i) {
+      f64 begin = t->events[i % PROFILE_RING_SIZE].begin;
+      if (begin < origin) origin = begin;
+    }
+    maxEvents += t->numEvents - first;
+  }
+
+  // every event fits in this many bytes: the names are short identifiers
+  u32 maxEventSize = 192;
+  u32 capacity = 64 + maxEvents*maxEventSize;
+  char *json = malloc(capacity);
+  u32 size = 0;
+  size += snprintf(json + size, capacity - size, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (int thread = 0; thread < PROFILE_MAX_THREADS; ++thread) {
+    ProfileThread *t = &profileThreads[thread];
+    u32 firstEvent = t->numEvents > PROFILE_RING_SIZE ? t->numEvents - PROFILE_RING_SIZE : 0;
+    for (u32 i = firstEvent; i < t->numEvents; ++i) {
+      ProfileEvent *e = &t->events[i % PROFILE_RING_SIZE];
+      f64 ts = (e->begin - origin)*1e6;
+      if (!first) json[size++] = ',';
+      first = false;
+      if (e->isCounter) {
+        size += snprintf(json + size, capacity - size,
+                         "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"value\":%.17g}}\n",
+                         e->name, ts, thread, e->end);
+      } else {
+        size += snprintf(json + size, capacity - size,
+                         "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"frame\":%u}}\n",
+                         e->name, ts, (e->end - e->begin)*1e6, thread, e->frame);
+      }
+      assert(size < capacity);
+    }
+  }
+  size += snprintf(json + size, capacity - size, "]}\n");
+  assert(size < capacity);
+
+  bool success = platformWriteEntireFile(filePath, json, size);
+  free(json);
+  return success;
+}
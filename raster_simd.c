@@ -0,0 +1,977 @@
+//
+// SSE4.1 (4 wide) and AVX2 (8 wide) versions of drawTriangleRectScalar, the
+// MSAA kernel and the deferred shading kernels, and the runtime choice
+// between them. The lanes are consecutive pixels of a row. Every lane does
+// the same float operations in the same order as the scalar kernels (no FMA,
+// IEEE sqrt and divide), so all three levels produce identical images.
+//
+
+// the shading kernels are indexed by ShadeMode
+PixelKernel **drawTriangleRect = drawTriangleRectScalar;
+PixelKernel **drawTriangleRectMsaa = drawTriangleRectMsaaScalar;
+PixelKernel *drawTriangleRectVisibility = drawTriangleRectVisibilityScalar;
+SpanShader **shadeSpan = shadeSpanScalar;
+ResolveKernel *resolveRow = resolveRowScalar;
+MsaaResolveKernel *resolveMsaaRow = resolveMsaaRowScalar;
+
+#if SIMD_X86
+
+int countBits(u32 mask) {
+  mask = mask - ((mask >> 1) & 0x55555555);
+  mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+  return (int)((((mask + (mask >> 4)) & 0x0F0F0F0F)*0x01010101) >> 24);
+}
+
+// getTexelIndex for four texels
+TARGET_SSE4 __m128i getTexelIndicesSSE4(Texture *texture, __m128i x, __m128i y) {
+  switch (texture->layout) {
+    case TEXTURE_LAYOUT_TILED: {
+      __m128i blocksPerRow = _mm_set1_epi32((texture->width + 3) >> 2);
+      __m128i block = _mm_add_epi32(_mm_srli_epi32(x, 2), _mm_mullo_epi32(_mm_srli_epi32(y, 2), blocksPerRow));
+      __m128i three = _mm_set1_epi32(3);
+      __m128i inBlock = _mm_add_epi32(_mm_and_si128(x, three), _mm_slli_epi32(_mm_and_si128(y, three), 2));
+      return _mm_add_epi32(_mm_slli_epi32(block, 4), inBlock);
+    }
+    case TEXTURE_LAYOUT_MORTON: {
+      __m128i bits = _mm_cvtsi32_si128(texture->mortonBits);
+      __m128i mask = _mm_set1_epi32((1u << texture->mortonBits) - 1);
+      __m128i xy[2] = {_mm_and_si128(x, mask), _mm_and_si128(y, mask)};
+      for (int i = 0; i < 2; ++i) {
+        __m128i v = xy[i];
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 8)), _mm_set1_epi32(0x00FF00FF));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 4)), _mm_set1_epi32(0x0F0F0F0F));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 2)), _mm_set1_epi32(0x33333333));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 1)), _mm_set1_epi32(0x55555555));
+        xy[i] = v;
+      }
+      __m128i high = _mm_sll_epi32(_mm_srl_epi32(_mm_or_si128(x, y), bits), _mm_add_epi32(bits, bits));
+      return _mm_or_si128(_mm_or_si128(xy[0], _mm_slli_epi32(xy[1], 1)), high);
+    }
+    default:
+      return _mm_add_epi32(x, _mm_mullo_epi32(y, _mm_set1_epi32(texture->width)));
+  }
+}
+
+// shadeNearest for four pixels, as one vector per channel
+FORCE_INLINE TARGET_SSE4 void shadePixelsSSE4(Texture *texture, Texture *normalMap, Vec3 lightDir, __m128 u, __m128 v, ShadeMode mode,
+                                          __m128 *cr, __m128 *cg, __m128 *cb) {
+  __m128 texScaleX = _mm_set1_ps((float)(texture->width-1));
+  __m128 texScaleY = _mm_set1_ps((float)(texture->height-1));
+  __m128i texMaxX = _mm_set1_epi32(texture->width-1);
+  __m128i texMaxY = _mm_set1_epi32(texture->height-1);
+
+  __m128i tx = _mm_cvttps_epi32(_mm_mul_ps(u, texScaleX));
+  __m128i ty = _mm_cvttps_epi32(_mm_mul_ps(v, texScaleY));
+  tx = _mm_min_epi32(_mm_max_epi32(tx, _mm_setzero_si128()), texMaxX);
+  ty = _mm_min_epi32(_mm_max_epi32(ty, _mm_setzero_si128()), texMaxY);
+  __m128i texIndex = getTexelIndicesSSE4(texture, tx, ty);
+
+  int texIndices[4];
+  _mm_storeu_si128((__m128i *)texIndices, texIndex);
+  __m128 texR = _mm_setzero_ps(), texG = _mm_setzero_ps(), texB = _mm_setzero_ps();
+  if (mode != SHADE_LIT) {
+    Vec3 *t0 = &texture->pixels[texIndices[0]], *t1 = &texture->pixels[texIndices[1]];
+    Vec3 *t2 = &texture->pixels[texIndices[2]], *t3 = &texture->pixels[texIndices[3]];
+    texR = _mm_setr_ps(t0->x, t1->x, t2->x, t3->x);
+    texG = _mm_setr_ps(t0->y, t1->y, t2->y, t3->y);
+    texB = _mm_setr_ps(t0->z, t1->z, t2->z, t3->z);
+  }
+  __m128 intensity = _mm_setzero_ps();
+  if (mode != SHADE_TEXTURE) {
+    Vec3 *n0 = &normalMap->pixels[texIndices[0]], *n1 = &normalMap->pixels[texIndices[1]];
+    Vec3 *n2 = &normalMap->pixels[texIndices[2]], *n3 = &normalMap->pixels[texIndices[3]];
+    __m128 nx = _mm_setr_ps(n0->x, n1->x, n2->x, n3->x);
+    __m128 ny = _mm_setr_ps(n0->y, n1->y, n2->y, n3->y);
+    __m128 nz = _mm_setr_ps(n0->z, n1->z, n2->z, n3->z);
+
+    __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+    __m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+    nx = _mm_mul_ps(nx, invLength);
+    ny = _mm_mul_ps(ny, invLength);
+    nz = _mm_mul_ps(nz, invLength);
+
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(lightDir.x)), _mm_mul_ps(ny, _mm_set1_ps(lightDir.y))),
+                            _mm_mul_ps(nz, _mm_set1_ps(lightDir.z)));
+    intensity = _mm_xor_ps(dot, _mm_set1_ps(-0.0f));
+    intensity = _mm_andnot_ps(_mm_cmplt_ps(intensity, _mm_setzero_ps()), intensity);
+  }
+
+  if (mode == SHADE_TEXTURE_LIT) {
+    *cr = _mm_mul_ps(texR, intensity);
+    *cg = _mm_mul_ps(texG, intensity);
+    *cb = _mm_mul_ps(texB, intensity);
+  } else if (mode == SHADE_TEXTURE) {
+    *cr = texR;
+    *cg = texG;
+    *cb = texB;
+  } else {
+    *cr = *cg = *cb = intensity;
+  }
+}
+
+FORCE_INLINE TARGET_SSE4 void drawTriangleRectSSE4Body(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i laneStepX[3], groupStepX[3];
+  for (int i = 0; i < 3; ++i) {
+    laneStepX[i] = _mm_mullo_epi32(lane, _mm_set1_epi32(r->stepX[i]));
+    groupStepX[i] = _mm_set1_epi32(r->stepX[i]*4);
+  }
+  __m128i endX = _mm_set1_epi32(r->maxX + 1);
+  __m128i rectMinX = _mm_set1_epi32(r->minX);
+  __m128 dzdx = _mm_set1_ps(r->dzdx);
+  __m128 dudx = _mm_set1_ps(r->dudx);
+  __m128 dvdx = _mm_set1_ps(r->dvdx);
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    __m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), laneStepX[0]);
+    __m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), laneStepX[1]);
+    __m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), laneStepX[2]);
+    __m128 zRow4 = _mm_set1_ps(zRow);
+    __m128 uRow4 = _mm_set1_ps(uRow);
+    __m128 vRow4 = _mm_set1_ps(vRow);
+
+    for (int x = r->minX; x <= r->maxX; x += 4,
+         e0 = _mm_add_epi32(e0, groupStepX[0]), e1 = _mm_add_epi32(e1, groupStepX[1]), e2 = _mm_add_epi32(e2, groupStepX[2])) {
+      __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+      __m128i covered = _mm_cmpgt_epi32(_mm_or_si128(e0, _mm_or_si128(e1, e2)), _mm_set1_epi32(-1));
+      __m128i live = _mm_and_si128(covered, _mm_cmpgt_epi32(endX, xs));
+      if (!_mm_movemask_ps(_mm_castsi128_ps(live))) continue;
+      PROFILE_COUNT(numTested, countBits(_mm_movemask_ps(_mm_castsi128_ps(live))));
+
+      // lanes past maxX belong to another tile: only touch them in full groups
+      bool fullGroup = x + 3 <= r->maxX;
+      int i = x + r->pitch*y + r->offset;
+      int c = x + TILE_SIZE*y + r->colorOffset;
+      float *depth = zBuffer + i;
+
+      __m128 dx = _mm_cvtepi32_ps(_mm_sub_epi32(xs, rectMinX));
+      __m128 z = _mm_add_ps(zRow4, _mm_mul_ps(dzdx, dx));
+      __m128 oldZ;
+      if (fullGroup) {
+        oldZ = _mm_loadu_ps(depth);
+      } else {
+        float lanes[4] = {0};
+        for (int k = 0; x + k <= r->maxX; ++k) lanes[k] = depth[k];
+        oldZ = _mm_loadu_ps(lanes);
+      }
+      __m128 pass = _mm_and_ps(_mm_castsi128_ps(live), _mm_cmpgt_ps(z, oldZ));
+      int passMask = _mm_movemask_ps(pass);
+      if (!passMask) continue;
+      PROFILE_COUNT(numWritten, countBits(passMask));
+      PROFILE_COUNT(numCovered, countBits(_mm_movemask_ps(_mm_and_ps(pass, _mm_cmpeq_ps(oldZ, _mm_set1_ps(-9999.0f))))));
+
+      __m128 u = _mm_add_ps(uRow4, _mm_mul_ps(dudx, dx));
+      __m128 v = _mm_add_ps(vRow4, _mm_mul_ps(dvdx, dx));
+      __m128 cr, cg, cb;
+      shadePixelsSSE4(texture, normalMap, r->lightDir, u, v, mode, &cr, &cg, &cb);
+
+      if (fullGroup) {
+        _mm_storeu_ps(depth, _mm_blendv_ps(oldZ, z, pass));
+        ColorTile *color = r->color;
+        _mm_storeu_ps(color->r + c, _mm_blendv_ps(_mm_loadu_ps(color->r + c), cr, pass));
+        _mm_storeu_ps(color->g + c, _mm_blendv_ps(_mm_loadu_ps(color->g + c), cg, pass));
+        _mm_storeu_ps(color->b + c, _mm_blendv_ps(_mm_loadu_ps(color->b + c), cb, pass));
+      } else {
+        float zs[4], rs[4], gs[4], bs[4];
+        _mm_storeu_ps(zs, z);
+        _mm_storeu_ps(rs, cr);
+        _mm_storeu_ps(gs, cg);
+        _mm_storeu_ps(bs, cb);
+        for (int k = 0; k < 4; ++k) {
+          if (passMask & (1 << k)) {
+            depth[k] = zs[k];
+            r->color->r[c + k] = rs[k];
+            r->color->g[c + k] = gs[k];
+            r->color->b[c + k] = bs[k];
+          }
+        }
+      }
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+DEFINE_PIXEL_KERNELS(TARGET_SSE4, drawTriangleRectSSE4, drawTriangleRectSSE4Body)
+
+// drawTriangleRectMsaaScalar four pixels at a time: every sample's coverage
+// and depth is tested for the four, then the pixels any sample passed in are
+// shaded together, and only those with some samples failed go per sample.
+FORCE_INLINE TARGET_SSE4 void drawTriangleRectMsaaSSE4Body(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode,
+                                                           int numSamples) {
+  MsaaPattern *pattern = getMsaaPattern(numSamples);
+  MsaaTile *msaa = r->msaa;
+  ColorTile *color = r->color;
+  __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i laneStepX[3], groupStepX[3], sampleE[3][MSAA_MAX_SAMPLES], outerE[3];
+  __m128 sampleZ[MSAA_MAX_SAMPLES];
+  for (int i = 0; i < 3; ++i) {
+    laneStepX[i] = _mm_mullo_epi32(lane, _mm_set1_epi32(r->stepX[i]));
+    groupStepX[i] = _mm_set1_epi32(r->stepX[i]*4);
+    i32 outer = 0;
+    for (int s = 0; s < numSamples; ++s) {
+      i32 e = (r->stepX[i]*pattern->x[s] + r->stepY[i]*pattern->y[s]) / SUBPIXEL_ONE;
+      sampleE[i][s] = _mm_set1_epi32(e);
+      if (e > outer) outer = e;
+    }
+    outerE[i] = _mm_set1_epi32(outer);
+  }
+  for (int s = 0; s < numSamples; ++s) {
+    sampleZ[s] = _mm_set1_ps(r->dzdx*((float)pattern->x[s] / SUBPIXEL_ONE) + r->dzdy*((float)pattern->y[s] / SUBPIXEL_ONE));
+  }
+  __m128i endX = _mm_set1_epi32(r->maxX + 1);
+  __m128i rectMinX = _mm_set1_epi32(r->minX);
+  __m128 dzdx = _mm_set1_ps(r->dzdx);
+  __m128 dudx = _mm_set1_ps(r->dudx);
+  __m128 dvdx = _mm_set1_ps(r->dvdx);
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    __m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), laneStepX[0]);
+    __m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), laneStepX[1]);
+    __m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), laneStepX[2]);
+    __m128 zRow4 = _mm_set1_ps(zRow);
+    __m128 uRow4 = _mm_set1_ps(uRow);
+    __m128 vRow4 = _mm_set1_ps(vRow);
+
+    for (int x = r->minX; x <= r->maxX; x += 4,
+         e0 = _mm_add_epi32(e0, groupStepX[0]), e1 = _mm_add_epi32(e1, groupStepX[1]), e2 = _mm_add_epi32(e2, groupStepX[2])) {
+      __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+      __m128i nearby = _mm_cmpgt_epi32(_mm_or_si128(_mm_add_epi32(e0, outerE[0]), _mm_or_si128(_mm_add_epi32(e1, outerE[1]), _mm_add_epi32(e2, outerE[2]))),
+                                       _mm_set1_epi32(-1));
+      __m128i live = _mm_and_si128(nearby, _mm_cmpgt_epi32(endX, xs));
+      if (!_mm_movemask_ps(_mm_castsi128_ps(live))) continue;
+
+      bool fullGroup = x + 3 <= r->maxX;
+      int c = x + TILE_SIZE*y + r->colorOffset;
+      __m128 dx = _mm_cvtepi32_ps(_mm_sub_epi32(xs, rectMinX));
+      __m128 z = _mm_add_ps(zRow4, _mm_mul_ps(dzdx, dx));
+      __m128 anyInside = _mm_setzero_ps(), anyPass = _mm_setzero_ps(), allPass = _mm_castsi128_ps(live);
+      int passMasks[MSAA_MAX_SAMPLES];
+      for (int s = 0; s < numSamples; ++s) {
+        __m128i sample0 = _mm_add_epi32(e0, sampleE[0][s]);
+        __m128i sample1 = _mm_add_epi32(e1, sampleE[1][s]);
+        __m128i sample2 = _mm_add_epi32(e2, sampleE[2][s]);
+        __m128 inside = _mm_castsi128_ps(_mm_and_si128(live, _mm_cmpgt_epi32(_mm_or_si128(sample0, _mm_or_si128(sample1, sample2)), _mm_set1_epi32(-1))));
+        __m128 sz = _mm_add_ps(z, sampleZ[s]);
+        float *depth = msaa->z[s] + c;
+        __m128 oldZ;
+        if (fullGroup) {
+          oldZ = _mm_loadu_ps(depth);
+        } else {
+          float lanes[4] = {0};
+          for (int k = 0; x + k <= r->maxX; ++k) lanes[k] = depth[k];
+          oldZ = _mm_loadu_ps(lanes);
+        }
+        __m128 pass = _mm_and_ps(inside, _mm_cmpgt_ps(sz, oldZ));
+        passMasks[s] = _mm_movemask_ps(pass);
+        if (fullGroup) {
+          _mm_storeu_ps(depth, _mm_blendv_ps(oldZ, sz, pass));
+        } else if (passMasks[s]) {
+          float zs[4];
+          _mm_storeu_ps(zs, sz);
+          for (int k = 0; k < 4; ++k) {
+            if (passMasks[s] & (1 << k)) depth[k] = zs[k];
+          }
+        }
+        anyInside = _mm_or_ps(anyInside, inside);
+        anyPass = _mm_or_ps(anyPass, pass);
+        allPass = _mm_and_ps(allPass, pass);
+      }
+      PROFILE_COUNT(numTested, countBits(_mm_movemask_ps(anyInside)));
+      int anyMask = _mm_movemask_ps(anyPass);
+      if (!anyMask) continue;
+      int allMask = _mm_movemask_ps(allPass);
+      PROFILE_COUNT(numWritten, countBits(anyMask));
+
+      __m128 u = _mm_add_ps(uRow4, _mm_mul_ps(dudx, dx));
+      __m128 v = _mm_add_ps(vRow4, _mm_mul_ps(dvdx, dx));
+      __m128 cr, cg, cb;
+      shadePixelsSSE4(texture, normalMap, r->lightDir, u, v, mode, &cr, &cg, &cb);
+      float rs[4], gs[4], bs[4];
+      _mm_storeu_ps(rs, cr);
+      _mm_storeu_ps(gs, cg);
+      _mm_storeu_ps(bs, cb);
+      for (int k = 0; k < 4; ++k) {
+        if (!(anyMask & (1 << k))) continue;
+        PROFILE_COUNT(numCovered, msaa->state[c + k] == MSAA_PIXEL_CLEAR);
+        if (allMask & (1 << k)) {
+          color->r[c + k] = rs[k];
+          color->g[c + k] = gs[k];
+          color->b[c + k] = bs[k];
+          msaa->state[c + k] = MSAA_PIXEL_UNIFORM;
+        } else {
+          u32 passed = 0;
+          for (int s = 0; s < numSamples; ++s) passed |= (u32)(passMasks[s] >> k & 1) << s;
+          storeMsaaSamples(msaa, color, c + k, passed, numSamples, makeVec3(rs[k], gs[k], bs[k]));
+        }
+      }
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+FORCE_INLINE TARGET_SSE4 void drawTriangleRectMsaaSSE4ModeBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  if (msaaSamples == 4) drawTriangleRectMsaaSSE4Body(r, texture, normalMap, mode, 4);
+  else drawTriangleRectMsaaSSE4Body(r, texture, normalMap, mode, 8);
+}
+
+DEFINE_PIXEL_KERNELS(TARGET_SSE4, drawTriangleRectMsaaSSE4, drawTriangleRectMsaaSSE4ModeBody)
+
+TARGET_SSE4 void drawTriangleRectVisibilitySSE4(TriangleRect *r, Texture *texture, Texture *normalMap) {
+  __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i laneStepX[3], groupStepX[3];
+  for (int i = 0; i < 3; ++i) {
+    laneStepX[i] = _mm_mullo_epi32(lane, _mm_set1_epi32(r->stepX[i]));
+    groupStepX[i] = _mm_set1_epi32(r->stepX[i]*4);
+  }
+  __m128i endX = _mm_set1_epi32(r->maxX + 1);
+  __m128i rectMinX = _mm_set1_epi32(r->minX);
+  __m128 dzdx = _mm_set1_ps(r->dzdx);
+  __m128 dudx = _mm_set1_ps(r->dudx);
+  __m128 dvdx = _mm_set1_ps(r->dvdx);
+  __m128i triangle = _mm_set1_epi32((int)r->triangle);
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    __m128i e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), laneStepX[0]);
+    __m128i e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), laneStepX[1]);
+    __m128i e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), laneStepX[2]);
+    __m128 zRow4 = _mm_set1_ps(zRow);
+    __m128 uRow4 = _mm_set1_ps(uRow);
+    __m128 vRow4 = _mm_set1_ps(vRow);
+
+    for (int x = r->minX; x <= r->maxX; x += 4,
+         e0 = _mm_add_epi32(e0, groupStepX[0]), e1 = _mm_add_epi32(e1, groupStepX[1]), e2 = _mm_add_epi32(e2, groupStepX[2])) {
+      __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+      __m128i covered = _mm_cmpgt_epi32(_mm_or_si128(e0, _mm_or_si128(e1, e2)), _mm_set1_epi32(-1));
+      __m128i live = _mm_and_si128(covered, _mm_cmpgt_epi32(endX, xs));
+      if (!_mm_movemask_ps(_mm_castsi128_ps(live))) continue;
+      PROFILE_COUNT(numTested, countBits(_mm_movemask_ps(_mm_castsi128_ps(live))));
+
+      bool fullGroup = x + 3 <= r->maxX;
+      int i = x + r->pitch*y + r->offset;
+      float *depth = zBuffer + i;
+
+      __m128 dx = _mm_cvtepi32_ps(_mm_sub_epi32(xs, rectMinX));
+      __m128 z = _mm_add_ps(zRow4, _mm_mul_ps(dzdx, dx));
+      __m128 oldZ;
+      if (fullGroup) {
+        oldZ = _mm_loadu_ps(depth);
+      } else {
+        float lanes[4] = {0};
+        for (int k = 0; x + k <= r->maxX; ++k) lanes[k] = depth[k];
+        oldZ = _mm_loadu_ps(lanes);
+      }
+      __m128 pass = _mm_and_ps(_mm_castsi128_ps(live), _mm_cmpgt_ps(z, oldZ));
+      int passMask = _mm_movemask_ps(pass);
+      if (!passMask) continue;
+      numWritten += countBits(passMask);
+
+      __m128 u = _mm_add_ps(uRow4, _mm_mul_ps(dudx, dx));
+      __m128 v = _mm_add_ps(vRow4, _mm_mul_ps(dvdx, dx));
+      if (fullGroup) {
+        __m128i passi = _mm_castps_si128(pass);
+        _mm_storeu_ps(depth, _mm_blendv_ps(oldZ, z, pass));
+        _mm_storeu_si128((__m128i *)(visTriangles + i), _mm_blendv_epi8(_mm_loadu_si128((__m128i *)(visTriangles + i)), triangle, passi));
+        _mm_storeu_ps(visU + i, _mm_blendv_ps(_mm_loadu_ps(visU + i), u, pass));
+        _mm_storeu_ps(visV + i, _mm_blendv_ps(_mm_loadu_ps(visV + i), v, pass));
+      } else {
+        float zs[4], us[4], vs[4];
+        _mm_storeu_ps(zs, z);
+        _mm_storeu_ps(us, u);
+        _mm_storeu_ps(vs, v);
+        for (int k = 0; k < 4; ++k) {
+          if (passMask & (1 << k)) {
+            depth[k] = zs[k];
+            visTriangles[i + k] = r->triangle;
+            visU[i + k] = us[k];
+            visV[i + k] = vs[k];
+          }
+        }
+      }
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+}
+
+FORCE_INLINE TARGET_SSE4 void shadeSpanSSE4Body(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap,
+                                                 Vec3 lightDir, ShadeMode mode) {
+  for (int k = 0; k < count; k += 4, i += 4, c += 4) {
+    __m128 cr, cg, cb;
+    if (count - k >= 4) {
+      shadePixelsSSE4(texture, normalMap, lightDir, _mm_loadu_ps(visU + i), _mm_loadu_ps(visV + i), mode, &cr, &cg, &cb);
+      _mm_storeu_ps(color->r + c, cr);
+      _mm_storeu_ps(color->g + c, cg);
+      _mm_storeu_ps(color->b + c, cb);
+    } else {
+      float us[4] = {0}, vs[4] = {0};
+      float rs[4], gs[4], bs[4];
+      for (int j = 0; k + j < count; ++j) {
+        us[j] = visU[i + j];
+        vs[j] = visV[i + j];
+      }
+      shadePixelsSSE4(texture, normalMap, lightDir, _mm_loadu_ps(us), _mm_loadu_ps(vs), mode, &cr, &cg, &cb);
+      _mm_storeu_ps(rs, cr);
+      _mm_storeu_ps(gs, cg);
+      _mm_storeu_ps(bs, cb);
+      for (int j = 0; k + j < count; ++j) {
+        color->r[c + j] = rs[j];
+        color->g[c + j] = gs[j];
+        color->b[c + j] = bs[j];
+      }
+    }
+  }
+}
+
+DEFINE_SPAN_SHADERS(TARGET_SSE4, shadeSpanSSE4, shadeSpanSSE4Body)
+
+// resolveChannel for four pixels
+FORCE_INLINE TARGET_SSE4 __m128i resolveChannelsSSE4(__m128 c, ColorResolve resolve) {
+  __m128 one = _mm_set1_ps(1.0f);
+  c = _mm_max_ps(c, _mm_setzero_ps());
+  if (resolve == COLOR_RESOLVE_REINHARD) c = _mm_div_ps(c, _mm_add_ps(one, c));
+  c = _mm_min_ps(c, one);
+  if (resolve == COLOR_RESOLVE_GAMMA) c = _mm_sqrt_ps(c);
+  return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+
+FORCE_INLINE TARGET_SSE4 void resolveRowSSE4Body(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve) {
+  int k = 0;
+  for (; k + 4 <= count; k += 4) {
+    __m128i r = resolveChannelsSSE4(_mm_loadu_ps(color->r + c + k), resolve);
+    __m128i g = resolveChannelsSSE4(_mm_loadu_ps(color->g + c + k), resolve);
+    __m128i b = resolveChannelsSSE4(_mm_loadu_ps(color->b + c + k), resolve);
+    __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    __m128i pixels = _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(r, 16)), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+    _mm_storeu_si128((__m128i *)(dest + k), pixels);
+  }
+  for (; k < count; ++k) dest[k] = resolvePixel(color->r[c + k], color->g[c + k], color->b[c + k], resolve);
+}
+
+TARGET_SSE4 void resolveRowSSE4(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve) {
+  switch (resolve) {
+    case COLOR_RESOLVE_CLAMP: resolveRowSSE4Body(dest, color, c, count, COLOR_RESOLVE_CLAMP); break;
+    case COLOR_RESOLVE_GAMMA: resolveRowSSE4Body(dest, color, c, count, COLOR_RESOLVE_GAMMA); break;
+    case COLOR_RESOLVE_REINHARD: resolveRowSSE4Body(dest, color, c, count, COLOR_RESOLVE_REINHARD); break;
+    default: assert(!"unknown color resolve");
+  }
+}
+
+TARGET_SSE4 void resolveMsaaRowSSE4(ColorTile *color, MsaaTile *msaa, int c, int count, int numSamples) {
+  __m128 scale = _mm_set1_ps(1.0f / (float)numSamples);
+  int k = 0;
+  for (; k + 4 <= count; k += 4) {
+    int i = c + k;
+    __m128 average = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(msaa->state + i)), _mm_set1_epi32(MSAA_PIXEL_SAMPLES)));
+    if (!_mm_movemask_ps(average)) continue;
+    __m128 r = _mm_loadu_ps(msaa->r[0] + i), g = _mm_loadu_ps(msaa->g[0] + i), b = _mm_loadu_ps(msaa->b[0] + i);
+    for (int s = 1; s < numSamples; ++s) {
+      r = _mm_add_ps(r, _mm_loadu_ps(msaa->r[s] + i));
+      g = _mm_add_ps(g, _mm_loadu_ps(msaa->g[s] + i));
+      b = _mm_add_ps(b, _mm_loadu_ps(msaa->b[s] + i));
+    }
+    _mm_storeu_ps(color->r + i, _mm_blendv_ps(_mm_loadu_ps(color->r + i), _mm_mul_ps(r, scale), average));
+    _mm_storeu_ps(color->g + i, _mm_blendv_ps(_mm_loadu_ps(color->g + i), _mm_mul_ps(g, scale), average));
+    _mm_storeu_ps(color->b + i, _mm_blendv_ps(_mm_loadu_ps(color->b + i), _mm_mul_ps(b, scale), average));
+  }
+  resolveMsaaRowScalar(color, msaa, c + k, count - k, numSamples);
+}
+
+// getTexelIndex for eight texels
+TARGET_AVX2 __m256i getTexelIndicesAVX2(Texture *texture, __m256i x, __m256i y) {
+  switch (texture->layout) {
+    case TEXTURE_LAYOUT_TILED: {
+      __m256i blocksPerRow = _mm256_set1_epi32((texture->width + 3) >> 2);
+      __m256i block = _mm256_add_epi32(_mm256_srli_epi32(x, 2), _mm256_mullo_epi32(_mm256_srli_epi32(y, 2), blocksPerRow));
+      __m256i three = _mm256_set1_epi32(3);
+      __m256i inBlock = _mm256_add_epi32(_mm256_and_si256(x, three), _mm256_slli_epi32(_mm256_and_si256(y, three), 2));
+      return _mm256_add_epi32(_mm256_slli_epi32(block, 4), inBlock);
+    }
+    case TEXTURE_LAYOUT_MORTON: {
+      __m128i bits = _mm_cvtsi32_si128(texture->mortonBits);
+      __m256i mask = _mm256_set1_epi32((1u << texture->mortonBits) - 1);
+      __m256i xy[2] = {_mm256_and_si256(x, mask), _mm256_and_si256(y, mask)};
+      for (int i = 0; i < 2; ++i) {
+        __m256i v = xy[i];
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_set1_epi32(0x00FF00FF));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)), _mm256_set1_epi32(0x33333333));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 1)), _mm256_set1_epi32(0x55555555));
+        xy[i] = v;
+      }
+      __m256i high = _mm256_sll_epi32(_mm256_srl_epi32(_mm256_or_si256(x, y), bits), _mm_add_epi32(bits, bits));
+      return _mm256_or_si256(_mm256_or_si256(xy[0], _mm256_slli_epi32(xy[1], 1)), high);
+    }
+    default:
+      return _mm256_add_epi32(x, _mm256_mullo_epi32(y, _mm256_set1_epi32(texture->width)));
+  }
+}
+
+// shadeNearest for eight pixels, as one vector per channel
+FORCE_INLINE TARGET_AVX2 void shadePixelsAVX2(Texture *texture, Texture *normalMap, Vec3 lightDir, __m256 u, __m256 v, ShadeMode mode,
+                                          __m256 *cr, __m256 *cg, __m256 *cb) {
+  __m256 texScaleX = _mm256_set1_ps((float)(texture->width-1));
+  __m256 texScaleY = _mm256_set1_ps((float)(texture->height-1));
+  __m256i texMaxX = _mm256_set1_epi32(texture->width-1);
+  __m256i texMaxY = _mm256_set1_epi32(texture->height-1);
+  float *texBase = &texture->pixels[0].x;
+  float *normalBase = &normalMap->pixels[0].x;
+
+  __m256i tx = _mm256_cvttps_epi32(_mm256_mul_ps(u, texScaleX));
+  __m256i ty = _mm256_cvttps_epi32(_mm256_mul_ps(v, texScaleY));
+  tx = _mm256_min_epi32(_mm256_max_epi32(tx, _mm256_setzero_si256()), texMaxX);
+  ty = _mm256_min_epi32(_mm256_max_epi32(ty, _mm256_setzero_si256()), texMaxY);
+  __m256i texIndex = getTexelIndicesAVX2(texture, tx, ty);
+  __m256i floatIndex = _mm256_add_epi32(texIndex, _mm256_add_epi32(texIndex, texIndex));
+
+  __m256 texR = _mm256_setzero_ps(), texG = _mm256_setzero_ps(), texB = _mm256_setzero_ps();
+  if (mode != SHADE_LIT) {
+    texR = _mm256_i32gather_ps(texBase + 0, floatIndex, 4);
+    texG = _mm256_i32gather_ps(texBase + 1, floatIndex, 4);
+    texB = _mm256_i32gather_ps(texBase + 2, floatIndex, 4);
+  }
+  __m256 intensity = _mm256_setzero_ps();
+  if (mode != SHADE_TEXTURE) {
+    __m256 nx = _mm256_i32gather_ps(normalBase + 0, floatIndex, 4);
+    __m256 ny = _mm256_i32gather_ps(normalBase + 1, floatIndex, 4);
+    __m256 nz = _mm256_i32gather_ps(normalBase + 2, floatIndex, 4);
+
+    __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz));
+    __m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lengthSquared));
+    nx = _mm256_mul_ps(nx, invLength);
+    ny = _mm256_mul_ps(ny, invLength);
+    nz = _mm256_mul_ps(nz, invLength);
+
+    __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_set1_ps(lightDir.x)), _mm256_mul_ps(ny, _mm256_set1_ps(lightDir.y))),
+                               _mm256_mul_ps(nz, _mm256_set1_ps(lightDir.z)));
+    intensity = _mm256_xor_ps(dot, _mm256_set1_ps(-0.0f));
+    intensity = _mm256_andnot_ps(_mm256_cmp_ps(intensity, _mm256_setzero_ps(), _CMP_LT_OQ), intensity);
+  }
+
+  if (mode == SHADE_TEXTURE_LIT) {
+    *cr = _mm256_mul_ps(texR, intensity);
+    *cg = _mm256_mul_ps(texG, intensity);
+    *cb = _mm256_mul_ps(texB, intensity);
+  } else if (mode == SHADE_TEXTURE) {
+    *cr = texR;
+    *cg = texG;
+    *cb = texB;
+  } else {
+    *cr = *cg = *cb = intensity;
+  }
+}
+
+FORCE_INLINE TARGET_AVX2 void drawTriangleRectAVX2Body(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i laneStepX[3], groupStepX[3];
+  for (int i = 0; i < 3; ++i) {
+    laneStepX[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32(r->stepX[i]));
+    groupStepX[i] = _mm256_set1_epi32(r->stepX[i]*8);
+  }
+  __m256i endX = _mm256_set1_epi32(r->maxX + 1);
+  __m256i rectMinX = _mm256_set1_epi32(r->minX);
+  __m256 dzdx = _mm256_set1_ps(r->dzdx);
+  __m256 dudx = _mm256_set1_ps(r->dudx);
+  __m256 dvdx = _mm256_set1_ps(r->dvdx);
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(e[0]), laneStepX[0]);
+    __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(e[1]), laneStepX[1]);
+    __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(e[2]), laneStepX[2]);
+    __m256 zRow8 = _mm256_set1_ps(zRow);
+    __m256 uRow8 = _mm256_set1_ps(uRow);
+    __m256 vRow8 = _mm256_set1_ps(vRow);
+
+    for (int x = r->minX; x <= r->maxX; x += 8,
+         e0 = _mm256_add_epi32(e0, groupStepX[0]), e1 = _mm256_add_epi32(e1, groupStepX[1]), e2 = _mm256_add_epi32(e2, groupStepX[2])) {
+      __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+      // lanes past maxX belong to another tile and are never loaded or stored
+      __m256i inRect = _mm256_cmpgt_epi32(endX, xs);
+      __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(e0, _mm256_or_si256(e1, e2)), _mm256_set1_epi32(-1));
+      __m256i live = _mm256_and_si256(covered, inRect);
+      if (_mm256_testz_si256(live, live)) continue;
+      PROFILE_COUNT(numTested, countBits(_mm256_movemask_ps(_mm256_castsi256_ps(live))));
+
+      int i = x + r->pitch*y + r->offset;
+      int c = x + TILE_SIZE*y + r->colorOffset;
+      float *depth = zBuffer + i;
+
+      __m256 dx = _mm256_cvtepi32_ps(_mm256_sub_epi32(xs, rectMinX));
+      __m256 z = _mm256_add_ps(zRow8, _mm256_mul_ps(dzdx, dx));
+      __m256 oldZ = _mm256_maskload_ps(depth, inRect);
+      __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(live), _mm256_cmp_ps(z, oldZ, _CMP_GT_OQ));
+      if (_mm256_testz_ps(pass, pass)) continue;
+      PROFILE_COUNT(numWritten, countBits(_mm256_movemask_ps(pass)));
+      PROFILE_COUNT(numCovered, countBits(_mm256_movemask_ps(_mm256_and_ps(pass, _mm256_cmp_ps(oldZ, _mm256_set1_ps(-9999.0f), _CMP_EQ_OQ)))));
+
+      __m256 u = _mm256_add_ps(uRow8, _mm256_mul_ps(dudx, dx));
+      __m256 v = _mm256_add_ps(vRow8, _mm256_mul_ps(dvdx, dx));
+      __m256 cr, cg, cb;
+      shadePixelsAVX2(texture, normalMap, r->lightDir, u, v, mode, &cr, &cg, &cb);
+
+      __m256i passi = _mm256_castps_si256(pass);
+      _mm256_maskstore_ps(depth, passi, z);
+      _mm256_maskstore_ps(r->color->r + c, passi, cr);
+      _mm256_maskstore_ps(r->color->g + c, passi, cg);
+      _mm256_maskstore_ps(r->color->b + c, passi, cb);
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+DEFINE_PIXEL_KERNELS(TARGET_AVX2, drawTriangleRectAVX2, drawTriangleRectAVX2Body)
+
+// drawTriangleRectMsaaSSE4Body eight pixels at a time
+FORCE_INLINE TARGET_AVX2 void drawTriangleRectMsaaAVX2Body(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode,
+                                                           int numSamples) {
+  MsaaPattern *pattern = getMsaaPattern(numSamples);
+  MsaaTile *msaa = r->msaa;
+  ColorTile *color = r->color;
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i laneStepX[3], groupStepX[3], sampleE[3][MSAA_MAX_SAMPLES], outerE[3];
+  __m256 sampleZ[MSAA_MAX_SAMPLES];
+  for (int i = 0; i < 3; ++i) {
+    laneStepX[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32(r->stepX[i]));
+    groupStepX[i] = _mm256_set1_epi32(r->stepX[i]*8);
+    i32 outer = 0;
+    for (int s = 0; s < numSamples; ++s) {
+      i32 e = (r->stepX[i]*pattern->x[s] + r->stepY[i]*pattern->y[s]) / SUBPIXEL_ONE;
+      sampleE[i][s] = _mm256_set1_epi32(e);
+      if (e > outer) outer = e;
+    }
+    outerE[i] = _mm256_set1_epi32(outer);
+  }
+  for (int s = 0; s < numSamples; ++s) {
+    sampleZ[s] = _mm256_set1_ps(r->dzdx*((float)pattern->x[s] / SUBPIXEL_ONE) + r->dzdy*((float)pattern->y[s] / SUBPIXEL_ONE));
+  }
+  __m256i endX = _mm256_set1_epi32(r->maxX + 1);
+  __m256i rectMinX = _mm256_set1_epi32(r->minX);
+  __m256 dzdx = _mm256_set1_ps(r->dzdx);
+  __m256 dudx = _mm256_set1_ps(r->dudx);
+  __m256 dvdx = _mm256_set1_ps(r->dvdx);
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(e[0]), laneStepX[0]);
+    __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(e[1]), laneStepX[1]);
+    __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(e[2]), laneStepX[2]);
+    __m256 zRow8 = _mm256_set1_ps(zRow);
+    __m256 uRow8 = _mm256_set1_ps(uRow);
+    __m256 vRow8 = _mm256_set1_ps(vRow);
+
+    for (int x = r->minX; x <= r->maxX; x += 8,
+         e0 = _mm256_add_epi32(e0, groupStepX[0]), e1 = _mm256_add_epi32(e1, groupStepX[1]), e2 = _mm256_add_epi32(e2, groupStepX[2])) {
+      __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+      __m256i inRect = _mm256_cmpgt_epi32(endX, xs);
+      __m256i nearby = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_add_epi32(e0, outerE[0]),
+                                                          _mm256_or_si256(_mm256_add_epi32(e1, outerE[1]), _mm256_add_epi32(e2, outerE[2]))),
+                                          _mm256_set1_epi32(-1));
+      __m256i live = _mm256_and_si256(nearby, inRect);
+      if (_mm256_testz_si256(live, live)) continue;
+
+      int c = x + TILE_SIZE*y + r->colorOffset;
+      __m256 dx = _mm256_cvtepi32_ps(_mm256_sub_epi32(xs, rectMinX));
+      __m256 z = _mm256_add_ps(zRow8, _mm256_mul_ps(dzdx, dx));
+      __m256 anyInside = _mm256_setzero_ps(), anyPass = _mm256_setzero_ps(), allPass = _mm256_castsi256_ps(live);
+      __m256 passes[MSAA_MAX_SAMPLES];
+      for (int s = 0; s < numSamples; ++s) {
+        __m256i sample0 = _mm256_add_epi32(e0, sampleE[0][s]);
+        __m256i sample1 = _mm256_add_epi32(e1, sampleE[1][s]);
+        __m256i sample2 = _mm256_add_epi32(e2, sampleE[2][s]);
+        __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(sample0, _mm256_or_si256(sample1, sample2)), _mm256_set1_epi32(-1));
+        __m256 inside = _mm256_castsi256_ps(_mm256_and_si256(live, covered));
+        __m256 sz = _mm256_add_ps(z, sampleZ[s]);
+        float *depth = msaa->z[s] + c;
+        __m256 oldZ = _mm256_maskload_ps(depth, inRect);
+        __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(sz, oldZ, _CMP_GT_OQ));
+        passes[s] = pass;
+        _mm256_maskstore_ps(depth, _mm256_castps_si256(pass), sz);
+        anyInside = _mm256_or_ps(anyInside, inside);
+        anyPass = _mm256_or_ps(anyPass, pass);
+        allPass = _mm256_and_ps(allPass, pass);
+      }
+      PROFILE_COUNT(numTested, countBits(_mm256_movemask_ps(anyInside)));
+      if (_mm256_testz_ps(anyPass, anyPass)) continue;
+      PROFILE_COUNT(numWritten, countBits(_mm256_movemask_ps(anyPass)));
+
+      __m256 u = _mm256_add_ps(uRow8, _mm256_mul_ps(dudx, dx));
+      __m256 v = _mm256_add_ps(vRow8, _mm256_mul_ps(dvdx, dx));
+      __m256 cr, cg, cb;
+      shadePixelsAVX2(texture, normalMap, r->lightDir, u, v, mode, &cr, &cg, &cb);
+      // pixels with every sample passed keep one color, the others get the
+      // color in the samples that passed, after their old color is expanded
+      // to all samples if they had one
+      __m256i alli = _mm256_castps_si256(allPass);
+      __m256i partial = _mm256_castps_si256(_mm256_andnot_ps(allPass, anyPass));
+      __m256i state = _mm256_maskload_epi32((int *)msaa->state + c, inRect);
+      PROFILE_COUNT(numCovered, countBits(_mm256_movemask_ps(_mm256_and_ps(anyPass, _mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(state, _mm256_set1_epi32(MSAA_PIXEL_CLEAR)))))));
+      if (!_mm256_testz_si256(partial, partial)) {
+        __m256i expand = _mm256_andnot_si256(_mm256_cmpeq_epi32(state, _mm256_set1_epi32(MSAA_PIXEL_SAMPLES)), partial);
+        __m256 oldR = _mm256_maskload_ps(color->r + c, expand);
+        __m256 oldG = _mm256_maskload_ps(color->g + c, expand);
+        __m256 oldB = _mm256_maskload_ps(color->b + c, expand);
+        for (int s = 0; s < numSamples; ++s) {
+          __m256i passi = _mm256_and_si256(partial, _mm256_castps_si256(passes[s]));
+          __m256 sr = _mm256_blendv_ps(oldR, cr, _mm256_castsi256_ps(passi));
+          __m256 sg = _mm256_blendv_ps(oldG, cg, _mm256_castsi256_ps(passi));
+          __m256 sb = _mm256_blendv_ps(oldB, cb, _mm256_castsi256_ps(passi));
+          __m256i store = _mm256_or_si256(expand, passi);
+          _mm256_maskstore_ps(msaa->r[s] + c, store, sr);
+          _mm256_maskstore_ps(msaa->g[s] + c, store, sg);
+          _mm256_maskstore_ps(msaa->b[s] + c, store, sb);
+        }
+      }
+      _mm256_maskstore_ps(color->r + c, alli, cr);
+      _mm256_maskstore_ps(color->g + c, alli, cg);
+      _mm256_maskstore_ps(color->b + c, alli, cb);
+      state = _mm256_blendv_epi8(state, _mm256_set1_epi32(MSAA_PIXEL_UNIFORM), alli);
+      state = _mm256_blendv_epi8(state, _mm256_set1_epi32(MSAA_PIXEL_SAMPLES), partial);
+      _mm256_maskstore_epi32((int *)msaa->state + c, _mm256_castps_si256(anyPass), state);
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+FORCE_INLINE TARGET_AVX2 void drawTriangleRectMsaaAVX2ModeBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  if (msaaSamples == 4) drawTriangleRectMsaaAVX2Body(r, texture, normalMap, mode, 4);
+  else drawTriangleRectMsaaAVX2Body(r, texture, normalMap, mode, 8);
+}
+
+DEFINE_PIXEL_KERNELS(TARGET_AVX2, drawTriangleRectMsaaAVX2, drawTriangleRectMsaaAVX2ModeBody)
+
+TARGET_AVX2 void drawTriangleRectVisibilityAVX2(TriangleRect *r, Texture *texture, Texture *normalMap) {
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i laneStepX[3], groupStepX[3];
+  for (int i = 0; i < 3; ++i) {
+    laneStepX[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32(r->stepX[i]));
+    groupStepX[i] = _mm256_set1_epi32(r->stepX[i]*8);
+  }
+  __m256i endX = _mm256_set1_epi32(r->maxX + 1);
+  __m256i rectMinX = _mm256_set1_epi32(r->minX);
+  __m256 dzdx = _mm256_set1_ps(r->dzdx);
+  __m256 dudx = _mm256_set1_ps(r->dudx);
+  __m256 dvdx = _mm256_set1_ps(r->dvdx);
+  __m256i triangle = _mm256_set1_epi32((int)r->triangle);
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    __m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(e[0]), laneStepX[0]);
+    __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(e[1]), laneStepX[1]);
+    __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(e[2]), laneStepX[2]);
+    __m256 zRow8 = _mm256_set1_ps(zRow);
+    __m256 uRow8 = _mm256_set1_ps(uRow);
+    __m256 vRow8 = _mm256_set1_ps(vRow);
+
+    for (int x = r->minX; x <= r->maxX; x += 8,
+         e0 = _mm256_add_epi32(e0, groupStepX[0]), e1 = _mm256_add_epi32(e1, groupStepX[1]), e2 = _mm256_add_epi32(e2, groupStepX[2])) {
+      __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+      __m256i inRect = _mm256_cmpgt_epi32(endX, xs);
+      __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(e0, _mm256_or_si256(e1, e2)), _mm256_set1_epi32(-1));
+      __m256i live = _mm256_and_si256(covered, inRect);
+      if (_mm256_testz_si256(live, live)) continue;
+      PROFILE_COUNT(numTested, countBits(_mm256_movemask_ps(_mm256_castsi256_ps(live))));
+
+      int i = x + r->pitch*y + r->offset;
+      float *depth = zBuffer + i;
+
+      __m256 dx = _mm256_cvtepi32_ps(_mm256_sub_epi32(xs, rectMinX));
+      __m256 z = _mm256_add_ps(zRow8, _mm256_mul_ps(dzdx, dx));
+      __m256 oldZ = _mm256_maskload_ps(depth, inRect);
+      __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(live), _mm256_cmp_ps(z, oldZ, _CMP_GT_OQ));
+      int passMask = _mm256_movemask_ps(pass);
+      if (!passMask) continue;
+      numWritten += countBits(passMask);
+
+      __m256 u = _mm256_add_ps(uRow8, _mm256_mul_ps(dudx, dx));
+      __m256 v = _mm256_add_ps(vRow8, _mm256_mul_ps(dvdx, dx));
+      __m256i passi = _mm256_castps_si256(pass);
+      _mm256_maskstore_ps(depth, passi, z);
+      _mm256_maskstore_epi32((int *)(visTriangles + i), passi, triangle);
+      _mm256_maskstore_ps(visU + i, passi, u);
+      _mm256_maskstore_ps(visV + i, passi, v);
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+}
+
+FORCE_INLINE TARGET_AVX2 void shadeSpanAVX2Body(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap,
+                                                 Vec3 lightDir, ShadeMode mode) {
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (int k = 0; k < count; k += 8, i += 8, c += 8) {
+    __m256i inSpan = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - k), lane);
+    __m256 u = _mm256_maskload_ps(visU + i, inSpan);
+    __m256 v = _mm256_maskload_ps(visV + i, inSpan);
+    __m256 cr, cg, cb;
+    shadePixelsAVX2(texture, normalMap, lightDir, u, v, mode, &cr, &cg, &cb);
+    _mm256_maskstore_ps(color->r + c, inSpan, cr);
+    _mm256_maskstore_ps(color->g + c, inSpan, cg);
+    _mm256_maskstore_ps(color->b + c, inSpan, cb);
+  }
+}
+
+DEFINE_SPAN_SHADERS(TARGET_AVX2, shadeSpanAVX2, shadeSpanAVX2Body)
+
+// resolveChannel for eight pixels
+FORCE_INLINE TARGET_AVX2 __m256i resolveChannelsAVX2(__m256 c, ColorResolve resolve) {
+  __m256 one = _mm256_set1_ps(1.0f);
+  c = _mm256_max_ps(c, _mm256_setzero_ps());
+  if (resolve == COLOR_RESOLVE_REINHARD) c = _mm256_div_ps(c, _mm256_add_ps(one, c));
+  c = _mm256_min_ps(c, one);
+  if (resolve == COLOR_RESOLVE_GAMMA) c = _mm256_sqrt_ps(c);
+  return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+}
+
+FORCE_INLINE TARGET_AVX2 void resolveRowAVX2Body(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve) {
+  int k = 0;
+  for (; k + 8 <= count; k += 8) {
+    __m256i r = resolveChannelsAVX2(_mm256_loadu_ps(color->r + c + k), resolve);
+    __m256i g = resolveChannelsAVX2(_mm256_loadu_ps(color->g + c + k), resolve);
+    __m256i b = resolveChannelsAVX2(_mm256_loadu_ps(color->b + c + k), resolve);
+    __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    __m256i pixels = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_slli_epi32(r, 16)), _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+    _mm256_storeu_si256((__m256i *)(dest + k), pixels);
+  }
+  for (; k < count; ++k) dest[k] = resolvePixel(color->r[c + k], color->g[c + k], color->b[c + k], resolve);
+}
+
+TARGET_AVX2 void resolveRowAVX2(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve) {
+  switch (resolve) {
+    case COLOR_RESOLVE_CLAMP: resolveRowAVX2Body(dest, color, c, count, COLOR_RESOLVE_CLAMP); break;
+    case COLOR_RESOLVE_GAMMA: resolveRowAVX2Body(dest, color, c, count, COLOR_RESOLVE_GAMMA); break;
+    case COLOR_RESOLVE_REINHARD: resolveRowAVX2Body(dest, color, c, count, COLOR_RESOLVE_REINHARD); break;
+    default: assert(!"unknown color resolve");
+  }
+}
+
+TARGET_AVX2 void resolveMsaaRowAVX2(ColorTile *color, MsaaTile *msaa, int c, int count, int numSamples) {
+  __m256 scale = _mm256_set1_ps(1.0f / (float)numSamples);
+  int k = 0;
+  for (; k + 8 <= count; k += 8) {
+    int i = c + k;
+    __m256i state = _mm256_loadu_si256((__m256i *)(msaa->state + i));
+    __m256i average = _mm256_cmpeq_epi32(state, _mm256_set1_epi32(MSAA_PIXEL_SAMPLES));
+    if (_mm256_testz_si256(average, average)) continue;
+    __m256 r = _mm256_loadu_ps(msaa->r[0] + i), g = _mm256_loadu_ps(msaa->g[0] + i), b = _mm256_loadu_ps(msaa->b[0] + i);
+    for (int s = 1; s < numSamples; ++s) {
+      r = _mm256_add_ps(r, _mm256_loadu_ps(msaa->r[s] + i));
+      g = _mm256_add_ps(g, _mm256_loadu_ps(msaa->g[s] + i));
+      b = _mm256_add_ps(b, _mm256_loadu_ps(msaa->b[s] + i));
+    }
+    _mm256_maskstore_ps(color->r + i, average, _mm256_mul_ps(r, scale));
+    _mm256_maskstore_ps(color->g + i, average, _mm256_mul_ps(g, scale));
+    _mm256_maskstore_ps(color->b + i, average, _mm256_mul_ps(b, scale));
+  }
+  resolveMsaaRowScalar(color, msaa, c + k, count - k, numSamples);
+}
+
+#endif
+
+// Picks the pixel kernels (forward, MSAA, visibility, deferred shading and
+// resolve).
+// SIMD_AUTO (or anything the CPU can't run) gets the widest supported ones.
+// Returns the level actually used.
+SimdLevel initPixelKernels(SimdLevel requested) {
+  SimdLevel supported = getCpuSimdLevel();
+  SimdLevel level = (requested == SIMD_AUTO || requested > supported) ? supported : requested;
+  switch (level) {
+#if SIMD_X86
+    case SIMD_AVX512:
+      // there's no wider pixel kernel
+      level = SIMD_AVX2;
+      // fall through
+    case SIMD_AVX2:
+      drawTriangleRect = drawTriangleRectAVX2;
+      drawTriangleRectMsaa = drawTriangleRectMsaaAVX2;
+      drawTriangleRectVisibility = drawTriangleRectVisibilityAVX2;
+      shadeSpan = shadeSpanAVX2;
+      resolveRow = resolveRowAVX2;
+      resolveMsaaRow = resolveMsaaRowAVX2;
+      break;
+    case SIMD_SSE4:
+      drawTriangleRect = drawTriangleRectSSE4;
+      drawTriangleRectMsaa = drawTriangleRectMsaaSSE4;
+      drawTriangleRectVisibility = drawTriangleRectVisibilitySSE4;
+      shadeSpan = shadeSpanSSE4;
+      resolveRow = resolveRowSSE4;
+      resolveMsaaRow = resolveMsaaRowSSE4;
+      break;
+#endif
+    default:
+      level = SIMD_SCALAR;
+      drawTriangleRect = drawTriangleRectScalar;
+      drawTriangleRectMsaa = drawTriangleRectMsaaScalar;
+      drawTriangleRectVisibility = drawTriangleRectVisibilityScalar;
+      shadeSpan = shadeSpanScalar;
+      resolveRow = resolveRowScalar;
+      resolveMsaaRow = resolveMsaaRowScalar;
+      break;
+  }
+  return level;
+}
@@ -0,0 +1,437 @@
+// Renderer benchmark: renders african_head from fixed views at several
+// resolutions, with texturing and normal mapping on and off and as a grid of
+// instances drawn with renderScene, at full detail and with the LOD chain,
+// and reports frame time percentiles and throughput per case. Every case's
+// images are hashed and checked against render_bench.golden, so an
+// optimization that changes the output fails the run. Run from the repo
+// root; -update rewrites the golden hashes after an intended change.
+
+#include "posix_platform.c"
+
+#define MAX_GOLDEN 128
+
+// Fixed positions rather than ones computed with sinf/cosf, so that the
+// images don't depend on the libm the benchmark is built with.
+Vec3 benchViews[] = {
+  { 0.0f,    1.0f,  4.1f},
+  { 2.8991f, 1.0f,  2.8991f},
+  { 4.1f,    1.0f,  0.0f},
+  { 2.8991f, 1.0f, -2.8991f},
+  { 0.0f,    1.0f, -4.1f},
+  {-2.8991f, 1.0f, -2.8991f},
+  {-4.1f,    1.0f,  0.0f},
+  {-2.8991f, 1.0f,  2.8991f},
+  // close enough to clip against the screen edges
+  { 0.4f,    0.2f,  1.3f},
+  // from above
+  { 0.0f,    4.0f,  0.5f},
+};
+#define NUM_VIEWS (int)(sizeof(benchViews)/sizeof(benchViews[0]))
+
+int benchSizes[] = {256, 512, 1024};
+#define NUM_SIZES (int)(sizeof(benchSizes)/sizeof(benchSizes[0]))
+
+// GRID_SIZE x GRID_SIZE heads in rows going away from the camera, turned by
+// multiples of 45 degrees (written out like the views) and alternating
+// between two materials.
+#define GRID_SIZE 8
+#define GRID_SPACING 2.5f
+
+float gridTurns[8][2] = {
+  { 1.0f,         0.0f},
+  { 0.70710677f,  0.70710677f},
+  { 0.0f,         1.0f},
+  {-0.70710677f,  0.70710677f},
+  {-1.0f,         0.0f},
+  {-0.70710677f, -0.70710677f},
+  { 0.0f,        -1.0f},
+  { 0.70710677f, -0.70710677f},
+};
+
+typedef struct {
+  Vec3 pos;
+  Vec3 target;
+} BenchSceneView;
+
+// Targets close to the cameras, so that the far rows come out small.
+BenchSceneView sceneViews[] = {
+  // down the rows
+  {{  0.0f,  2.5f,  6.0f}, {  0.0f,  2.2f,  5.0f}},
+  // across them from a corner
+  {{-12.0f,  3.0f,  4.0f}, {-11.3f,  2.8f,  3.3f}},
+  // from above
+  {{  0.0f, 12.0f, -4.0f}, {  0.0f, 11.2f, -4.6f}},
+  // close enough to the front head to clip it
+  {{  0.5f,  0.3f,  1.5f}, {  0.4f,  0.25f, 0.5f}},
+};
+#define NUM_SCENE_VIEWS (int)(sizeof(sceneViews)/sizeof(sceneViews[0]))
+
+Scene gridScene;
+Scene lodScene;
+
+bool addBenchGrid(Scene *scene, Mesh *mesh, Material *materials) {
+  MeshHandle meshHandle = addSceneMesh(scene, mesh);
+  for (int m = 0; m < 2; ++m) {
+    MaterialHandle material = addSceneMaterial(scene, materials[m].texture, materials[m].normalMap);
+    if (material == MATERIAL_NONE) return false;
+    Mat4 models[GRID_SIZE*GRID_SIZE];
+    u32 numModels = 0;
+    for (int z = 0; z < GRID_SIZE; ++z) {
+      for (int x = 0; x < GRID_SIZE; ++x) {
+        if ((x + z) % 2 != m) continue;
+        float c = gridTurns[(3*x + 5*z) % 8][0], s = gridTurns[(3*x + 5*z) % 8][1];
+        float px = ((float)x - 0.5f*(GRID_SIZE-1))*GRID_SPACING, pz = -(float)z*GRID_SPACING;
+        models[numModels++] = makeMat4( c, 0, s, px,
+                                        0, 1, 0, 0,
+                                       -s, 0, c, pz,
+                                        0, 0, 0, 1);
+      }
+    }
+    drawMeshInstanced(scene, meshHandle, material, models, numModels);
+  }
+  return true;
+}
+
+// Checks what the LOD case relies on: every level has fewer faces and no
+// smaller an error than the one before, no face is degenerate or folded over
+// against its corners' normals, and the vertices on UV seams keep their
+// texcoords where they were. Prints the problems and returns their count.
+int checkLodChain(Mesh *mesh) {
+  if (mesh->numLods < 2) {
+    printf("LOD chain has %d level\n", mesh->numLods);
+    return 1;
+  }
+
+  // the full mesh's position of each texcoord on a seam vertex, -1 for the
+  // others
+  int *positionTexCoord = malloc((mesh->numPositions + 1)*sizeof(int));
+  bool *isSeam = calloc(mesh->numPositions + 1, sizeof(bool));
+  int *seamPosition = malloc((mesh->numTexCoords + 1)*sizeof(int));
+  bool *seen = malloc(mesh->numTexCoords + 1);
+  for (u32 i = 0; i < mesh->numPositions; ++i) positionTexCoord[i] = -1;
+  for (u32 i = 0; i < mesh->numTexCoords; ++i) seamPosition[i] = -1;
+  for (u32 i = 0; i < mesh->numFaces; ++i) {
+    Face *f = &mesh->faces[i];
+    for (int j = 0; j < 3; ++j) {
+      int *vt = &positionTexCoord[f->v[j]];
+      if (*vt >= 0 && *vt != f->vt[j]) isSeam[f->v[j]] = true;
+      *vt = f->vt[j];
+    }
+  }
+  u32 numSeamTexCoords = 0;
+  for (u32 i = 0; i < mesh->numFaces; ++i) {
+    Face *f = &mesh->faces[i];
+    for (int j = 0; j < 3; ++j) {
+      if (!isSeam[f->v[j]] || f->vt[j] < 0 || seamPosition[f->vt[j]] >= 0) continue;
+      seamPosition[f->vt[j]] = f->v[j];
+      ++numSeamTexCoords;
+    }
+  }
+
+  int numProblems = 0;
+  for (int level = 0; level < mesh->numLods; ++level) {
+    Mesh *lod = &mesh->lods[level];
+    if (level > 0) {
+      Mesh *finer = &mesh->lods[level-1];
+      // buildLodChain keeps a level it gets stuck on at up to 3/4 of the faces
+      if (lod->numFaces > finer->numFaces*3/4) {
+        printf("LOD %d has %u faces after %u\n", level, lod->numFaces, finer->numFaces);
+        ++numProblems;
+      }
+      if (!(lod->lodError > 0 && lod->lodError >= finer->lodError)) {
+        printf("LOD %d has error %g after %g\n", level, lod->lodError, finer->lodError);
+        ++numProblems;
+      }
+    }
+
+    u32 numDegenerate = 0, numFolded = 0, numMoved = 0, numLost = 0;
+    memset(seen, 0, mesh->numTexCoords);
+    for (u32 i = 0; i < lod->numFaces; ++i) {
+      Face *f = &lod->faces[i];
+      Vec3 p0 = lod->positions[f->v[0]];
+      Vec3 n = crossVec3(subVec3(lod->positions[f->v[1]], p0), subVec3(lod->positions[f->v[2]], p0));
+      if (f->v[0] == f->v[1] || f->v[1] == f->v[2] || f->v[2] == f->v[0] || lengthVec3(n) == 0) ++numDegenerate;
+      Vec3 cornerNormals = makeVec3(0, 0, 0);
+      for (int j = 0; j < 3; ++j) {
+        if (f->vn[j] >= 0) cornerNormals = addVec3(cornerNormals, lod->normals[f->vn[j]]);
+        int vt = f->vt[j];
+        if (vt < 0 || seamPosition[vt] < 0) continue;
+        seen[vt] = true;
+        Vec3 p = lod->positions[f->v[j]], original = mesh->positions[seamPosition[vt]];
+        if (p.x != original.x || p.y != original.y || p.z != original.z) ++numMoved;
+      }
+      if (dotVec3(n, cornerNormals) <= 0) ++numFolded;
+    }
+    for (u32 vt = 0; vt < mesh->numTexCoords; ++vt) numLost += seamPosition[vt] >= 0 && !seen[vt];
+    if (numDegenerate || numFolded || numMoved || numLost) {
+      printf("LOD %d: %u degenerate and %u folded faces, %u of %u seam texcoords moved and %u lost\n",
+             level, numDegenerate, numFolded, numMoved, numSeamTexCoords, numLost);
+      ++numProblems;
+    }
+  }
+
+  free(positionTexCoord);
+  free(isSeam);
+  free(seamPosition);
+  free(seen);
+  return numProblems;
+}
+
+typedef struct {
+  char *name;
+  bool isTextured;
+  bool normalMapEnabled;
+  // NULL for the head alone from benchViews, else a scene from sceneViews
+  Scene *scene;
+} BenchCase;
+
+BenchCase benchCases[] = {
+  {"texture+normalmap", true, true, NULL},
+  {"texture", true, false, NULL},
+  {"normalmap", false, true, NULL},
+  {"grid", true, true, &gridScene},
+  {"grid+lod", true, true, &lodScene},
+};
+#define NUM_CASES (int)(sizeof(benchCases)/sizeof(benchCases[0]))
+
+typedef struct {
+  char name[64];
+  u64 hash;
+} GoldenHash;
+
+// FNV-1a over the pixels, continuing from hash.
+u64 hashPixels(u64 hash, u32 *pixels, int count) {
+  u8 *bytes = (u8 *)pixels;
+  for (size_t i = 0; i < count*sizeof(*pixels); ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+int compareF64(const void *a, const void *b) {
+  f64 x = *(const f64 *)a, y = *(const f64 *)b;
+  return x < y ? -1 : x > y;
+}
+
+// times must be sorted
+f64 getPercentile(f64 *times, int count, f64 percentile) {
+  int i = (int)(percentile/100.0*(count-1) + 0.5);
+  return times[i];
+}
+
+int readGoldenHashes(char *filePath, GoldenHash *hashes) {
+  int numHashes = 0;
+  FILE *file = fopen(filePath, "r");
+  if (!file) return 0;
+  char line[256];
+  while (numHashes < MAX_GOLDEN && fgets(line, sizeof(line), file)) {
+    unsigned long long hash;
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%63s %llx", hashes[numHashes].name, &hash) == 2) {
+      hashes[numHashes++].hash = hash;
+    }
+  }
+  fclose(file);
+  return numHashes;
+}
+
+void printUsage(void) {
+  fprintf(stderr,
+          "usage: render_bench [options]\n"
+          "  -repeat N          frames per view and case (10)\n"
+          "  -threads N         worker threads (one per CPU)\n"
+          "  -simd LEVEL        pixel and vertex kernels: auto, scalar, sse4, avx2 or avx512 (auto)\n"
+          "  -filter MODE       texture filter: nearest, mipmap or trilinear (mipmap)\n"
+          "  -deferred          use deferred shading (the images, and so the hashes, are the same)\n"
+          "  -fblayout LAYOUT   render target memory layout: linear or tiled (the hashes are the same)\n"
+          "  -msaa N            anti-aliasing samples per pixel: 1, 4 or 8 (1), hashed as their own cases\n"
+          "  -golden FILE       golden image hashes (render_bench.golden)\n"
+          "  -update            write the hashes of this run to the golden file instead of checking\n");
+}
+
+int main(int argc, char **argv) {
+  char *goldenPath = "render_bench.golden";
+  bool update = false;
+  int repeat = 10;
+  int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  SimdLevel simdLevel = SIMD_AUTO;
+
+  for (int i = 1; i < argc; ++i) {
+    char *arg = argv[i];
+    char *value = (i+1 < argc) ? argv[i+1] : NULL;
+    bool ok = true;
+
+    if (!strcmp(arg, "-repeat") && value) { repeat = atoi(value); ok = repeat > 0; ++i; }
+    else if (!strcmp(arg, "-threads") && value) { numThreads = atoi(value); ok = numThreads > 0 && numThreads <= MAX_WORKERS; ++i; }
+    else if (!strcmp(arg, "-simd") && value) {
+      ok = false;
+      for (int level = 0; level < SIMD_COUNT; ++level) {
+        if (!strcmp(value, simdLevelNames[level])) {
+          simdLevel = level;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-filter") && value) {
+      ok = false;
+      for (int filter = 0; filter < TEXTURE_FILTER_COUNT; ++filter) {
+        if (!strcmp(value, textureFilterNames[filter])) {
+          textureFilter = filter;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-deferred")) { deferredShading = true; }
+    else if (!strcmp(arg, "-fblayout") && value) {
+      ok = false;
+      for (int layout = 0; layout < FRAMEBUFFER_LAYOUT_COUNT; ++layout) {
+        if (!strcmp(value, framebufferLayoutNames[layout])) {
+          framebufferLayout = layout;
+          ok = true;
+        }
+      }
+      ++i;
+    }
+    else if (!strcmp(arg, "-msaa") && value) { msaaSamples = atoi(value); ok = msaaSamples == 1 || msaaSamples == 4 || msaaSamples == 8; ++i; }
+    else if (!strcmp(arg, "-golden") && value) { goldenPath = value; ++i; }
+    else if (!strcmp(arg, "-update")) { update = true; }
+    else ok = false;
+
+    if (!ok) {
+      fprintf(stderr, "bad argument: %s\n", arg);
+      printUsage();
+      return 1;
+    }
+  }
+  if (deferredShading && msaaSamples > 1) {
+    fprintf(stderr, "-msaa needs forward shading, not -deferred\n");
+    return 1;
+  }
+
+  initWorkers(numThreads);
+  Mesh mesh = readMesh("african_head.obj");
+  if (!mesh.faces) return 1;
+  Texture texture = readTGAFile("african_head_diffuse.tga");
+  Texture normalMap = readTGAFile("african_head_nm.tga");
+  if (!texture.pixels || !normalMap.pixels) return 1;
+  // the second material wears the normal map as its texture
+  Material materials[2] = {{texture, normalMap}, {normalMap, normalMap}};
+  if (!addBenchGrid(&gridScene, &mesh, materials)) return 1;
+  // a copy of its own for the LOD case, so the others draw just the full mesh
+  Mesh lodMesh = readMesh("african_head.obj");
+  if (!lodMesh.faces) return 1;
+  buildLodChain(&lodMesh);
+  if (checkLodChain(&lodMesh)) return 1;
+  if (!addBenchGrid(&lodScene, &lodMesh, materials)) return 1;
+  SimdLevel vertexSimdLevel = initVertexKernels(simdLevel);
+  simdLevel = initPixelKernels(simdLevel);
+
+  GoldenHash golden[MAX_GOLDEN];
+  int numGolden = update ? 0 : readGoldenHashes(goldenPath, golden);
+  GoldenHash results[MAX_GOLDEN];
+  int numResults = 0;
+  int numFailed = 0;
+
+  printf("%d views (%d for scenes) x %d frames per case, %d threads, %s pixels, %s vertices, %s filter, %s framebuffer, %dx MSAA%s\n",
+         NUM_VIEWS, NUM_SCENE_VIEWS, repeat, numThreads, simdLevelNames[simdLevel], simdLevelNames[vertexSimdLevel],
+         textureFilterNames[textureFilter], framebufferLayoutNames[framebufferLayout], msaaSamples,
+         deferredShading ? ", deferred" : "");
+  printf("%-40s %8s %8s %8s %8s %9s %9s  %s\n", "case", "p50 ms", "p90 ms", "p99 ms", "max ms", "Mtris/s", "Mpix/s", "image");
+
+  int maxViews = NUM_VIEWS > NUM_SCENE_VIEWS ? NUM_VIEWS : NUM_SCENE_VIEWS;
+  f64 *times = malloc(maxViews*repeat*sizeof(*times));
+  for (int s = 0; s < NUM_SIZES; ++s) {
+    if (!initBackbuffer(benchSizes[s], benchSizes[s])) return 1;
+    for (int m = 0; m < NUM_CASES; ++m) {
+      BenchCase *benchCase = &benchCases[m];
+      isTextured = benchCase->isTextured;
+      normalMapEnabled = benchCase->normalMapEnabled;
+      int numViews = benchCase->scene ? NUM_SCENE_VIEWS : NUM_VIEWS;
+      int numFrames = numViews*repeat;
+
+      GoldenHash *result = &results[numResults++];
+      snprintf(result->name, sizeof(result->name), "%dx%d/%s/%s", benchSizes[s], benchSizes[s], benchCase->name,
+               textureFilterNames[textureFilter]);
+      if (msaaSamples > 1) {
+        int length = (int)strlen(result->name);
+        snprintf(result->name + length, sizeof(result->name) - length, "/msaa%d", msaaSamples);
+      }
+      result->hash = 0xCBF29CE484222325ull;
+
+      f64 totalTime = 0;
+      u64 triangles = 0, pixels = 0;
+      for (int v = 0; v < numViews; ++v) {
+        Camera camera;
+        camera.pos = benchCase->scene ? sceneViews[v].pos : benchViews[v];
+        camera.target = benchCase->scene ? sceneViews[v].target : makeVec3(0, 0, 0);
+        camera.perspectiveEnabled = true;
+        camera.isCameraEnabled = true;
+
+        // warm up the caches and the lazily grown bins
+        if (benchCase->scene) renderScene(&camera, benchCase->scene);
+        else renderFrame(&camera, &mesh, texture, normalMap);
+        for (int j = 0; j < repeat; ++j) {
+          f64 start = platformGetSeconds();
+          if (benchCase->scene) renderScene(&camera, benchCase->scene);
+          else renderFrame(&camera, &mesh, texture, normalMap);
+          f64 time = platformGetSeconds() - start;
+          times[v*repeat + j] = time;
+          totalTime += time;
+          triangles += cullStats.trianglesBinned;
+          // forward shading counts are only kept with the profiler on
+          pixels += deferredShading ? shadingStats.shadedPixels : shadingStats.depthWrites;
+        }
+        result->hash = hashPixels(result->hash, backbuffer, backbufferWidth*backbufferHeight);
+      }
+      qsort(times, numFrames, sizeof(*times), compareF64);
+
+      char *status = "new";
+      if (!update) {
+        status = "no golden hash";
+        for (int i = 0; i < numGolden; ++i) {
+          if (!strcmp(golden[i].name, result->name)) status = golden[i].hash == result->hash ? "ok" : "MISMATCH";
+        }
+        if (strcmp(status, "ok")) ++numFailed;
+      }
+      printf("%-40s %8.3f %8.3f %8.3f %8.3f %9.2f %9.2f  %016llx %s\n", result->name,
+             getPercentile(times, numFrames, 50)*1000.0, getPercentile(times, numFrames, 90)*1000.0,
+             getPercentile(times, numFrames, 99)*1000.0, times[numFrames-1]*1000.0,
+             triangles/totalTime*1e-6, pixels/totalTime*1e-6, (unsigned long long)result->hash, status);
+    }
+  }
+
+  if (update) {
+    // keep the other filters' hashes
+    GoldenHash merged[MAX_GOLDEN];
+    int numMerged = readGoldenHashes(goldenPath, merged);
+    for (int i = 0; i < numResults; ++i) {
+      int j = 0;
+      while (j < numMerged && strcmp(merged[j].name, results[i].name)) ++j;
+      if (j == numMerged) {
+        if (numMerged == MAX_GOLDEN) break;
+        ++numMerged;
+      }
+      merged[j] = results[i];
+    }
+    FILE *file = fopen(goldenPath, "w");
+    if (!file) {
+      fprintf(stderr, "can't write %s\n", goldenPath);
+      return 1;
+    }
+    fprintf(file, "# render_bench image hashes (FNV-1a of every view's pixels), written by render_bench -update\n");
+    for (int i = 0; i < numMerged; ++i) fprintf(file, "%s %016llx\n", merged[i].name, (unsigned long long)merged[i].hash);
+    fclose(file);
+    printf("wrote %d hashes to %s\n", numMerged, goldenPath);
+    return 0;
+  }
+
+  if (numFailed) {
+    printf("%d of %d cases don't match %s\n", numFailed, numResults, goldenPath);
+    return 1;
+  }
+  printf("all %d cases match %s\n", numResults, goldenPath);
+  return 0;
+}
@@ -0,0 +1,4233 @@
+#include <stdint.h>
+#include <assert.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdbool.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t i8;
+typedef int16_t i16;
+typedef int32_t i32;
+typedef int64_t i64;
+
+typedef float f32;
+typedef double f64;
+
+#include "platform.h"
+#include "simd.c"
+#include "profiler.c"
+
+#define WHITE 0xFFFFFFFF
+#define RED   0xFFFF0000
+#define GREEN 0xFF00FF00
+
+typedef struct {
+  float x, y, z;
+} Vec3;
+
+Vec3 crossVec3(Vec3 a, Vec3 b) {
+  Vec3 r;
+  r.x = a.y*b.z - b.y*a.z;
+  r.y = b.x*a.z - a.x*b.z;
+  r.z = a.x*b.y - a.y*b.x;
+  return r;
+}
+
+Vec3 subVec3(Vec3 a, Vec3 b) {
+  Vec3 r;
+  r.x = a.x - b.x;
+  r.y = a.y - b.y;
+  r.z = a.z - b.z;
+  return r;
+}
+
+Vec3 addVec3(Vec3 a, Vec3 b) {
+  Vec3 r;
+  r.x = a.x + b.x;
+  r.y = a.y + b.y;
+  r.z = a.z + b.z;
+  return r;
+}
+
+Vec3 makeVec3(float x, float y, float z) {
+  Vec3 r;
+  r.x = x;
+  r.y = y;
+  r.z = z;
+  return r;
+}
+
+float dotVec3(Vec3 a, Vec3 b) {
+  return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+float lengthSquaredVec3(Vec3 v) {
+  return dotVec3(v,v);
+}
+
+float lengthVec3(Vec3 v) {
+  return sqrtf(lengthSquaredVec3(v));
+}
+
+Vec3 scaleVec3(Vec3 v, float a) {
+  return makeVec3(v.x*a, v.y*a, v.z*a);
+}
+
+Vec3 normalizeVec3(Vec3 v) {
+  return scaleVec3(v, 1.0f / lengthVec3(v));
+}
+
+typedef struct {
+  float x, y, z, w;
+} Vec4;
+
+Vec4 makeVec4(float x, float y, float z, float w) {
+  Vec4 r;
+  r.x = x;
+  r.y = y;
+  r.z = z;
+  r.w = w;
+  return r;
+}
+
+typedef struct {
+  float d[4][4];
+} Mat4;
+
+Mat4 makeMat4(float d00, float d01, float d02, float d03,
+              float d10, float d11, float d12, float d13,
+              float d20, float d21, float d22, float d23,
+              float d30, float d31, float d32, float d33) {
+  Mat4 m;
+  m.d[0][0] = d00; m.d[0][1] = d01; m.d[0][2] = d02; m.d[0][3] = d03;
+  m.d[1][0] = d10; m.d[1][1] = d11; m.d[1][2] = d12; m.d[1][3] = d13;
+  m.d[2][0] = d20; m.d[2][1] = d21; m.d[2][2] = d22; m.d[2][3] = d23;
+  m.d[3][0] = d30; m.d[3][1] = d31; m.d[3][2] = d32; m.d[3][3] = d33;
+  return m;
+}
+
+Mat4 getIdentityMat4() {
+  return makeMat4(1,0,0,0,
+                  0,1,0,0,
+                  0,0,1,0,
+                  0,0,0,1);
+}
+
+Mat4 mulMat4(Mat4 m, Mat4 n) {
+  Mat4 r;
+
+  r.d[0][0] = m.d[0][0]*n.d[0][0] + m.d[0][1]*n.d[1][0] + m.d[0][2]*n.d[2][0] + m.d[0][3]*n.d[3][0];
+  r.d[0][1] = m.d[0][0]*n.d[0][1] + m.d[0][1]*n.d[1][1] + m.d[0][2]*n.d[2][1] + m.d[0][3]*n.d[3][1];
+  r.d[0][2] = m.d[0][0]*n.d[0][2] + m.d[0][1]*n.d[1][2] + m.d[0][2]*n.d[2][2] + m.d[0][3]*n.d[3][2];
+  r.d[0][3] = m.d[0][0]*n.d[0][3] + m.d[0][1]*n.d[1][3] + m.d[0][2]*n.d[2][3] + m.d[0][3]*n.d[3][3];
+
+  r.d[1][0] = m.d[1][0]*n.d[0][0] + m.d[1][1]*n.d[1][0] + m.d[1][2]*n.d[2][0] + m.d[1][3]*n.d[3][0];
+  r.d[1][1] = m.d[1][0]*n.d[0][1] + m.d[1][1]*n.d[1][1] + m.d[1][2]*n.d[2][1] + m.d[1][3]*n.d[3][1];
+  r.d[1][2] = m.d[1][0]*n.d[0][2] + m.d[1][1]*n.d[1][2] + m.d[1][2]*n.d[2][2] + m.d[1][3]*n.d[3][2];
+  r.d[1][3] = m.d[1][0]*n.d[0][3] + m.d[1][1]*n.d[1][3] + m.d[1][2]*n.d[2][3] + m.d[1][3]*n.d[3][3];
+
+  r.d[2][0] = m.d[2][0]*n.d[0][0] + m.d[2][1]*n.d[1][0] + m.d[2][2]*n.d[2][0] + m.d[2][3]*n.d[3][0];
+  r.d[2][1] = m.d[2][0]*n.d[0][1] + m.d[2][1]*n.d[1][1] + m.d[2][2]*n.d[2][1] + m.d[2][3]*n.d[3][1];
+  r.d[2][2] = m.d[2][0]*n.d[0][2] + m.d[2][1]*n.d[1][2] + m.d[2][2]*n.d[2][2] + m.d[2][3]*n.d[3][2];
+  r.d[2][3] = m.d[2][0]*n.d[0][3] + m.d[2][1]*n.d[1][3] + m.d[2][2]*n.d[2][3] + m.d[2][3]*n.d[3][3];
+
+  r.d[3][0] = m.d[3][0]*n.d[0][0] + m.d[3][1]*n.d[1][0] + m.d[3][2]*n.d[2][0] + m.d[3][3]*n.d[3][0];
+  r.d[3][1] = m.d[3][0]*n.d[0][1] + m.d[3][1]*n.d[1][1] + m.d[3][2]*n.d[2][1] + m.d[3][3]*n.d[3][1];
+  r.d[3][2] = m.d[3][0]*n.d[0][2] + m.d[3][1]*n.d[1][2] + m.d[3][2]*n.d[2][2] + m.d[3][3]*n.d[3][2];
+  r.d[3][3] = m.d[3][0]*n.d[0][3] + m.d[3][1]*n.d[1][3] + m.d[3][2]*n.d[2][3] + m.d[3][3]*n.d[3][3];
+
+  return r;
+}
+
+Vec4 mulMatVec4(Mat4 m, Vec4 v) {
+  Vec4 r;
+  r.x = m.d[0][0]*v.x + m.d[0][1]*v.y + m.d[0][2]*v.z + m.d[0][3]*v.w;
+  r.y = m.d[1][0]*v.x + m.d[1][1]*v.y + m.d[1][2]*v.z + m.d[1][3]*v.w;
+  r.z = m.d[2][0]*v.x + m.d[2][1]*v.y + m.d[2][2]*v.z + m.d[2][3]*v.w;
+  r.w = m.d[3][0]*v.x + m.d[3][1]*v.y + m.d[3][2]*v.z + m.d[3][3]*v.w;
+  return r;
+}
+
+float determinantMat4(Mat4 m) {
+  float det =
+    m.d[0][3]*m.d[1][2]*m.d[2][1]*m.d[3][0] - m.d[0][2]*m.d[1][3]*m.d[2][1]*m.d[3][0] - m.d[0][3]*m.d[1][1]*m.d[2][2]*m.d[3][0] + m.d[0][1]*m.d[1][3]*m.d[2][2]*m.d[3][0]+
+    m.d[0][2]*m.d[1][1]*m.d[2][3]*m.d[3][0] - m.d[0][1]*m.d[1][2]*m.d[2][3]*m.d[3][0] - m.d[0][3]*m.d[1][2]*m.d[2][0]*m.d[3][1] + m.d[0][2]*m.d[1][3]*m.d[2][0]*m.d[3][1]+
+    m.d[0][3]*m.d[1][0]*m.d[2][2]*m.d[3][1] - m.d[0][0]*m.d[1][3]*m.d[2][2]*m.d[3][1] - m.d[0][2]*m.d[1][0]*m.d[2][3]*m.d[3][1] + m.d[0][0]*m.d[1][2]*m.d[2][3]*m.d[3][1]+
+    m.d[0][3]*m.d[1][1]*m.d[2][0]*m.d[3][2] - m.d[0][1]*m.d[1][3]*m.d[2][0]*m.d[3][2] - m.d[0][3]*m.d[1][0]*m.d[2][1]*m.d[3][2] + m.d[0][0]*m.d[1][3]*m.d[2][1]*m.d[3][2]+
+    m.d[0][1]*m.d[1][0]*m.d[2][3]*m.d[3][2] - m.d[0][0]*m.d[1][1]*m.d[2][3]*m.d[3][2] - m.d[0][2]*m.d[1][1]*m.d[2][0]*m.d[3][3] + m.d[0][1]*m.d[1][2]*m.d[2][0]*m.d[3][3]+
+    m.d[0][2]*m.d[1][0]*m.d[2][1]*m.d[3][3] - m.d[0][0]*m.d[1][2]*m.d[2][1]*m.d[3][3] - m.d[0][1]*m.d[1][0]*m.d[2][2]*m.d[3][3] + m.d[0][0]*m.d[1][1]*m.d[2][2]*m.d[3][3];
+  return det;
+}
+
+Mat4 invertMat4(Mat4 m) {
+  Mat4 r;
+  float det = determinantMat4(m);
+  assert(fabs(det) > 0.001f);
+  float invDet = 1.0f / det;
+  r.d[0][0] = invDet * (m.d[1][2]*m.d[2][3]*m.d[3][1] - m.d[1][3]*m.d[2][2]*m.d[3][1] + m.d[1][3]*m.d[2][1]*m.d[3][2] - m.d[1][1]*m.d[2][3]*m.d[3][2] - m.d[1][2]*m.d[2][1]*m.d[3][3] + m.d[1][1]*m.d[2][2]*m.d[3][3]);
+  r.d[0][1] = invDet * (m.d[0][3]*m.d[2][2]*m.d[3][1] - m.d[0][2]*m.d[2][3]*m.d[3][1] - m.d[0][3]*m.d[2][1]*m.d[3][2] + m.d[0][1]*m.d[2][3]*m.d[3][2] + m.d[0][2]*m.d[2][1]*m.d[3][3] - m.d[0][1]*m.d[2][2]*m.d[3][3]);
+  r.d[0][2] = invDet * (m.d[0][2]*m.d[1][3]*m.d[3][1] - m.d[0][3]*m.d[1][2]*m.d[3][1] + m.d[0][3]*m.d[1][1]*m.d[3][2] - m.d[0][1]*m.d[1][3]*m.d[3][2] - m.d[0][2]*m.d[1][1]*m.d[3][3] + m.d[0][1]*m.d[1][2]*m.d[3][3]);
+  r.d[0][3] = invDet * (m.d[0][3]*m.d[1][2]*m.d[2][1] - m.d[0][2]*m.d[1][3]*m.d[2][1] - m.d[0][3]*m.d[1][1]*m.d[2][2] + m.d[0][1]*m.d[1][3]*m.d[2][2] + m.d[0][2]*m.d[1][1]*m.d[2][3] - m.d[0][1]*m.d[1][2]*m.d[2][3]);
+  r.d[1][0] = invDet * (m.d[1][3]*m.d[2][2]*m.d[3][0] - m.d[1][2]*m.d[2][3]*m.d[3][0] - m.d[1][3]*m.d[2][0]*m.d[3][2] + m.d[1][0]*m.d[2][3]*m.d[3][2] + m.d[1][2]*m.d[2][0]*m.d[3][3] - m.d[1][0]*m.d[2][2]*m.d[3][3]);
+  r.d[1][1] = invDet * (m.d[0][2]*m.d[2][3]*m.d[3][0] - m.d[0][3]*m.d[2][2]*m.d[3][0] + m.d[0][3]*m.d[2][0]*m.d[3][2] - m.d[0][0]*m.d[2][3]*m.d[3][2] - m.d[0][2]*m.d[2][0]*m.d[3][3] + m.d[0][0]*m.d[2][2]*m.d[3][3]);
+  r.d[1][2] = invDet * (m.d[0][3]*m.d[1][2]*m.d[3][0] - m.d[0][2]*m.d[1][3]*m.d[3][0] - m.d[0][3]*m.d[1][0]*m.d[3][2] + m.d[0][0]*m.d[1][3]*m.d[3][2] + m.d[0][2]*m.d[1][0]*m.d[3][3] - m.d[0][0]*m.d[1][2]*m.d[3][3]);
+  r.d[1][3] = invDet * (m.d[0][2]*m.d[1][3]*m.d[2][0] - m.d[0][3]*m.d[1][2]*m.d[2][0] + m.d[0][3]*m.d[1][0]*m.d[2][2] - m.d[0][0]*m.d[1][3]*m.d[2][2] - m.d[0][2]*m.d[1][0]*m.d[2][3] + m.d[0][0]*m.d[1][2]*m.d[2][3]);
+  r.d[2][0] = invDet * (m.d[1][1]*m.d[2][3]*m.d[3][0] - m.d[1][3]*m.d[2][1]*m.d[3][0] + m.d[1][3]*m.d[2][0]*m.d[3][1] - m.d[1][0]*m.d[2][3]*m.d[3][1] - m.d[1][1]*m.d[2][0]*m.d[3][3] + m.d[1][0]*m.d[2][1]*m.d[3][3]);
+  r.d[2][1] = invDet * (m.d[0][3]*m.d[2][1]*m.d[3][0] - m.d[0][1]*m.d[2][3]*m.d[3][0] - m.d[0][3]*m.d[2][0]*m.d[3][1] + m.d[0][0]*m.d[2][3]*m.d[3][1] + m.d[0][1]*m.d[2][0]*m.d[3][3] - m.d[0][0]*m.d[2][1]*m.d[3][3]);
+  r.d[2][2] = invDet * (m.d[0][1]*m.d[1][3]*m.d[3][0] - m.d[0][3]*m.d[1][1]*m.d[3][0] + m.d[0][3]*m.d[1][0]*m.d[3][1] - m.d[0][0]*m.d[1][3]*m.d[3][1] - m.d[0][1]*m.d[1][0]*m.d[3][3] + m.d[0][0]*m.d[1][1]*m.d[3][3]);
+  r.d[2][3] = invDet * (m.d[0][3]*m.d[1][1]*m.d[2][0] - m.d[0][1]*m.d[1][3]*m.d[2][0] - m.d[0][3]*m.d[1][0]*m.d[2][1] + m.d[0][0]*m.d[1][3]*m.d[2][1] + m.d[0][1]*m.d[1][0]*m.d[2][3] - m.d[0][0]*m.d[1][1]*m.d[2][3]);
+  r.d[3][0] = invDet * (m.d[1][2]*m.d[2][1]*m.d[3][0] - m.d[1][1]*m.d[2][2]*m.d[3][0] - m.d[1][2]*m.d[2][0]*m.d[3][1] + m.d[1][0]*m.d[2][2]*m.d[3][1] + m.d[1][1]*m.d[2][0]*m.d[3][2] - m.d[1][0]*m.d[2][1]*m.d[3][2]);
+  r.d[3][1] = invDet * (m.d[0][1]*m.d[2][2]*m.d[3][0] - m.d[0][2]*m.d[2][1]*m.d[3][0] + m.d[0][2]*m.d[2][0]*m.d[3][1] - m.d[0][0]*m.d[2][2]*m.d[3][1] - m.d[0][1]*m.d[2][0]*m.d[3][2] + m.d[0][0]*m.d[2][1]*m.d[3][2]);
+  r.d[3][2] = invDet * (m.d[0][2]*m.d[1][1]*m.d[3][0] - m.d[0][1]*m.d[1][2]*m.d[3][0] - m.d[0][2]*m.d[1][0]*m.d[3][1] + m.d[0][0]*m.d[1][2]*m.d[3][1] + m.d[0][1]*m.d[1][0]*m.d[3][2] - m.d[0][0]*m.d[1][1]*m.d[3][2]);
+  r.d[3][3] = invDet * (m.d[0][1]*m.d[1][2]*m.d[2][0] - m.d[0][2]*m.d[1][1]*m.d[2][0] + m.d[0][2]*m.d[1][0]*m.d[2][1] - m.d[0][0]*m.d[1][2]*m.d[2][1] - m.d[0][1]*m.d[1][0]*m.d[2][2] + m.d[0][0]*m.d[1][1]*m.d[2][2]);
+  return r;
+}
+
+Mat4 transposeMat4(Mat4 m) {
+  Mat4 r;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      r.d[i][j] = m.d[j][i];
+    }
+  }
+  return r;
+}
+
+// Inverse of a matrix whose last row is (0, 0, 0, 1). Unlike invertMat4 it
+// takes small scales.
+Mat4 invertAffineMat4(Mat4 m) {
+  float c00 = m.d[1][1]*m.d[2][2] - m.d[1][2]*m.d[2][1];
+  float c01 = m.d[1][2]*m.d[2][0] - m.d[1][0]*m.d[2][2];
+  float c02 = m.d[1][0]*m.d[2][1] - m.d[1][1]*m.d[2][0];
+  float det = m.d[0][0]*c00 + m.d[0][1]*c01 + m.d[0][2]*c02;
+  assert(det != 0.0f);
+  float invDet = 1.0f / det;
+  Mat4 r;
+  r.d[0][0] = c00*invDet;
+  r.d[0][1] = (m.d[0][2]*m.d[2][1] - m.d[0][1]*m.d[2][2])*invDet;
+  r.d[0][2] = (m.d[0][1]*m.d[1][2] - m.d[0][2]*m.d[1][1])*invDet;
+  r.d[1][0] = c01*invDet;
+  r.d[1][1] = (m.d[0][0]*m.d[2][2] - m.d[0][2]*m.d[2][0])*invDet;
+  r.d[1][2] = (m.d[0][2]*m.d[1][0] - m.d[0][0]*m.d[1][2])*invDet;
+  r.d[2][0] = c02*invDet;
+  r.d[2][1] = (m.d[0][1]*m.d[2][0] - m.d[0][0]*m.d[2][1])*invDet;
+  r.d[2][2] = (m.d[0][0]*m.d[1][1] - m.d[0][1]*m.d[1][0])*invDet;
+  for (int i = 0; i < 3; ++i) {
+    r.d[i][3] = -(r.d[i][0]*m.d[0][3] + r.d[i][1]*m.d[1][3] + r.d[i][2]*m.d[2][3]);
+    r.d[3][i] = 0;
+  }
+  r.d[3][3] = 1;
+  return r;
+}
+
+// Scales by scale, turns by angleY radians around the y axis, then moves to
+// position.
+Mat4 getModelMat4(Vec3 position, float angleY, float scale) {
+  float c = cosf(angleY)*scale, s = sinf(angleY)*scale;
+  return makeMat4( c, 0,     s, position.x,
+                   0, scale, 0, position.y,
+                  -s, 0,     c, position.z,
+                   0, 0,     0, 1);
+}
+
+// malloc with the result aligned to alignment (a power of two). Free with
+// freeAligned.
+void *allocAligned(size_t size, size_t alignment) {
+  u8 *base = malloc(size + alignment + sizeof(void *));
+  assert(base);
+  uintptr_t aligned = ((uintptr_t)(base + sizeof(void *)) + alignment-1) & ~(uintptr_t)(alignment-1);
+  ((void **)aligned)[-1] = base;
+  return (void *)aligned;
+}
+
+void freeAligned(void *p) {
+  if (p) free(((void **)p)[-1]);
+}
+
+// The linear 0xAARRGGBB image renderScene leaves for output and overlays.
+u32 *backbuffer;
+int backbufferWidth;
+int backbufferHeight;
+
+// Screen tiles the renderer bins triangles into and rasterizes one at a time.
+#define TILE_SIZE 64
+
+// How the screen-sized render targets (zBuffer and the visibility buffer)
+// are stored. Linear is row-major over the whole screen. Tiled stores each
+// TILE_SIZE square contiguously, row-major inside it, so a tile's rows don't
+// stride across the screen; edge tiles are padded to full size.
+typedef enum {
+  FRAMEBUFFER_LAYOUT_LINEAR,
+  FRAMEBUFFER_LAYOUT_TILED,
+  FRAMEBUFFER_LAYOUT_COUNT,
+} FramebufferLayout;
+
+char *framebufferLayoutNames[FRAMEBUFFER_LAYOUT_COUNT] = {"linear", "tiled"};
+
+// takes effect at the next initBackbuffer
+FramebufferLayout framebufferLayout = FRAMEBUFFER_LAYOUT_LINEAR;
+FramebufferLayout currentFramebufferLayout;
+
+// render targets, FRAMEBUFFER_ALIGN aligned
+#define FRAMEBUFFER_ALIGN 64
+float *zBuffer;
+
+// A tile's linear (unclamped) color while it's rasterized, one plane per
+// channel so the kernels store shading results without converting them.
+// It lives on the rasterizing worker's stack, so it stays in the cache until
+// it's resolved into the backbuffer.
+typedef struct {
+  float r[TILE_SIZE*TILE_SIZE];
+  float g[TILE_SIZE*TILE_SIZE];
+  float b[TILE_SIZE*TILE_SIZE];
+} ColorTile;
+
+// How ColorTiles are converted to the backbuffer's 0xAARRGGBB:
+// clamped to [0, 1] and rounded, after Reinhard tone mapping (c/(1 + c)) or
+// followed by gamma 2 (a square root) if chosen.
+typedef enum {
+  COLOR_RESOLVE_CLAMP,
+  COLOR_RESOLVE_GAMMA,
+  COLOR_RESOLVE_REINHARD,
+  COLOR_RESOLVE_COUNT,
+} ColorResolve;
+
+char *colorResolveNames[COLOR_RESOLVE_COUNT] = {"clamp", "gamma", "reinhard"};
+
+ColorResolve colorResolve = COLOR_RESOLVE_CLAMP;
+
+// Multisample anti-aliasing: with msaaSamples 4 or 8, coverage and depth are
+// tested at that many points per pixel, but a triangle is still shaded once
+// per pixel, and its result goes to every sample it passed. Forward shading
+// only; 1 turns it off.
+#define MSAA_MAX_SAMPLES 8
+// no sample is further than this many subpixels from its pixel center in x
+// or y
+#define MSAA_SAMPLE_RADIUS 7
+
+int msaaSamples = 1;
+
+// sample offsets from the pixel center, in subpixels (the standard D3D
+// patterns)
+typedef struct {
+  int numSamples;
+  int x[MSAA_MAX_SAMPLES];
+  int y[MSAA_MAX_SAMPLES];
+} MsaaPattern;
+
+MsaaPattern msaaPatterns[] = {
+  {4, {-2, 6, -6, 2}, {-6, -2, 2, 6}},
+  {8, {1, -1, 5, -3, -5, -7, 3, 7}, {-3, 3, 1, -5, 5, -1, 7, -7}},
+};
+
+MsaaPattern *getMsaaPattern(int numSamples) {
+  for (int i = 0; i < (int)(sizeof(msaaPatterns)/sizeof(*msaaPatterns)); ++i) {
+    if (msaaPatterns[i].numSamples == numSamples) return &msaaPatterns[i];
+  }
+  assert(!"unsupported MSAA sample count");
+  return NULL;
+}
+
+typedef enum {
+  MSAA_PIXEL_CLEAR,   // no triangle yet, the ColorTile holds the clear color
+  MSAA_PIXEL_UNIFORM, // every sample shows one triangle, whose color is in the ColorTile
+  MSAA_PIXEL_SAMPLES, // the colors are per sample
+} MsaaPixelState;
+
+// A tile's samples, next to its ColorTile: one plane per sample, indexed
+// like the ColorTile, so the SIMD kernels test a sample of consecutive pixels
+// at once. Only MSAA_PIXEL_SAMPLES pixels use the sample colors, so pixels
+// inside a triangle cost one color store, and the resolve only averages the
+// pixels on edges. Too big for the stack, so every worker has one.
+typedef struct {
+  float z[MSAA_MAX_SAMPLES][TILE_SIZE*TILE_SIZE];
+  float r[MSAA_MAX_SAMPLES][TILE_SIZE*TILE_SIZE];
+  float g[MSAA_MAX_SAMPLES][TILE_SIZE*TILE_SIZE];
+  float b[MSAA_MAX_SAMPLES][TILE_SIZE*TILE_SIZE];
+  u32 state[TILE_SIZE*TILE_SIZE]; // MsaaPixelState, 32 bits to load alongside the floats
+} MsaaTile;
+
+// Hierarchical z: the farthest depth in every HIZ_BLOCK_SIZE square of the
+// z-buffer, never nearer than the real minimum. Larger z is nearer, so a
+// triangle whose nearest depth over a block is not above this can't pass
+// the depth test anywhere in it.
+#define HIZ_BLOCK_SIZE 8
+float *hiZ;
+int hiZWidth;
+int hiZHeight;
+// Fast clear tags, one per hiZ block: set while the block's depth and color
+// (or visibility) still hold last frame's pixels that should read as
+// cleared. rasterizeTile sets them instead of clearing a tile, and clears a
+// block when a triangle first reaches it, or at the end if none does.
+u8 *hiZClearTags;
+
+// Visibility buffer for deferred shading: the triangle in front at every
+// pixel and its texture coordinates there.
+u32 *visTriangles;
+float *visU;
+float *visV;
+
+// Tile rects pack each tile coordinate into 8 bits, so no side can have
+// more than 256 tiles (16384 pixels). The screen also has to be inside the
+// clipping guard band, which keeps snapped coordinates within
+// RASTER_COORD_LIMIT and ends 15360 pixels from the origin, so that's the
+// limit.
+#define MAX_BACKBUFFER_SIZE 15360
+
+// (Re)allocates the backbuffer and render targets for a width x height
+// screen in the current framebufferLayout. Returns false, keeping the old
+// ones, if a side is out of 1..MAX_BACKBUFFER_SIZE.
+bool initBackbuffer(int width, int height) {
+  if (width <= 0 || height <= 0 || width > MAX_BACKBUFFER_SIZE || height > MAX_BACKBUFFER_SIZE) {
+    debugPrint("can't render %dx%d, sides go from 1 to %d pixels\n", width, height, MAX_BACKBUFFER_SIZE);
+    return false;
+  }
+  freeAligned(backbuffer);
+  freeAligned(zBuffer);
+  freeAligned(hiZ);
+  freeAligned(hiZClearTags);
+  freeAligned(visTriangles);
+  freeAligned(visU);
+  freeAligned(visV);
+
+  backbufferWidth = width;
+  backbufferHeight = height;
+  currentFramebufferLayout = framebufferLayout;
+  size_t numPixels = (size_t)width*height;
+  backbuffer = allocAligned(numPixels*sizeof(*backbuffer), FRAMEBUFFER_ALIGN);
+  if (currentFramebufferLayout == FRAMEBUFFER_LAYOUT_TILED) {
+    int tilesX = (width + TILE_SIZE-1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE-1) / TILE_SIZE;
+    numPixels = (size_t)tilesX*tilesY*TILE_SIZE*TILE_SIZE;
+  }
+  zBuffer = allocAligned(numPixels*sizeof(*zBuffer), FRAMEBUFFER_ALIGN);
+  hiZWidth = (width + HIZ_BLOCK_SIZE-1) / HIZ_BLOCK_SIZE;
+  hiZHeight = (height + HIZ_BLOCK_SIZE-1) / HIZ_BLOCK_SIZE;
+  hiZ = allocAligned(hiZWidth*hiZHeight*sizeof(*hiZ), FRAMEBUFFER_ALIGN);
+  hiZClearTags = allocAligned(hiZWidth*hiZHeight*sizeof(*hiZClearTags), FRAMEBUFFER_ALIGN);
+  visTriangles = allocAligned(numPixels*sizeof(*visTriangles), FRAMEBUFFER_ALIGN);
+  visU = allocAligned(numPixels*sizeof(*visU), FRAMEBUFFER_ALIGN);
+  visV = allocAligned(numPixels*sizeof(*visV), FRAMEBUFFER_ALIGN);
+  return true;
+}
+
+// Where a tile's pixels are in the render targets: pixel (x, y) of the tile
+// is at index x + y*pitch + offset, and in its ColorTile at
+// x + y*TILE_SIZE + colorOffset. msaa holds its samples in MSAA mode and is
+// NULL otherwise.
+typedef struct {
+  int pitch;
+  int offset;
+  ColorTile *color;
+  int colorOffset;
+  MsaaTile *msaa;
+} TileAddress;
+
+TileAddress getTileAddress(int tileX, int tileY, ColorTile *color, MsaaTile *msaa) {
+  TileAddress result;
+  result.color = color;
+  result.msaa = msaa;
+  result.colorOffset = -tileX*TILE_SIZE - tileY*TILE_SIZE*TILE_SIZE;
+  if (currentFramebufferLayout == FRAMEBUFFER_LAYOUT_TILED) {
+    int tilesX = (backbufferWidth + TILE_SIZE-1) / TILE_SIZE;
+    int tileStart = (tileX + tileY*tilesX)*TILE_SIZE*TILE_SIZE;
+    result.pitch = TILE_SIZE;
+    result.offset = tileStart - tileX*TILE_SIZE - tileY*TILE_SIZE*TILE_SIZE;
+  } else {
+    result.pitch = backbufferWidth;
+    result.offset = 0;
+  }
+  return result;
+}
+
+// Sets count 32-bit values from p on to the bits of value, 16 bytes per store
+// where it can.
+FORCE_INLINE void fill32(void *p, u32 value, int count) {
+  u8 *dest = p;
+  int i = 0;
+#if SIMD_X86 && (defined(__SSE2__) || defined(_M_X64))
+  __m128i v = _mm_set1_epi32((int)value);
+  for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i *)(dest + i*sizeof(value)), v);
+#endif
+  // memcpy, as the destination may be floats
+  for (; i < count; ++i) memcpy(dest + i*sizeof(value), &value, sizeof(value));
+}
+
+u32 getFloatBits(float f) {
+  u32 bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+u32 makeU32Color(Vec3 color) {
+  assert(color.x >= 0.0f && color.x <= 1.0f);
+  assert(color.y >= 0.0f && color.y <= 1.0f);
+  assert(color.z >= 0.0f && color.z <= 1.0f);
+  //0xFFRRGGBB
+  u8 r = (u8)(color.x*0xFF);
+  u8 g = (u8)(color.y*0xFF);
+  u8 b = (u8)(color.z*0xFF);
+  uint32_t result = (0xFF << 8*3) | (r << 8*2) | (g << 8*1) | (b << 8*0);
+  return result;
+}
+
+FORCE_INLINE void storeColor(ColorTile *tile, int c, Vec3 color) {
+  tile->r[c] = color.x;
+  tile->g[c] = color.y;
+  tile->b[c] = color.z;
+}
+
+// One channel of a ColorTile pixel as a byte. The SIMD resolve kernels do
+// the same operations per lane; NaN resolves to 0.
+FORCE_INLINE u32 resolveChannel(float c, ColorResolve resolve) {
+  c = c > 0.0f ? c : 0.0f;
+  if (resolve == COLOR_RESOLVE_REINHARD) c = c / (1.0f + c);
+  c = c < 1.0f ? c : 1.0f;
+  if (resolve == COLOR_RESOLVE_GAMMA) c = sqrtf(c);
+  return (u32)(c*255.0f + 0.5f);
+}
+
+FORCE_INLINE u32 resolvePixel(float r, float g, float b, ColorResolve resolve) {
+  return 0xFF000000 | (resolveChannel(r, resolve) << 16) | (resolveChannel(g, resolve) << 8) | resolveChannel(b, resolve);
+}
+
+void setPixel(int x, int y, Vec3 color) {
+  /* assert(x >= 0 && x < backbufferWidth); */
+  /* assert(y >= 0 && y < backbufferHeight); */
+
+  if (x >= 0 && x < backbufferWidth && y >= 0 && y < backbufferHeight)
+    backbuffer[y*backbufferWidth + x] = makeU32Color(color);
+}
+
+void drawFilledRect(int left, int top, int right, int bottom, Vec3 color) {
+  for (int y = top; y <= bottom; ++y) {
+    for (int x = left; x <= right; ++x) {
+      setPixel(x, y, color);
+    }
+  }
+}
+
+void drawLine(int x1, int y1, int x2, int y2, Vec3 color) {
+  if (x1 == x2 && y1 == y2) {
+    setPixel(x1, y1, color);
+    return;
+  }
+
+  int xStart, xEnd, yStart, yEnd;
+  int dx = x2 - x1;
+  int dy = y2 - y1;
+
+  if (abs(dx) > abs(dy)) {
+    float m = (float)dy / (float)dx;
+    if (x1 < x2) {
+      xStart = x1;
+      yStart = y1;
+      xEnd = x2;
+      yEnd = y2;
+    } else {
+      xStart = x2;
+      yStart = y2;
+      xEnd = x1;
+      yEnd = y1;
+    }
+    for (int x = xStart; x <= xEnd; ++x) {
+      int y = (int)(m * (x - xStart) + yStart);
+      setPixel(x, y, color);
+    }
+  } else {
+    float m = (float)dx / (float)dy;
+    if (y1 < y2) {
+      xStart = x1;
+      yStart = y1;
+      xEnd = x2;
+      yEnd = y2;
+    } else {
+      xStart = x2;
+      yStart = y2;
+      xEnd = x1;
+      yEnd = y1;
+    }
+    for (int y = yStart; y <= yEnd; ++y) {
+      int x = (int)(m * (y - yStart) + xStart);
+      setPixel(x, y, color);
+    }
+  }
+}
+
+#define SWAP(x,y) {int t=x; x=y; y=t;}
+
+void drawTriangleLineSweep(int x0, int y0, int x1, int y1, int x2, int y2, Vec3 color) {
+  if (y2 < y1) {SWAP(y2, y1); SWAP(x2, x1);}
+  if (y1 < y0) {SWAP(y1, y0); SWAP(x1, x0);}
+  if (y2 < y1) {SWAP(y2, y1); SWAP(x2, x1);}
+  assert(y0 <= y1 && y1 <= y2);
+
+#if 0
+  drawLine(x0, y0, x1, y1, color);
+  drawLine(x1, y1, x2, y2, color);
+  drawLine(x2, y2, x0, y0, color);
+#endif
+
+  for (int y = y0; y <= y1; ++y) {
+    float tA = (float)(y - y0) / (y1 - y0);
+    int xA = (int)((1.0f - tA)*x0 + tA*x1);
+    float tB = (float)(y - y0) / (y2 - y0);
+    int xB = (int)((1.0f - tB)*x0 + tB*x2);
+    drawLine(xA, y, xB, y, color);
+  }
+
+  for (int y = y1; y <= y2; ++y) {
+    float tA = (float)(y - y1) / (y2 - y1);
+    int xC = (int)((1.0f - tA)*x1 + tA*x2);
+    float tB = (float)(y - y0) / (y2 - y0);
+    int xD = (int)((1.0f - tB)*x0 + tB*x2);
+    drawLine(xC, y, xD, y, color);
+  }
+}
+
+Vec3 getBarycentricCoords(Vec3 A, Vec3 B, Vec3 C, Vec3 P) {
+  Vec3 AB = subVec3(B, A);
+  Vec3 AC = subVec3(C, A);
+  Vec3 PA = subVec3(A, P);
+  Vec3 v1 = makeVec3(AB.x, AC.x, PA.x);
+  Vec3 v2 = makeVec3(AB.y, AC.y, PA.y);
+  Vec3 c = crossVec3(v1, v2);
+  if (fabs(c.z) < 0.00001f) return makeVec3(-1.0f, 1.0f, 1.0f);
+  float u = c.x / c.z;
+  float v = c.y / c.z;
+  float w = 1.0f - u - v;
+  return makeVec3(w, u, v);
+}
+
+#pragma pack(push, 1)
+typedef struct {
+  u16 origin;
+  u16 length;
+  u8 bitsPerEntry;
+} TGAColorMap;
+
+typedef struct {
+  u16 xOrigin;
+  u16 yOrigin;
+  u16 width;
+  u16 height;
+  u8 bitsPerPixel;
+  u8 descriptor;
+} TGAImageSpecification;
+
+typedef struct {
+  u8 numCharsInIdField;
+  u8 colorMapType;
+  u8 imageType;
+  TGAColorMap colorMap;
+  TGAImageSpecification imageSpec;
+} TGAHeader;
+#pragma pack(pop)
+
+typedef enum {
+  TEXTURE_LAYOUT_LINEAR, // row after row
+  TEXTURE_LAYOUT_TILED,  // 4x4 texel blocks in row order, each block contiguous
+  TEXTURE_LAYOUT_MORTON, // Z-order curve, power-of-two sizes only
+  TEXTURE_LAYOUT_COUNT,
+} TextureLayout;
+
+char *textureLayoutNames[TEXTURE_LAYOUT_COUNT] = {"linear", "tiled", "morton"};
+
+// layout readTGAFile stores textures in
+TextureLayout textureLayout = TEXTURE_LAYOUT_TILED;
+
+typedef struct Texture {
+  Vec3 *pixels;
+  u32 width;
+  u32 height;
+  TextureLayout layout;
+  u32 mortonBits; // log2 of the smaller side, for TEXTURE_LAYOUT_MORTON
+  // Mip chain, mips[0] is the texture itself. The levels have no mips of
+  // their own.
+  int numMips;
+  struct Texture *mips;
+} Texture;
+
+// Halves the texture until it's 1x1 with a 2x2 box filter. Odd sizes round
+// down and reuse the last row or column.
+void buildMipChain(Texture *texture) {
+  assert(texture->layout == TEXTURE_LAYOUT_LINEAR);
+  int numMips = 1;
+  for (u32 w = texture->width, h = texture->height; w > 1 || h > 1; w = w > 1 ? w/2 : 1, h = h > 1 ? h/2 : 1) {
+    ++numMips;
+  }
+
+  texture->numMips = numMips;
+  texture->mips = malloc(numMips*sizeof(*texture->mips));
+  Texture *level = &texture->mips[0];
+  level->pixels = texture->pixels;
+  level->width = texture->width;
+  level->height = texture->height;
+  level->layout = texture->layout;
+  level->mortonBits = 0;
+  level->numMips = 0;
+  level->mips = NULL;
+
+  for (int i = 1; i < numMips; ++i) {
+    Texture *src = &texture->mips[i-1];
+    Texture *dst = &texture->mips[i];
+    dst->width = src->width > 1 ? src->width/2 : 1;
+    dst->height = src->height > 1 ? src->height/2 : 1;
+    dst->layout = TEXTURE_LAYOUT_LINEAR;
+    dst->mortonBits = 0;
+    dst->numMips = 0;
+    dst->mips = NULL;
+    dst->pixels = malloc(dst->width*dst->height*sizeof(*dst->pixels));
+    for (u32 y = 0; y < dst->height; ++y) {
+      u32 y0 = 2*y < src->height ? 2*y : src->height-1;
+      u32 y1 = 2*y+1 < src->height ? 2*y+1 : src->height-1;
+      for (u32 x = 0; x < dst->width; ++x) {
+        u32 x0 = 2*x < src->width ? 2*x : src->width-1;
+        u32 x1 = 2*x+1 < src->width ? 2*x+1 : src->width-1;
+        Vec3 a = src->pixels[x0 + y0*src->width];
+        Vec3 b = src->pixels[x1 + y0*src->width];
+        Vec3 c = src->pixels[x0 + y1*src->width];
+        Vec3 d = src->pixels[x1 + y1*src->width];
+        dst->pixels[x + y*dst->width] = makeVec3(0.25f*(a.x + b.x + c.x + d.x),
+                                                 0.25f*(a.y + b.y + c.y + d.y),
+                                                 0.25f*(a.z + b.z + c.z + d.z));
+      }
+    }
+  }
+}
+
+// Spreads the low 16 bits of x out to the even bits.
+u32 part1By1(u32 x) {
+  x &= 0x0000FFFF;
+  x = (x | (x << 8)) & 0x00FF00FF;
+  x = (x | (x << 4)) & 0x0F0F0F0F;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+u32 getTexelIndex(Texture *texture, u32 x, u32 y) {
+  switch (texture->layout) {
+    case TEXTURE_LAYOUT_TILED: {
+      u32 blocksPerRow = (texture->width + 3) >> 2;
+      return (((x >> 2) + (y >> 2)*blocksPerRow) << 4) + (x & 3) + ((y & 3) << 2);
+    }
+    case TEXTURE_LAYOUT_MORTON: {
+      // Interleave the bits both coordinates have; the larger side's extra
+      // bits go on top (the other coordinate has none there).
+      u32 bits = texture->mortonBits;
+      u32 mask = (1u << bits) - 1;
+      return part1By1(x & mask) | (part1By1(y & mask) << 1) | (((x | y) >> bits) << (2*bits));
+    }
+    default:
+      return x + y*texture->width;
+  }
+}
+
+u32 getTextureStorageSize(u32 width, u32 height, TextureLayout layout) {
+  if (layout == TEXTURE_LAYOUT_TILED) {
+    return ((width + 3) & ~3u) * ((height + 3) & ~3u);
+  }
+  return width*height;
+}
+
+bool isPowerOfTwo(u32 x) {
+  return x && !(x & (x-1));
+}
+
+// Reorders a linear texture and all its mips. Morton order needs power-of-two
+// sizes; other textures stay linear. Returns the layout that was applied.
+TextureLayout convertTextureLayout(Texture *texture, TextureLayout layout) {
+  assert(texture->layout == TEXTURE_LAYOUT_LINEAR);
+  if (layout == TEXTURE_LAYOUT_MORTON && !(isPowerOfTwo(texture->width) && isPowerOfTwo(texture->height))) {
+    layout = TEXTURE_LAYOUT_LINEAR;
+  }
+  if (layout == TEXTURE_LAYOUT_LINEAR) return layout;
+
+  int numLevels = texture->mips ? texture->numMips : 1;
+  for (int i = 0; i < numLevels; ++i) {
+    Texture *level = texture->mips ? &texture->mips[i] : texture;
+    u32 bits = 0;
+    while ((2u << bits) <= level->width && (2u << bits) <= level->height) ++bits;
+
+    Texture converted = *level;
+    converted.layout = layout;
+    converted.mortonBits = bits;
+    u32 size = getTextureStorageSize(level->width, level->height, layout);
+    converted.pixels = calloc(size, sizeof(*converted.pixels));
+    for (u32 y = 0; y < level->height; ++y) {
+      for (u32 x = 0; x < level->width; ++x) {
+        converted.pixels[getTexelIndex(&converted, x, y)] = level->pixels[x + y*level->width];
+      }
+    }
+    free(level->pixels);
+    *level = converted;
+  }
+  if (texture->mips) {
+    texture->pixels = texture->mips[0].pixels;
+    texture->layout = layout;
+    texture->mortonBits = texture->mips[0].mortonBits;
+  }
+  return layout;
+}
+
+Texture getMipLevel(Texture *texture, int level) {
+  if (!texture->mips) return *texture;
+  if (level < 0) level = 0;
+  if (level > texture->numMips-1) level = texture->numMips-1;
+  return texture->mips[level];
+}
+
+typedef enum {
+  TGADT_TC = 2, // true color
+  TGADT_BW = 3, // black & white
+  TGADT_RLE_TC = 10, // true color
+  TGADT_RLE_BW = 11, // black & white
+} TGADataType;
+
+// TGAImageSpecification.descriptor bits
+#define TGA_RIGHT_TO_LEFT 0x10
+#define TGA_TOP_TO_BOTTOM 0x20
+
+// c/255.0f for every byte value, so decoding doesn't divide per channel
+float unormToFloat[256];
+
+// Expands count 8-bit grey, BGR or BGRA pixels (the alpha byte is dropped) to
+// float RGB. srcEnd is the end of readable memory, wide loads stay before it.
+typedef void TGAUnpack(Vec3 *dst, u8 *src, u32 count, int bytesPerPixel, u8 *srcEnd);
+
+void unpackTGAPixelsScalar(Vec3 *dst, u8 *src, u32 count, int bytesPerPixel, u8 *srcEnd) {
+  for (u32 i = 0; i < count; ++i, src += bytesPerPixel) {
+    if (bytesPerPixel == 1) {
+      float c = unormToFloat[src[0]];
+      dst[i] = makeVec3(c, c, c);
+    } else {
+      dst[i] = makeVec3(unormToFloat[src[2]], unormToFloat[src[1]], unormToFloat[src[0]]);
+    }
+  }
+}
+
+#if SIMD_X86
+// Four pixels per step: one shuffle puts their channels in RGB order, then
+// they're widened to 12 floats. The divide is exact, so the result matches
+// the scalar table.
+TARGET_SSE4 void unpackTGAPixelsSSE4(Vec3 *dst, u8 *src, u32 count, int bytesPerPixel, u8 *srcEnd) {
+  __m128i shuffle;
+  if (bytesPerPixel == 1) {
+    shuffle = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, -1, -1, -1, -1);
+  } else if (bytesPerPixel == 3) {
+    shuffle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
+  } else {
+    shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  }
+  __m128 c255 = _mm_set1_ps(255.0f);
+
+  u32 i = 0;
+  for (; i + 4 <= count && src + 16 <= srcEnd; i += 4, src += 4*bytesPerPixel) {
+    __m128i rgb = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)src), shuffle);
+    __m128 a = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(rgb));
+    __m128 b = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(rgb, 4)));
+    __m128 c = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(rgb, 8)));
+    float *out = (float *)(dst + i);
+    _mm_storeu_ps(out, _mm_div_ps(a, c255));
+    _mm_storeu_ps(out + 4, _mm_div_ps(b, c255));
+    _mm_storeu_ps(out + 8, _mm_div_ps(c, c255));
+  }
+  unpackTGAPixelsScalar(dst + i, src, count - i, bytesPerPixel, srcEnd);
+}
+#endif
+
+// Reports why filePath didn't load and returns the empty texture
+// readTGAFile fails with, freeing what it had.
+Texture failTGALoad(char *filePath, char *reason, PlatformFile file, Texture *texture) {
+  debugPrint("%s: %s\n", filePath, reason);
+  if (file.contents) platformUnmapFile(file);
+  free(texture->pixels);
+  Texture empty = {0};
+  return empty;
+}
+
+// Decodes true color (24 or 32 bit) and grey (8 bit) TGA files, raw or RLE.
+// Rows end up bottom to top whatever the file's origin. Files it can't read
+// give a texture with no pixels.
+Texture readTGAFile(char *filePath) {
+  Texture result = {0};
+  f64 startTime = platformGetSeconds();
+
+  if (unormToFloat[255] == 0) {
+    for (int i = 0; i < 256; ++i) unormToFloat[i] = i/255.0f;
+  }
+  TGAUnpack *unpackTGAPixels = unpackTGAPixelsScalar;
+#if SIMD_X86
+  if (getCpuSimdLevel() >= SIMD_SSE4) unpackTGAPixels = unpackTGAPixelsSSE4;
+#endif
+
+  PlatformFile file = platformMapFile(filePath);
+  if (!file.contents) return failTGALoad(filePath, "can't open", file, &result);
+  if (file.size < sizeof(TGAHeader)) return failTGALoad(filePath, "truncated header", file, &result);
+  u8 *fileContents = file.contents;
+  u8 *fileEnd = fileContents + file.size;
+
+  TGAHeader *header = (TGAHeader *)fileContents;
+  if (file.size - sizeof(TGAHeader) < header->numCharsInIdField) return failTGALoad(filePath, "truncated id field", file, &result);
+  u8 *data = fileContents + sizeof(TGAHeader) + header->numCharsInIdField;
+  u8 imageType = header->imageType;
+  bool isRLE = imageType == TGADT_RLE_TC || imageType == TGADT_RLE_BW;
+  bool isGrey = imageType == TGADT_BW || imageType == TGADT_RLE_BW;
+  if (!isRLE && imageType != TGADT_TC && imageType != TGADT_BW) return failTGALoad(filePath, "unsupported image type", file, &result);
+  u8 bitsPerPixel = header->imageSpec.bitsPerPixel;
+  if (isGrey ? bitsPerPixel != 8 : (bitsPerPixel != 24 && bitsPerPixel != 32)) {
+    return failTGALoad(filePath, "unsupported pixel size", file, &result);
+  }
+  if (header->colorMapType != 0) return failTGALoad(filePath, "color maps aren't supported", file, &result);
+  if (header->imageSpec.descriptor & TGA_RIGHT_TO_LEFT) return failTGALoad(filePath, "right to left images aren't supported", file, &result);
+  if (!header->imageSpec.width || !header->imageSpec.height) return failTGALoad(filePath, "empty image", file, &result);
+  int bytesPerPixel = bitsPerPixel/8;
+
+  result.width = header->imageSpec.width;
+  result.height = header->imageSpec.height;
+  u32 numPixels = result.width*result.height;
+  result.pixels = malloc(numPixels*sizeof(*result.pixels));
+  Vec3 *tex = result.pixels;
+  Vec3 *texEnd = result.pixels + numPixels;
+
+  if (!isRLE) {
+    if ((size_t)(fileEnd - data) < (size_t)numPixels*bytesPerPixel) return failTGALoad(filePath, "truncated pixels", file, &result);
+    unpackTGAPixels(tex, data, numPixels, bytesPerPixel, fileEnd);
+  } else {
+    while (tex < texEnd) {
+      if (data == fileEnd) return failTGALoad(filePath, "truncated RLE packet", file, &result);
+      bool isRunPacket = *data & 0x80;
+      u32 length = (*(data++) & 0x7F) + 1;
+      if (length > (u32)(texEnd - tex)) length = (u32)(texEnd - tex);
+      if (isRunPacket) {
+        if (fileEnd - data < bytesPerPixel) return failTGALoad(filePath, "truncated RLE packet", file, &result);
+        unpackTGAPixels(tex, data, 1, bytesPerPixel, fileEnd);
+        for (u32 j = 1; j < length; ++j) {
+          tex[j] = tex[0];
+        }
+        data += bytesPerPixel;
+      } else {
+        if ((size_t)(fileEnd - data) < (size_t)length*bytesPerPixel) return failTGALoad(filePath, "truncated RLE packet", file, &result);
+        unpackTGAPixels(tex, data, length, bytesPerPixel, fileEnd);
+        data += length*bytesPerPixel;
+      }
+      tex += length;
+    }
+  }
+
+  if (header->imageSpec.descriptor & TGA_TOP_TO_BOTTOM) {
+    for (u32 y = 0; y < result.height/2; ++y) {
+      Vec3 *a = result.pixels + y*result.width;
+      Vec3 *b = result.pixels + (result.height-1-y)*result.width;
+      for (u32 x = 0; x < result.width; ++x) {
+        Vec3 t = a[x];
+        a[x] = b[x];
+        b[x] = t;
+      }
+    }
+  }
+
+  f64 decodeTime = platformGetSeconds() - startTime;
+  debugPrint("%s: %ux%u, %.1f MB decoded in %.2f ms (%.0f MB/s)\n", filePath, result.width, result.height,
+             file.size/1e6, decodeTime*1000.0, file.size/1e6/decodeTime);
+  platformUnmapFile(file);
+
+  buildMipChain(&result);
+  convertTextureLayout(&result, textureLayout);
+  return result;
+}
+
+#pragma pack(push, 1)
+typedef struct {
+  char signature[2];
+  u32 fileSize;
+  u16 reserved1;
+  u16 reserved2;
+  u32 imageDataOffset;
+} BitmapFileHeader;
+
+typedef struct {
+  u32 dibHeaderSize;
+  u32 width;
+  u32 height;
+  u16 planes;
+  u16 bitsPerPixel;
+  u32 compression;
+  u32 imageSize;
+  u32 xPixelsPerMeter;
+  u32 yPixelsPerMeter;
+  u32 colorsInColorTable;
+  u32 importantColorCount;
+} DIBHeader;
+
+typedef struct {
+  BitmapFileHeader fileHeader;
+  DIBHeader dibHeader;
+} BMPMainHeader;
+#pragma pack(pop)
+
+Texture readBMPFile(char *filePath) {
+  Texture result = {0};
+
+  PlatformFile file = platformReadEntireFile(filePath);
+  assert(file.contents);
+  u8 *fileContents = file.contents;
+
+  BMPMainHeader *header = (BMPMainHeader *)fileContents;
+  u8 *data = fileContents + header->fileHeader.imageDataOffset;
+  result.width = header->dibHeader.width;
+  result.height = header->dibHeader.height;
+  result.pixels = malloc(result.width * result.height * sizeof(*result.pixels));
+  Vec3 *tex = result.pixels;
+  Vec3 *texEnd = result.pixels + (result.width*result.height);
+
+  while (tex < texEnd) {
+    Vec3 color;
+    float b = *(data++);
+    float g = *(data++);
+    float r = *(data++);
+    color = makeVec3(r/255.0f, g/255.0f, b/255.0f);
+    *(tex++) = color;
+  }
+
+  platformFreeFile(file);
+  return result;
+}
+
+bool isTextured = true;
+bool normalMapEnabled = true;
+// the direction light travels in, in world space; need not be unit length
+Vec3 lightDir = {-1, 0, -0.4f};
+
+// A texture and the normal map that goes with it, looked up with the same
+// texel indices.
+typedef struct {
+  Texture texture;
+  Texture normalMap;
+} Material;
+
+// What a binned triangle is shaded with. There's one per instance drawn, as
+// the light direction is in the instance's object space.
+typedef struct {
+  Material *material;
+  Vec3 lightDir;
+} DrawState;
+
+// What the pixel kernels compute. Each kernel is compiled once per mode with
+// only the texture fetches and lighting math that mode needs, and renderScene
+// picks the mode from isTextured and normalMapEnabled once per frame.
+typedef enum {
+  SHADE_TEXTURE_LIT, // texture modulated by normal mapped lighting
+  SHADE_TEXTURE,     // texture alone
+  SHADE_LIT,         // normal mapped lighting alone
+  SHADE_MODE_COUNT,
+} ShadeMode;
+
+ShadeMode getShadeMode(void) {
+  if (!isTextured) return SHADE_LIT;
+  return normalMapEnabled ? SHADE_TEXTURE_LIT : SHADE_TEXTURE;
+}
+
+typedef enum {
+  TEXTURE_FILTER_NEAREST,   // nearest texel of the full-size texture
+  TEXTURE_FILTER_MIPMAP,    // nearest texel of the mip level picked per triangle
+  TEXTURE_FILTER_TRILINEAR, // bilinear in the two closest mip levels, blended
+  TEXTURE_FILTER_COUNT,
+} TextureFilter;
+
+char *textureFilterNames[TEXTURE_FILTER_COUNT] = {"nearest", "mipmap", "trilinear"};
+
+TextureFilter textureFilter = TEXTURE_FILTER_MIPMAP;
+
+typedef struct {
+  float x[3], y[3], z[3], u[3], v[3];
+} RasterTriangle;
+
+//
+// Triangle setup for the edge-function rasterizer. Vertex positions are
+// snapped to SUBPIXEL_BITS of fixed-point precision, and every edge is turned
+// into E(x,y) = A*x + B*y + C over subpixel coordinates, positive inside. The
+// pixel loop then only adds A or B (scaled to whole pixels) to step across
+// columns and rows. Pixels are sampled at integer coordinates, and pixels
+// exactly on an edge are only filled for top and left edges, so triangles
+// sharing an edge never draw the same pixel twice.
+//
+// z, u and v are interpolated from planes a = a0 + dadx*(x - x0) + dady*(y - y0)
+// whose gradients are computed once here.
+//
+
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+// Snapped coordinates must stay inside +-RASTER_COORD_LIMIT pixels so that edge
+// values over a tile fit in 32 bits. Clipping keeps triangles inside a guard
+// band that respects this.
+#define RASTER_COORD_LIMIT 16384.0f
+
+typedef struct {
+  i32 edgeA[3];
+  i32 edgeB[3];
+  i64 edgeC[3]; // includes the fill rule bias
+
+  int minX, minY, maxX, maxY; // pixel bounding box, inclusive
+
+  float refX, refY;
+  float z, dzdx, dzdy;
+  float u, dudx, dudy;
+  float v, dvdx, dvdy;
+
+  u32 draw; // its DrawState in the TileBins
+} TriangleSetup;
+
+// Returns false for degenerate triangles or ones too large to rasterize.
+bool setupTriangle(RasterTriangle *t, TriangleSetup *s) {
+  i32 x[3], y[3];
+  for (int i = 0; i < 3; ++i) {
+    // NaN-safe: comparisons with NaN fail
+    if (!(fabsf(t->x[i]) < RASTER_COORD_LIMIT && fabsf(t->y[i]) < RASTER_COORD_LIMIT)) return false;
+    x[i] = (i32)floorf(t->x[i]*SUBPIXEL_ONE + 0.5f);
+    y[i] = (i32)floorf(t->y[i]*SUBPIXEL_ONE + 0.5f);
+  }
+
+  // make the winding counter-clockwise (y is up), so inside is E > 0
+  int i0 = 0, i1 = 1, i2 = 2;
+  i64 area = (i64)(x[1] - x[0])*(y[2] - y[0]) - (i64)(x[2] - x[0])*(y[1] - y[0]);
+  if (area == 0) return false;
+  if (area < 0) {
+    i1 = 2;
+    i2 = 1;
+  }
+  int order[3] = {i0, i1, i2};
+
+  for (int e = 0; e < 3; ++e) {
+    int i = order[e];
+    int j = order[(e+1)%3];
+    s->edgeA[e] = y[i] - y[j];
+    s->edgeB[e] = x[j] - x[i];
+    s->edgeC[e] = (i64)x[i]*y[j] - (i64)x[j]*y[i];
+    bool isTopLeft = s->edgeA[e] > 0 || (s->edgeA[e] == 0 && s->edgeB[e] < 0);
+    if (!isTopLeft) s->edgeC[e] -= 1;
+  }
+
+  // pixel centers are at integer coordinates
+  i32 minXs = x[0], maxXs = x[0], minYs = y[0], maxYs = y[0];
+  for (int i = 1; i < 3; ++i) {
+    if (x[i] < minXs) minXs = x[i];
+    if (x[i] > maxXs) maxXs = x[i];
+    if (y[i] < minYs) minYs = y[i];
+    if (y[i] > maxYs) maxYs = y[i];
+  }
+  // MSAA samples can be inside even if their pixel center isn't
+  if (msaaSamples > 1) {
+    minXs -= MSAA_SAMPLE_RADIUS;
+    minYs -= MSAA_SAMPLE_RADIUS;
+    maxXs += MSAA_SAMPLE_RADIUS;
+    maxYs += MSAA_SAMPLE_RADIUS;
+  }
+  s->minX = (minXs + SUBPIXEL_ONE-1) >> SUBPIXEL_BITS;
+  s->minY = (minYs + SUBPIXEL_ONE-1) >> SUBPIXEL_BITS;
+  s->maxX = maxXs >> SUBPIXEL_BITS;
+  s->maxY = maxYs >> SUBPIXEL_BITS;
+  // only the visible part of the bounding box is ever walked
+  if (s->minX < 0) s->minX = 0;
+  if (s->minY < 0) s->minY = 0;
+  if (s->maxX > backbufferWidth-1) s->maxX = backbufferWidth-1;
+  if (s->maxY > backbufferHeight-1) s->maxY = backbufferHeight-1;
+  if (s->minX > s->maxX || s->minY > s->maxY) return false;
+
+  float fx0 = (float)x[0] / SUBPIXEL_ONE, fy0 = (float)y[0] / SUBPIXEL_ONE;
+  float fx1 = (float)x[1] / SUBPIXEL_ONE, fy1 = (float)y[1] / SUBPIXEL_ONE;
+  float fx2 = (float)x[2] / SUBPIXEL_ONE, fy2 = (float)y[2] / SUBPIXEL_ONE;
+  float invArea = 1.0f / ((fx1 - fx0)*(fy2 - fy0) - (fx2 - fx0)*(fy1 - fy0));
+  s->refX = fx0;
+  s->refY = fy0;
+
+#define SETUP_PLANE(a, dadx, dady) \
+  s->a = t->a[0]; \
+  s->dadx = ((t->a[1] - t->a[0])*(fy2 - fy0) - (t->a[2] - t->a[0])*(fy1 - fy0)) * invArea; \
+  s->dady = ((t->a[2] - t->a[0])*(fx1 - fx0) - (t->a[1] - t->a[0])*(fx2 - fx0)) * invArea;
+  SETUP_PLANE(z, dzdx, dzdy);
+  SETUP_PLANE(u, dudx, dudy);
+  SETUP_PLANE(v, dvdx, dvdy);
+#undef SETUP_PLANE
+
+  return true;
+}
+
+// The part of a triangle that falls into one clip rect, ready for a pixel
+// kernel: edge values and attributes at (minX, minY) plus their steps.
+typedef struct {
+  int minX, minY, maxX, maxY;
+  i32 e[3], stepX[3], stepY[3];
+  float zRow, dzdx, dzdy;
+  float uRow, dudx, dudy;
+  float vRow, dvdx, dvdy;
+  // toward the light, in the object space the normal map is in
+  Vec3 lightDir;
+  // only used by the trilinear kernel
+  int mipLevel;
+  float mipBlend;
+  // only used by the visibility kernels: the triangle's index in the tile bins
+  u32 triangle;
+  // set by the kernels: covered pixels that were depth tested, how many
+  // passed, and (forward kernels only) how many of those were still clear.
+  // Forward kernels only count them for the profiler.
+  u32 numTested;
+  u32 numWritten;
+  u32 numCovered;
+  // see TileAddress
+  int pitch;
+  int offset;
+  ColorTile *color;
+  int colorOffset;
+  MsaaTile *msaa;
+} TriangleRect;
+
+typedef void PixelKernel(TriangleRect *r, Texture *texture, Texture *normalMap);
+
+// Shades count render target pixels from index i on, reading their texture
+// coordinates from the visibility buffer, into color from index c on.
+typedef void SpanShader(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap, Vec3 lightDir);
+
+// Instantiate a FORCE_INLINE kernel body that takes the ShadeMode as its last
+// argument for every mode, as a table indexed by mode.
+#define DEFINE_PIXEL_KERNELS(target, name, body) \
+  target void name##TextureLit(TriangleRect *r, Texture *texture, Texture *normalMap) { body(r, texture, normalMap, SHADE_TEXTURE_LIT); } \
+  target void name##Texture(TriangleRect *r, Texture *texture, Texture *normalMap) { body(r, texture, normalMap, SHADE_TEXTURE); } \
+  target void name##Lit(TriangleRect *r, Texture *texture, Texture *normalMap) { body(r, texture, normalMap, SHADE_LIT); } \
+  PixelKernel *name[SHADE_MODE_COUNT] = {name##TextureLit, name##Texture, name##Lit};
+
+#define DEFINE_SPAN_SHADERS(target, name, body) \
+  target void name##TextureLit(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap, Vec3 lightDir) { body(color, c, i, count, texture, normalMap, lightDir, SHADE_TEXTURE_LIT); } \
+  target void name##Texture(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap, Vec3 lightDir) { body(color, c, i, count, texture, normalMap, lightDir, SHADE_TEXTURE); } \
+  target void name##Lit(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap, Vec3 lightDir) { body(color, c, i, count, texture, normalMap, lightDir, SHADE_LIT); } \
+  SpanShader *name[SHADE_MODE_COUNT] = {name##TextureLit, name##Texture, name##Lit};
+
+//
+// Deferred shading. Instead of shading every pixel that passes the depth
+// test when it does, the visibility kernels only store depth, the triangle
+// and its texture coordinates, and after a tile's last triangle one pass
+// shades each visible pixel once. UVs are affine in screen space, so they
+// stand in for barycentrics and shading reads them directly; both paths
+// compute them identically, so the images match the forward kernels'.
+//
+
+#define VIS_NONE 0xFFFFFFFF
+
+bool deferredShading = false;
+
+typedef struct {
+  u32 pixelsTested;
+  u32 depthWrites;
+  u32 shadedPixels;
+  u32 pixelsCovered;
+} ShadingStats;
+
+// counts for the last renderScene. In deferred mode depthWrites -
+// shadedPixels is the shading that forward mode would have overdrawn. The
+// rest is only counted when PROFILER is on, except that pixelsCovered always
+// equals shadedPixels in deferred mode.
+ShadingStats shadingStats;
+
+// Nearest lookup and/or normal mapped lighting, as the mode says.
+FORCE_INLINE Vec3 shadeNearest(Texture *texture, Texture *normalMap, Vec3 lightDir, float u, float v, ShadeMode mode) {
+  int tx = (int)(u*(texture->width-1));
+  int ty = (int)(v*(texture->height-1));
+  if (tx < 0) tx = 0;
+  if (tx > (int)texture->width-1) tx = texture->width-1;
+  if (ty < 0) ty = 0;
+  if (ty > (int)texture->height-1) ty = texture->height-1;
+  u32 texIndex = getTexelIndex(texture, tx, ty);
+  if (mode == SHADE_TEXTURE) return texture->pixels[texIndex];
+
+  Vec3 normal = normalMap->pixels[texIndex];
+  normal = normalizeVec3(normal);
+
+  float intensity = -dotVec3(normal, lightDir);
+  if (intensity < 0) intensity = 0;
+
+#if 0
+  if (intensity > 0.75f) intensity = 1.0f;
+  else if (intensity > 0.5f) intensity = 0.75f;
+  else if (intensity > 0.25f) intensity = 0.5f;
+  else if (intensity > 0) intensity = 0.25f;
+#endif
+
+  if (mode == SHADE_LIT) return makeVec3(intensity,intensity,intensity);
+  return scaleVec3(texture->pixels[texIndex], intensity);
+}
+
+// Reference pixel kernel. The SIMD kernels in raster_simd.c must produce
+// exactly the same pixels, so they follow its arithmetic operation for
+// operation.
+FORCE_INLINE void drawTriangleRectScalarBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    i32 e0 = e[0], e1 = e[1], e2 = e[2];
+    for (int x = r->minX; x <= r->maxX; ++x, e0 += r->stepX[0], e1 += r->stepX[1], e2 += r->stepX[2]) {
+      if ((e0 | e1 | e2) < 0) continue;
+      PROFILE_COUNT(numTested, 1);
+      // attributes are evaluated from the row start, not accumulated along
+      // the row, so every pixel is rounded the same way
+      float dx = (float)(x - r->minX);
+      float z = zRow + r->dzdx*dx;
+      int i = x + r->pitch*y + r->offset;
+      if (z > zBuffer[i]) {
+        PROFILE_COUNT(numWritten, 1);
+        PROFILE_COUNT(numCovered, zBuffer[i] == -9999.0f);
+        zBuffer[i] = z;
+        float u = uRow + r->dudx*dx;
+        float v = vRow + r->dvdx*dx;
+        storeColor(r->color, x + y*TILE_SIZE + r->colorOffset, shadeNearest(texture, normalMap, r->lightDir, u, v, mode));
+      }
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+DEFINE_PIXEL_KERNELS(, drawTriangleRectScalar, drawTriangleRectScalarBody)
+
+// Depth, triangle and texture coordinates only, for deferred shading.
+void drawTriangleRectVisibilityScalar(TriangleRect *r, Texture *texture, Texture *normalMap) {
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    i32 e0 = e[0], e1 = e[1], e2 = e[2];
+    for (int x = r->minX; x <= r->maxX; ++x, e0 += r->stepX[0], e1 += r->stepX[1], e2 += r->stepX[2]) {
+      if ((e0 | e1 | e2) < 0) continue;
+      PROFILE_COUNT(numTested, 1);
+      float dx = (float)(x - r->minX);
+      float z = zRow + r->dzdx*dx;
+      int i = x + r->pitch*y + r->offset;
+      if (z > zBuffer[i]) {
+        zBuffer[i] = z;
+        visTriangles[i] = r->triangle;
+        visU[i] = uRow + r->dudx*dx;
+        visV[i] = vRow + r->dvdx*dx;
+        ++numWritten;
+      }
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+}
+
+FORCE_INLINE void shadeSpanScalarBody(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap,
+                                      Vec3 lightDir, ShadeMode mode) {
+  for (int end = i + count; i < end; ++i, ++c) {
+    storeColor(color, c, shadeNearest(texture, normalMap, lightDir, visU[i], visV[i], mode));
+  }
+}
+
+DEFINE_SPAN_SHADERS(, shadeSpanScalar, shadeSpanScalarBody)
+
+// Converts count ColorTile pixels from index c on into dest.
+typedef void ResolveKernel(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve);
+
+FORCE_INLINE void resolveRowScalarBody(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve) {
+  for (int k = 0; k < count; ++k) dest[k] = resolvePixel(color->r[c + k], color->g[c + k], color->b[c + k], resolve);
+}
+
+void resolveRowScalar(u32 *dest, ColorTile *color, int c, int count, ColorResolve resolve) {
+  switch (resolve) {
+    case COLOR_RESOLVE_CLAMP: resolveRowScalarBody(dest, color, c, count, COLOR_RESOLVE_CLAMP); break;
+    case COLOR_RESOLVE_GAMMA: resolveRowScalarBody(dest, color, c, count, COLOR_RESOLVE_GAMMA); break;
+    case COLOR_RESOLVE_REINHARD: resolveRowScalarBody(dest, color, c, count, COLOR_RESOLVE_REINHARD); break;
+    default: assert(!"unknown color resolve");
+  }
+}
+
+// u and v map to texel centers the same way as in nearest sampling.
+Vec3 sampleBilinear(Texture *texture, float u, float v) {
+  float fx = u*(texture->width-1);
+  float fy = v*(texture->height-1);
+  if (!(fx > 0)) fx = 0;
+  if (!(fy > 0)) fy = 0;
+  if (fx > (float)(texture->width-1)) fx = (float)(texture->width-1);
+  if (fy > (float)(texture->height-1)) fy = (float)(texture->height-1);
+  u32 x0 = (u32)fx;
+  u32 y0 = (u32)fy;
+  u32 x1 = x0+1 < texture->width ? x0+1 : x0;
+  u32 y1 = y0+1 < texture->height ? y0+1 : y0;
+  float ax = fx - (float)x0;
+  float ay = fy - (float)y0;
+  Vec3 a = texture->pixels[getTexelIndex(texture, x0, y0)];
+  Vec3 b = texture->pixels[getTexelIndex(texture, x1, y0)];
+  Vec3 c = texture->pixels[getTexelIndex(texture, x0, y1)];
+  Vec3 d = texture->pixels[getTexelIndex(texture, x1, y1)];
+  Vec3 r;
+  r.x = (a.x + (b.x - a.x)*ax) + ((c.x + (d.x - c.x)*ax) - (a.x + (b.x - a.x)*ax))*ay;
+  r.y = (a.y + (b.y - a.y)*ax) + ((c.y + (d.y - c.y)*ax) - (a.y + (b.y - a.y)*ax))*ay;
+  r.z = (a.z + (b.z - a.z)*ax) + ((c.z + (d.z - c.z)*ax) - (a.z + (b.z - a.z)*ax))*ay;
+  return r;
+}
+
+Vec3 sampleTrilinear(Texture *texture, int level, float blend, float u, float v) {
+  Texture level0 = getMipLevel(texture, level);
+  Vec3 c0 = sampleBilinear(&level0, u, v);
+  if (blend == 0.0f) return c0;
+  Texture level1 = getMipLevel(texture, level+1);
+  Vec3 c1 = sampleBilinear(&level1, u, v);
+  return makeVec3(c0.x + (c1.x - c0.x)*blend, c0.y + (c1.y - c0.y)*blend, c0.z + (c1.z - c0.z)*blend);
+}
+
+FORCE_INLINE Vec3 shadeTrilinear(Texture *texture, Texture *normalMap, Vec3 lightDir, int mipLevel, float mipBlend, float u, float v,
+                                  ShadeMode mode) {
+  if (mode == SHADE_TEXTURE) return sampleTrilinear(texture, mipLevel, mipBlend, u, v);
+
+  Vec3 normal = sampleTrilinear(normalMap, mipLevel, mipBlend, u, v);
+  normal = normalizeVec3(normal);
+
+  float intensity = -dotVec3(normal, lightDir);
+  if (intensity < 0) intensity = 0;
+
+  if (mode == SHADE_LIT) return makeVec3(intensity,intensity,intensity);
+  return scaleVec3(sampleTrilinear(texture, mipLevel, mipBlend, u, v), intensity);
+}
+
+// Same as drawTriangleRectScalar but with filtered texture lookups. There is
+// no SIMD version; eight texel fetches per map make it a quality mode, not a
+// fast path.
+FORCE_INLINE void drawTriangleRectTrilinearBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    i32 e0 = e[0], e1 = e[1], e2 = e[2];
+    for (int x = r->minX; x <= r->maxX; ++x, e0 += r->stepX[0], e1 += r->stepX[1], e2 += r->stepX[2]) {
+      if ((e0 | e1 | e2) < 0) continue;
+      PROFILE_COUNT(numTested, 1);
+      float dx = (float)(x - r->minX);
+      float z = zRow + r->dzdx*dx;
+      int i = x + r->pitch*y + r->offset;
+      if (z > zBuffer[i]) {
+        PROFILE_COUNT(numWritten, 1);
+        PROFILE_COUNT(numCovered, zBuffer[i] == -9999.0f);
+        zBuffer[i] = z;
+        float u = uRow + r->dudx*dx;
+        float v = vRow + r->dvdx*dx;
+        storeColor(r->color, x + y*TILE_SIZE + r->colorOffset, shadeTrilinear(texture, normalMap, r->lightDir, r->mipLevel, r->mipBlend, u, v, mode));
+      }
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+DEFINE_PIXEL_KERNELS(, drawTriangleRectTrilinear, drawTriangleRectTrilinearBody)
+
+// Stores a pixel's color to the samples in the passed mask, which are not
+// all of them, expanding the pixel to per sample colors first if needed.
+FORCE_INLINE void storeMsaaSamples(MsaaTile *msaa, ColorTile *color, int c, u32 passed, int numSamples, Vec3 shaded) {
+  if (msaa->state[c] != MSAA_PIXEL_SAMPLES) {
+    for (int s = 0; s < numSamples; ++s) {
+      msaa->r[s][c] = color->r[c];
+      msaa->g[s][c] = color->g[c];
+      msaa->b[s][c] = color->b[c];
+    }
+    msaa->state[c] = MSAA_PIXEL_SAMPLES;
+  }
+  for (int s = 0; s < numSamples; ++s) {
+    if (!(passed >> s & 1)) continue;
+    msaa->r[s][c] = shaded.x;
+    msaa->g[s][c] = shaded.y;
+    msaa->b[s][c] = shaded.z;
+  }
+}
+
+// MSAA kernel: coverage and depth per sample, then one shading at the pixel
+// center (as in the other kernels) for all the samples that passed. A pixel
+// whose samples all pass goes back to a single color.
+FORCE_INLINE void drawTriangleRectMsaaBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode, bool trilinear,
+                                           int numSamples) {
+  MsaaPattern *pattern = getMsaaPattern(numSamples);
+  u32 allSamples = (1u << numSamples) - 1;
+  MsaaTile *msaa = r->msaa;
+  ColorTile *color = r->color;
+
+  // edge values and depths at the samples relative to the pixel center;
+  // the steps are whole pixels of the subpixel edge equations. A pixel whose
+  // center is at least innerE inside an edge has all its samples inside it,
+  // and one that is more than outerE outside has none.
+  i32 sampleE[3][MSAA_MAX_SAMPLES];
+  i32 innerE[3] = {0, 0, 0}, outerE[3] = {0, 0, 0};
+  float sampleZ[MSAA_MAX_SAMPLES];
+  for (int s = 0; s < numSamples; ++s) {
+    for (int i = 0; i < 3; ++i) {
+      sampleE[i][s] = (r->stepX[i]*pattern->x[s] + r->stepY[i]*pattern->y[s]) / SUBPIXEL_ONE;
+      if (-sampleE[i][s] > innerE[i]) innerE[i] = -sampleE[i][s];
+      if (sampleE[i][s] > outerE[i]) outerE[i] = sampleE[i][s];
+    }
+    sampleZ[s] = r->dzdx*((float)pattern->x[s] / SUBPIXEL_ONE) + r->dzdy*((float)pattern->y[s] / SUBPIXEL_ONE);
+  }
+
+  float zRow = r->zRow, uRow = r->uRow, vRow = r->vRow;
+  i32 e[3] = {r->e[0], r->e[1], r->e[2]};
+  u32 numTested = 0, numWritten = 0, numCovered = 0;
+
+  for (int y = r->minY; y <= r->maxY; ++y) {
+    i32 e0 = e[0], e1 = e[1], e2 = e[2];
+    for (int x = r->minX; x <= r->maxX; ++x, e0 += r->stepX[0], e1 += r->stepX[1], e2 += r->stepX[2]) {
+      if (((e0 + outerE[0]) | (e1 + outerE[1]) | (e2 + outerE[2])) < 0) continue;
+      u32 inside = allSamples;
+      if (((e0 - innerE[0]) | (e1 - innerE[1]) | (e2 - innerE[2])) < 0) {
+        inside = 0;
+        for (int s = 0; s < numSamples; ++s) {
+          if (((e0 + sampleE[0][s]) | (e1 + sampleE[1][s]) | (e2 + sampleE[2][s])) >= 0) inside |= 1u << s;
+        }
+        if (!inside) continue;
+      }
+      PROFILE_COUNT(numTested, 1);
+      float dx = (float)(x - r->minX);
+      float z = zRow + r->dzdx*dx;
+      int c = x + y*TILE_SIZE + r->colorOffset;
+      u32 passed = 0;
+      for (int s = 0; s < numSamples; ++s) {
+        float sz = z + sampleZ[s];
+        if ((inside >> s & 1) && sz > msaa->z[s][c]) {
+          msaa->z[s][c] = sz;
+          passed |= 1u << s;
+        }
+      }
+      if (!passed) continue;
+      PROFILE_COUNT(numWritten, 1);
+      PROFILE_COUNT(numCovered, msaa->state[c] == MSAA_PIXEL_CLEAR);
+
+      float u = uRow + r->dudx*dx;
+      float v = vRow + r->dvdx*dx;
+      Vec3 shaded = trilinear ? shadeTrilinear(texture, normalMap, r->lightDir, r->mipLevel, r->mipBlend, u, v, mode)
+                              : shadeNearest(texture, normalMap, r->lightDir, u, v, mode);
+      if (passed == allSamples) {
+        storeColor(color, c, shaded);
+        msaa->state[c] = MSAA_PIXEL_UNIFORM;
+        continue;
+      }
+      storeMsaaSamples(msaa, color, c, passed, numSamples, shaded);
+    }
+    e[0] += r->stepY[0];
+    e[1] += r->stepY[1];
+    e[2] += r->stepY[2];
+    zRow += r->dzdy;
+    uRow += r->dudy;
+    vRow += r->dvdy;
+  }
+  r->numTested = numTested;
+  r->numWritten = numWritten;
+  r->numCovered = numCovered;
+}
+
+// constant sample counts, so that the sample loops unroll
+FORCE_INLINE void drawTriangleRectMsaaNearestBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  if (msaaSamples == 4) drawTriangleRectMsaaBody(r, texture, normalMap, mode, false, 4);
+  else drawTriangleRectMsaaBody(r, texture, normalMap, mode, false, 8);
+}
+
+FORCE_INLINE void drawTriangleRectMsaaTrilinearBody(TriangleRect *r, Texture *texture, Texture *normalMap, ShadeMode mode) {
+  if (msaaSamples == 4) drawTriangleRectMsaaBody(r, texture, normalMap, mode, true, 4);
+  else drawTriangleRectMsaaBody(r, texture, normalMap, mode, true, 8);
+}
+
+DEFINE_PIXEL_KERNELS(, drawTriangleRectMsaaScalar, drawTriangleRectMsaaNearestBody)
+DEFINE_PIXEL_KERNELS(, drawTriangleRectMsaaTrilinear, drawTriangleRectMsaaTrilinearBody)
+
+// Averages the samples of the MSAA_PIXEL_SAMPLES pixels among count
+// ColorTile pixels from index c on into the ColorTile, which is then
+// resolved as usual.
+typedef void MsaaResolveKernel(ColorTile *color, MsaaTile *msaa, int c, int count, int numSamples);
+
+void resolveMsaaRowScalar(ColorTile *color, MsaaTile *msaa, int c, int count, int numSamples) {
+  float scale = 1.0f / (float)numSamples;
+  for (int end = c + count; c < end; ++c) {
+    if (msaa->state[c] != MSAA_PIXEL_SAMPLES) continue;
+    float r = msaa->r[0][c], g = msaa->g[0][c], b = msaa->b[0][c];
+    for (int s = 1; s < numSamples; ++s) {
+      r += msaa->r[s][c];
+      g += msaa->g[s][c];
+      b += msaa->b[s][c];
+    }
+    storeColor(color, c, makeVec3(r*scale, g*scale, b*scale));
+  }
+}
+
+#include "raster_simd.c"
+
+// UVs are affine in screen space, so the texel footprint of a pixel is the
+// same over the whole triangle and one LOD per triangle is exact.
+float getTriangleLod(TriangleSetup *t, Texture *texture) {
+  float w = (float)texture->width;
+  float h = (float)texture->height;
+  float dx2 = (t->dudx*w)*(t->dudx*w) + (t->dvdx*h)*(t->dvdx*h);
+  float dy2 = (t->dudy*w)*(t->dudy*w) + (t->dvdy*h)*(t->dvdy*h);
+  float lod = 0.5f*log2f(dx2 > dy2 ? dx2 : dy2);
+  if (!(lod > 0)) lod = 0; // also catches NaN and -inf
+  return lod;
+}
+
+// Sets up the edge values of r over its rect. Edges that have the whole rect
+// inside drop out of the pixel loop; the rest span at most the rect (a tile),
+// so their values fit in 32 bits from here on. Returns false if the rect is
+// outside an edge, and sets *covered if it is inside all of them. The rect
+// is widened by margin subpixels for these tests, to include MSAA samples.
+bool setupRectEdges(TriangleSetup *t, TriangleRect *r, int margin, bool *covered) {
+  *covered = true;
+  for (int i = 0; i < 3; ++i) {
+    i64 a = t->edgeA[i], b = t->edgeB[i];
+    i64 e00 = a*r->minX*SUBPIXEL_ONE + b*r->minY*SUBPIXEL_ONE + t->edgeC[i];
+    i64 dx = a*(r->maxX - r->minX)*SUBPIXEL_ONE;
+    i64 dy = b*(r->maxY - r->minY)*SUBPIXEL_ONE;
+    i64 edgeMargin = ((a < 0 ? -a : a) + (b < 0 ? -b : b))*margin;
+    i64 emin = e00 + (dx < 0 ? dx : 0) + (dy < 0 ? dy : 0) - edgeMargin;
+    i64 emax = e00 + (dx > 0 ? dx : 0) + (dy > 0 ? dy : 0) + edgeMargin;
+    if (emax < 0) return false;
+    if (emin >= 0) {
+      r->e[i] = 0;
+      r->stepX[i] = 0;
+      r->stepY[i] = 0;
+    } else {
+      r->e[i] = (i32)e00;
+      r->stepX[i] = t->edgeA[i]*SUBPIXEL_ONE;
+      r->stepY[i] = t->edgeB[i]*SUBPIXEL_ONE;
+      *covered = false;
+    }
+  }
+  return true;
+}
+
+// Depth range of the triangle over a rect widened by margin subpixels, and
+// by the rounding of the kernels' row stepping.
+void getRectDepthRange(TriangleSetup *t, int minX, int minY, int maxX, int maxY, int margin, float *zMin, float *zMax) {
+  float z = t->z + t->dzdx*((float)minX - t->refX) + t->dzdy*((float)minY - t->refY);
+  float zStepX = t->dzdx*(float)(maxX - minX);
+  float zStepY = t->dzdy*(float)(maxY - minY);
+  float zMargin = (fabsf(t->dzdx) + fabsf(t->dzdy))*((float)margin / SUBPIXEL_ONE);
+  float zError = (fabsf(z) + fabsf(zStepX) + fabsf(zStepY) + zMargin)*(16*FLT_EPSILON);
+  *zMin = z + (zStepX < 0 ? zStepX : 0) + (zStepY < 0 ? zStepY : 0) - zMargin - zError;
+  *zMax = z + (zStepX > 0 ? zStepX : 0) + (zStepY > 0 ? zStepY : 0) + zMargin + zError;
+}
+
+void getHiZBlockRect(int bx, int by, TriangleRect *r) {
+  r->minX = bx*HIZ_BLOCK_SIZE;
+  r->minY = by*HIZ_BLOCK_SIZE;
+  r->maxX = r->minX + HIZ_BLOCK_SIZE-1 < backbufferWidth-1 ? r->minX + HIZ_BLOCK_SIZE-1 : backbufferWidth-1;
+  r->maxY = r->minY + HIZ_BLOCK_SIZE-1 < backbufferHeight-1 ? r->minY + HIZ_BLOCK_SIZE-1 : backbufferHeight-1;
+}
+
+// Clears the tagged hiZ blocks under the rect: depth (or the MSAA sample
+// depths), and color or (in deferred mode) visibility.
+void clearTaggedBlocks(TileAddress address, int minX, int minY, int maxX, int maxY, Vec3 clearColor) {
+  if (minX > maxX || minY > maxY) return;
+  for (int by = minY / HIZ_BLOCK_SIZE; by <= maxY / HIZ_BLOCK_SIZE; ++by) {
+    for (int bx = minX / HIZ_BLOCK_SIZE; bx <= maxX / HIZ_BLOCK_SIZE; ++bx) {
+      u8 *tag = &hiZClearTags[bx + by*hiZWidth];
+      if (!*tag) continue;
+      *tag = 0;
+      TriangleRect block;
+      getHiZBlockRect(bx, by, &block);
+      int width = block.maxX - block.minX + 1;
+      for (int y = block.minY; y <= block.maxY; ++y) {
+        int i = block.minX + y*address.pitch + address.offset;
+        if (address.msaa) {
+          int c = block.minX + y*TILE_SIZE + address.colorOffset;
+          for (int s = 0; s < msaaSamples; ++s) fill32(address.msaa->z[s] + c, getFloatBits(-9999.0f), width);
+        } else {
+          fill32(zBuffer + i, getFloatBits(-9999.0f), width);
+        }
+        if (deferredShading) {
+          fill32(visTriangles + i, VIS_NONE, width);
+        } else {
+          int c = block.minX + y*TILE_SIZE + address.colorOffset;
+          fill32(address.color->r + c, getFloatBits(clearColor.x), width);
+          fill32(address.color->g + c, getFloatBits(clearColor.y), width);
+          fill32(address.color->b + c, getFloatBits(clearColor.z), width);
+        }
+      }
+    }
+  }
+}
+
+// In deferred mode writes the visibility buffer instead of shading. Adds the
+// pixels it depth tested and wrote to stats.
+void drawTriangleBarycentric(TriangleSetup *t, u32 triangle, DrawState *draw, ShadeMode mode, ShadingStats *stats,
+                            TileAddress address, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY) {
+  TriangleRect r;
+  r.minX = t->minX > clipMinX ? t->minX : clipMinX;
+  r.minY = t->minY > clipMinY ? t->minY : clipMinY;
+  r.maxX = t->maxX < clipMaxX ? t->maxX : clipMaxX;
+  r.maxY = t->maxY < clipMaxY ? t->maxY : clipMaxY;
+  if (r.minX > r.maxX || r.minY > r.maxY) return;
+  // in MSAA mode hiZ holds sample depths, and coverage and depth ranges
+  // reach out to the samples
+  int margin = address.msaa ? MSAA_SAMPLE_RADIUS : 0;
+
+  // Test against the hiZ blocks under the rect: all of them in front is an
+  // early out, all of them behind is an early accept, and otherwise only the
+  // blocks the triangle actually touches count.
+  int blockMinX = r.minX / HIZ_BLOCK_SIZE, blockMaxX = r.maxX / HIZ_BLOCK_SIZE;
+  int blockMinY = r.minY / HIZ_BLOCK_SIZE, blockMaxY = r.maxY / HIZ_BLOCK_SIZE;
+  float hiZMin = FLT_MAX, hiZMax = -FLT_MAX;
+  for (int by = blockMinY; by <= blockMaxY; ++by) {
+    for (int bx = blockMinX; bx <= blockMaxX; ++bx) {
+      float z = hiZ[bx + by*hiZWidth];
+      if (z < hiZMin) hiZMin = z;
+      if (z > hiZMax) hiZMax = z;
+    }
+  }
+  float zMin, zMax;
+  getRectDepthRange(t, r.minX, r.minY, r.maxX, r.maxY, margin, &zMin, &zMax);
+  // NaN-safe: a NaN depth never passes the depth test
+  if (!(zMax > hiZMin)) return;
+  if (!(zMin > hiZMax)) {
+    bool visible = false;
+    for (int by = blockMinY; by <= blockMaxY && !visible; ++by) {
+      for (int bx = blockMinX; bx <= blockMaxX && !visible; ++bx) {
+        TriangleRect block;
+        getHiZBlockRect(bx, by, &block);
+        bool covered;
+        if (!setupRectEdges(t, &block, margin, &covered)) continue;
+        getRectDepthRange(t, block.minX, block.minY, block.maxX, block.maxY, margin, &zMin, &zMax);
+        if (zMax > hiZ[bx + by*hiZWidth]) visible = true;
+      }
+    }
+    if (!visible) return;
+  }
+
+  bool covered;
+  if (!setupRectEdges(t, &r, margin, &covered)) return;
+
+  float fx = (float)r.minX - t->refX;
+  float fy = (float)r.minY - t->refY;
+  r.zRow = t->z + t->dzdx*fx + t->dzdy*fy;
+  r.uRow = t->u + t->dudx*fx + t->dudy*fy;
+  r.vRow = t->v + t->dvdx*fx + t->dvdy*fy;
+  r.dzdx = t->dzdx; r.dzdy = t->dzdy;
+  r.dudx = t->dudx; r.dudy = t->dudy;
+  r.dvdx = t->dvdx; r.dvdy = t->dvdy;
+  r.pitch = address.pitch;
+  r.offset = address.offset;
+  r.color = address.color;
+  r.colorOffset = address.colorOffset;
+  r.msaa = address.msaa;
+  r.lightDir = draw->lightDir;
+
+  Texture *texture = &draw->material->texture, *normalMap = &draw->material->normalMap;
+
+  if (deferredShading) {
+    r.triangle = triangle;
+    drawTriangleRectVisibility(&r, texture, normalMap);
+  } else {
+    PixelKernel **kernels = address.msaa ? drawTriangleRectMsaa : drawTriangleRect;
+    switch (textureFilter) {
+      case TEXTURE_FILTER_NEAREST:
+        kernels[mode](&r, texture, normalMap);
+        break;
+      case TEXTURE_FILTER_MIPMAP: {
+        int level = (int)(getTriangleLod(t, texture) + 0.5f);
+        Texture textureLevel = getMipLevel(texture, level);
+        Texture normalMapLevel = getMipLevel(normalMap, level);
+        kernels[mode](&r, &textureLevel, &normalMapLevel);
+      } break;
+      case TEXTURE_FILTER_TRILINEAR: {
+        float lod = getTriangleLod(t, texture);
+        r.mipLevel = (int)lod;
+        r.mipBlend = r.mipLevel+1 < texture->numMips ? lod - (float)r.mipLevel : 0.0f;
+        kernels = address.msaa ? drawTriangleRectMsaaTrilinear : drawTriangleRectTrilinear;
+        kernels[mode](&r, texture, normalMap);
+      } break;
+      default:
+        assert(!"unknown texture filter");
+    }
+  }
+  stats->pixelsTested += r.numTested;
+  stats->depthWrites += r.numWritten;
+  if (!deferredShading) stats->pixelsCovered += r.numCovered;
+
+  // Raise the entries of blocks the triangle covers completely, as every
+  // pixel (or sample) in them now holds at least its depth. Only whole blocks
+  // inside the rect can be covered; a block is inside an edge if its worst
+  // corner (or sample) is, which is stepped from block to block.
+  int fullMinX = (r.minX + HIZ_BLOCK_SIZE-1) / HIZ_BLOCK_SIZE, fullMaxX = (r.maxX+1) / HIZ_BLOCK_SIZE - 1;
+  int fullMinY = (r.minY + HIZ_BLOCK_SIZE-1) / HIZ_BLOCK_SIZE, fullMaxY = (r.maxY+1) / HIZ_BLOCK_SIZE - 1;
+  if (fullMinX > fullMaxX || fullMinY > fullMaxY) return;
+  i64 rowE[3], blockStepX[3], blockStepY[3];
+  for (int i = 0; i < 3; ++i) {
+    i64 a = (i64)t->edgeA[i]*SUBPIXEL_ONE, b = (i64)t->edgeB[i]*SUBPIXEL_ONE;
+    i64 worstX = a < 0 ? a*(HIZ_BLOCK_SIZE-1) : 0;
+    i64 worstY = b < 0 ? b*(HIZ_BLOCK_SIZE-1) : 0;
+    i64 edgeMargin = ((i64)abs(t->edgeA[i]) + (i64)abs(t->edgeB[i]))*margin;
+    rowE[i] = a*fullMinX*HIZ_BLOCK_SIZE + b*fullMinY*HIZ_BLOCK_SIZE + t->edgeC[i] + worstX + worstY - edgeMargin;
+    blockStepX[i] = a*HIZ_BLOCK_SIZE;
+    blockStepY[i] = b*HIZ_BLOCK_SIZE;
+  }
+  for (int by = fullMinY; by <= fullMaxY; ++by) {
+    i64 e0 = rowE[0], e1 = rowE[1], e2 = rowE[2];
+    for (int bx = fullMinX; bx <= fullMaxX; ++bx) {
+      if ((e0 | e1 | e2) >= 0) {
+        int blockX = bx*HIZ_BLOCK_SIZE, blockY = by*HIZ_BLOCK_SIZE;
+        getRectDepthRange(t, blockX, blockY, blockX + HIZ_BLOCK_SIZE-1, blockY + HIZ_BLOCK_SIZE-1, margin, &zMin, &zMax);
+        float *blockZ = &hiZ[bx + by*hiZWidth];
+        if (zMin > *blockZ) *blockZ = zMin;
+      }
+      e0 += blockStepX[0];
+      e1 += blockStepX[1];
+      e2 += blockStepX[2];
+    }
+    rowE[0] += blockStepY[0];
+    rowE[1] += blockStepY[1];
+    rowE[2] += blockStepY[2];
+  }
+}
+
+typedef struct {
+  int v[3];
+  int vt[3];
+  int vn[3];
+} Face;
+
+// SoA vertex streams are padded to a multiple of the widest SIMD kernel
+#define SOA_PADDING 16
+#define SOA_ALIGN 64
+
+u32 getSoACount(u32 count) {
+  return (count + SOA_PADDING-1) & ~(u32)(SOA_PADDING-1);
+}
+
+// Makes room for one more element in a malloc'd array, doubling it as needed.
+#define RESERVE_ONE(array, count, capacity) \
+  if ((count) == (capacity)) { \
+    (capacity) = (capacity) ? 2*(capacity) : 256; \
+    (array) = realloc((array), (capacity)*sizeof(*(array))); \
+  }
+
+// Bounding sphere plus a cone around every face normal. All the faces point
+// away from a viewer at p when
+//   dot(center - p, coneAxis) >= coneCutoff*length(center - p) + radius
+// and from an orthographic one looking along d when dot(d, coneAxis) >=
+// coneCutoff. coneCutoff is 1 when the normals spread too wide to cull.
+typedef struct {
+  Vec3 center;
+  float radius;
+  Vec3 coneAxis;
+  float coneCutoff;
+} Bounds;
+
+// Up to MESHLET_MAX_FACES neighbouring faces. Their vertex indices all lie in
+// [firstVertex, vertexEnd).
+typedef struct {
+  Bounds bounds;
+  u32 firstFace;
+  u32 numFaces;
+  u32 firstVertex;
+  u32 vertexEnd;
+} Meshlet;
+
+// Triangle mesh streams. readObjFile mallocs them; readMeshFile points them
+// straight into the mapped file (mappedFile.contents != NULL then).
+typedef struct Mesh {
+  Vec3 *positions;
+  // the positions again as x, y and z planes of getSoACount(numPositions)
+  // zero padded floats each, SOA_ALIGN aligned
+  float *positionsSoA;
+  Vec3 *texCoords;
+  Vec3 *normals;
+  Face *faces;
+  u32 numPositions;
+  u32 numTexCoords;
+  u32 numNormals;
+  u32 numFaces;
+  Meshlet *meshlets;
+  u32 numMeshlets;
+  Bounds bounds;
+  // LOD chain from buildLodChain, lods[0] is the mesh itself. The levels have
+  // no LODs of their own and share its texcoords and normals; lodError bounds
+  // how far the full mesh's vertices are from a level's surface, in object
+  // space.
+  int numLods;
+  struct Mesh *lods;
+  float lodError;
+  PlatformFile mappedFile;
+} Mesh;
+
+void buildPositionsSoA(Mesh *mesh) {
+  u32 count = getSoACount(mesh->numPositions);
+  mesh->positionsSoA = allocAligned(3*count*sizeof(float), SOA_ALIGN);
+  memset(mesh->positionsSoA, 0, 3*count*sizeof(float));
+  for (u32 i = 0; i < mesh->numPositions; ++i) {
+    mesh->positionsSoA[i] = mesh->positions[i].x;
+    mesh->positionsSoA[count + i] = mesh->positions[i].y;
+    mesh->positionsSoA[2*count + i] = mesh->positions[i].z;
+  }
+}
+
+//
+// Meshlets: faces are grouped into patches of up to MESHLET_MAX_FACES
+// neighbours, each with a bounding sphere and a normal cone, so whole patches
+// can be rejected before their vertices are transformed. Building them
+// reorders the faces patch by patch and the positions in order of first use,
+// which keeps each patch's vertices in a short index range.
+//
+
+#define MESHLET_MAX_FACES 64
+
+// Computes the sphere and cone of faces [firstFace, firstFace+numFaces).
+Bounds computeBounds(Mesh *mesh, u32 firstFace, u32 numFaces) {
+  Bounds bounds = {0};
+  Vec3 minP = makeVec3(FLT_MAX, FLT_MAX, FLT_MAX);
+  Vec3 maxP = makeVec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  Vec3 normalSum = makeVec3(0, 0, 0);
+  for (u32 i = firstFace; i < firstFace + numFaces; ++i) {
+    Face *f = &mesh->faces[i];
+    Vec3 p[3];
+    for (int j = 0; j < 3; ++j) {
+      p[j] = mesh->positions[f->v[j]];
+      minP = makeVec3(fminf(minP.x, p[j].x), fminf(minP.y, p[j].y), fminf(minP.z, p[j].z));
+      maxP = makeVec3(fmaxf(maxP.x, p[j].x), fmaxf(maxP.y, p[j].y), fmaxf(maxP.z, p[j].z));
+    }
+    Vec3 n = crossVec3(subVec3(p[1], p[0]), subVec3(p[2], p[0]));
+    float length = lengthVec3(n);
+    if (length > 0) normalSum = addVec3(normalSum, scaleVec3(n, 1.0f/length));
+  }
+  if (!numFaces) return bounds;
+
+  bounds.center = scaleVec3(addVec3(minP, maxP), 0.5f);
+  for (u32 i = firstFace; i < firstFace + numFaces; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      float distance = lengthVec3(subVec3(mesh->positions[mesh->faces[i].v[j]], bounds.center));
+      if (distance > bounds.radius) bounds.radius = distance;
+    }
+  }
+
+  // the cone's half angle is acos(minDot); past ~84 degrees it can't cull
+  bounds.coneCutoff = 1.0f;
+  float sumLength = lengthVec3(normalSum);
+  if (sumLength > 0) {
+    bounds.coneAxis = scaleVec3(normalSum, 1.0f/sumLength);
+    float minDot = 1.0f;
+    for (u32 i = firstFace; i < firstFace + numFaces; ++i) {
+      Face *f = &mesh->faces[i];
+      Vec3 p0 = mesh->positions[f->v[0]];
+      Vec3 n = crossVec3(subVec3(mesh->positions[f->v[1]], p0), subVec3(mesh->positions[f->v[2]], p0));
+      float length = lengthVec3(n);
+      if (length > 0) minDot = fminf(minDot, dotVec3(n, bounds.coneAxis)/length);
+    }
+    if (minDot > 0.1f) bounds.coneCutoff = sqrtf(1.0f - minDot*minDot);
+  }
+  return bounds;
+}
+
+// Lists the faces around each vertex: those of vertex v are
+// vertexFaces[vertexFaceStart[v]] up to vertexFaces[vertexFaceStart[v+1]], once
+// per corner. vertexFaceStart needs numPositions+1 entries and vertexFaces
+// 3*numFaces.
+void getVertexFaces(Face *faces, u32 numFaces, u32 numPositions, u32 *vertexFaceStart, u32 *vertexFaces) {
+  memset(vertexFaceStart, 0, (numPositions + 1)*sizeof(u32));
+  for (u32 i = 0; i < numFaces; ++i) {
+    for (int j = 0; j < 3; ++j) ++vertexFaceStart[faces[i].v[j] + 1];
+  }
+  for (u32 i = 0; i < numPositions; ++i) vertexFaceStart[i+1] += vertexFaceStart[i];
+  for (u32 i = 0; i < numFaces; ++i) {
+    for (int j = 0; j < 3; ++j) vertexFaces[vertexFaceStart[faces[i].v[j]]++] = i;
+  }
+  // the fill moved every start to the next one's
+  memmove(vertexFaceStart + 1, vertexFaceStart, numPositions*sizeof(u32));
+  vertexFaceStart[0] = 0;
+}
+
+void buildMeshlets(Mesh *mesh) {
+  assert(!mesh->mappedFile.contents);
+  u32 numFaces = mesh->numFaces;
+  u32 numPositions = mesh->numPositions;
+
+  // faces around each vertex
+  u32 *vertexFaceStart = malloc((numPositions + 1)*sizeof(u32));
+  u32 *vertexFaces = malloc((3*numFaces + 1)*sizeof(u32));
+  getVertexFaces(mesh->faces, numFaces, numPositions, vertexFaceStart, vertexFaces);
+
+  // grow each meshlet breadth first from the first face nobody has taken
+  u32 *order = malloc((numFaces + 1)*sizeof(u32));
+  bool *taken = calloc(numFaces + 1, sizeof(bool));
+  u32 maxMeshlets = 256;
+  mesh->meshlets = malloc(maxMeshlets*sizeof(*mesh->meshlets));
+  mesh->numMeshlets = 0;
+  u32 numOrdered = 0;
+  for (u32 seed = 0; seed < numFaces; ++seed) {
+    if (taken[seed]) continue;
+    u32 start = numOrdered;
+    order[numOrdered++] = seed;
+    taken[seed] = true;
+    for (u32 q = start; q < numOrdered && numOrdered - start < MESHLET_MAX_FACES; ++q) {
+      Face *f = &mesh->faces[order[q]];
+      for (int j = 0; j < 3; ++j) {
+        for (u32 k = vertexFaceStart[f->v[j]]; k < vertexFaceStart[f->v[j] + 1]; ++k) {
+          u32 neighbour = vertexFaces[k];
+          if (!taken[neighbour] && numOrdered - start < MESHLET_MAX_FACES) {
+            taken[neighbour] = true;
+            order[numOrdered++] = neighbour;
+          }
+        }
+      }
+    }
+    RESERVE_ONE(mesh->meshlets, mesh->numMeshlets, maxMeshlets);
+    Meshlet *meshlet = &mesh->meshlets[mesh->numMeshlets++];
+    meshlet->firstFace = start;
+    meshlet->numFaces = numOrdered - start;
+  }
+
+  // faces in meshlet order, positions in order of first use
+  Face *faces = malloc((numFaces + 1)*sizeof(*faces));
+  u32 *newIndex = malloc((numPositions + 1)*sizeof(u32));
+  memset(newIndex, 0xFF, (numPositions + 1)*sizeof(u32));
+  u32 numUsed = 0;
+  for (u32 i = 0; i < numFaces; ++i) {
+    faces[i] = mesh->faces[order[i]];
+    for (int j = 0; j < 3; ++j) {
+      u32 *index = &newIndex[faces[i].v[j]];
+      if (*index == UINT32_MAX) *index = numUsed++;
+      faces[i].v[j] = *index;
+    }
+  }
+  Vec3 *positions = malloc((numPositions + 1)*sizeof(*positions));
+  for (u32 i = 0; i < numPositions; ++i) {
+    if (newIndex[i] == UINT32_MAX) newIndex[i] = numUsed++;
+    positions[newIndex[i]] = mesh->positions[i];
+  }
+  free(mesh->faces);
+  free(mesh->positions);
+  mesh->faces = faces;
+  mesh->positions = positions;
+
+  for (u32 i = 0; i < mesh->numMeshlets; ++i) {
+    Meshlet *meshlet = &mesh->meshlets[i];
+    meshlet->bounds = computeBounds(mesh, meshlet->firstFace, meshlet->numFaces);
+    meshlet->firstVertex = UINT32_MAX;
+    meshlet->vertexEnd = 0;
+    for (u32 j = meshlet->firstFace; j < meshlet->firstFace + meshlet->numFaces; ++j) {
+      for (int k = 0; k < 3; ++k) {
+        u32 v = mesh->faces[j].v[k];
+        if (v < meshlet->firstVertex) meshlet->firstVertex = v;
+        if (v + 1 > meshlet->vertexEnd) meshlet->vertexEnd = v + 1;
+      }
+    }
+  }
+  mesh->bounds = computeBounds(mesh, 0, numFaces);
+
+  free(vertexFaceStart);
+  free(vertexFaces);
+  free(order);
+  free(taken);
+  free(newIndex);
+}
+
+//
+// Levels of detail. buildLodChain simplifies a mesh by half edge collapses,
+// each merging a vertex into a neighbour, cheapest first by the quadric error
+// metric: every vertex sums the planes of its faces, and the cost of moving
+// it is the squared distance of the new position to its and its neighbour's
+// planes. Vertices on a UV or normal seam, an open border or a non-manifold
+// edge never move, so seams stay where they are and the texture doesn't
+// slide. Collapses run in passes over independent vertices, and whenever
+// the face count halves the faces so far become a level with meshlets of
+// its own. A level's error is measured on the result rather than taken from
+// the quadrics, which only rank the collapses.
+//
+
+#define MESH_MAX_LODS 8
+#define LOD_MIN_FACES 64
+// vertices with more faces than this stay put
+#define SIMPLIFY_MAX_VALENCE 64
+
+// Weighted sum of the planes dot(n, p) + d = 0 as a symmetric 4x4 matrix,
+// upper triangle row by row, and the sum of the weights.
+typedef struct {
+  double q[10];
+  double weight;
+} Quadric;
+
+void addPlaneToQuadric(Quadric *quadric, Vec3 n, float d, double weight) {
+  double a = n.x, b = n.y, c = n.z;
+  double *q = quadric->q;
+  q[0] += weight*a*a; q[1] += weight*a*b; q[2] += weight*a*c; q[3] += weight*a*d;
+  q[4] += weight*b*b; q[5] += weight*b*c; q[6] += weight*b*d;
+  q[7] += weight*c*c; q[8] += weight*c*d;
+  q[9] += weight*d*d;
+  quadric->weight += weight;
+}
+
+void addQuadric(Quadric *a, Quadric *b) {
+  for (int i = 0; i < 10; ++i) a->q[i] += b->q[i];
+  a->weight += b->weight;
+}
+
+// The root mean square distance of p to the planes, which orders collapses.
+float getQuadricError(Quadric *quadric, Vec3 p) {
+  double x = p.x, y = p.y, z = p.z;
+  double *q = quadric->q;
+  double sum = q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+             + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+             + q[7]*z*z + 2*q[8]*z
+             + q[9];
+  return quadric->weight > 0 && sum > 0 ? (float)sqrt(sum/quadric->weight) : 0.0f;
+}
+
+typedef struct {
+  float error;
+  u32 vertex;
+  u32 target;
+} EdgeCollapse;
+
+int compareEdgeCollapses(const void *a, const void *b) {
+  const EdgeCollapse *x = a, *y = b;
+  if (x->error != y->error) return x->error < y->error ? -1 : 1;
+  return x->vertex < y->vertex ? -1 : x->vertex > y->vertex;
+}
+
+// Whether v has to stay put: it's on a UV or normal seam, an open border or a
+// non-manifold edge, in a degenerate face, or has too many faces.
+bool isVertexLocked(Face *faces, u32 *vertexFaceStart, u32 *vertexFaces, u32 v) {
+  u32 start = vertexFaceStart[v], end = vertexFaceStart[v+1];
+  if (end - start > SIMPLIFY_MAX_VALENCE) return true;
+  int others[2*SIMPLIFY_MAX_VALENCE];
+  u32 numOthers = 0;
+  int vt = -1, vn = -1;
+  for (u32 i = start; i < end; ++i) {
+    Face *f = &faces[vertexFaces[i]];
+    if (f->v[0] == f->v[1] || f->v[1] == f->v[2] || f->v[2] == f->v[0]) return true;
+    int j = f->v[0] == (int)v ? 0 : f->v[1] == (int)v ? 1 : 2;
+    if (i > start && (f->vt[j] != vt || f->vn[j] != vn)) return true;
+    vt = f->vt[j];
+    vn = f->vn[j];
+    others[numOthers++] = f->v[(j+1) % 3];
+    others[numOthers++] = f->v[(j+2) % 3];
+  }
+  // every edge out of v has to be in exactly two faces
+  for (u32 i = 0; i < numOthers; ++i) {
+    int count = 0;
+    for (u32 j = 0; j < numOthers; ++j) count += others[j] == others[i];
+    if (count != 2) return true;
+  }
+  return false;
+}
+
+// Merges vertex a into its neighbour b unless that would fold a face over or
+// pinch the surface. Returns the number of faces removed; they get v[0] = -1.
+u32 collapseEdge(Face *faces, Vec3 *positions, Vec3 *normals, u32 *vertexFaceStart, u32 *vertexFaces, u32 a, u32 b) {
+  // b's texcoord and normal in the faces along the edge, which a's other
+  // faces take over
+  int vt = -1, vn = -1;
+  u32 numShared = 0;
+  int neighbours[2*SIMPLIFY_MAX_VALENCE];
+  u32 numNeighbours = 0;
+  for (u32 i = vertexFaceStart[a]; i < vertexFaceStart[a+1]; ++i) {
+    Face *f = &faces[vertexFaces[i]];
+    for (int j = 0; j < 3; ++j) {
+      int u = f->v[j];
+      if (u == (int)b) {
+        if (numShared++ && (f->vt[j] != vt || f->vn[j] != vn)) return 0;
+        vt = f->vt[j];
+        vn = f->vn[j];
+      }
+      if (u == (int)a || u == (int)b) continue;
+      u32 k = 0;
+      while (k < numNeighbours && neighbours[k] != u) ++k;
+      if (k == numNeighbours) neighbours[numNeighbours++] = u;
+    }
+  }
+  if (!numShared) return 0;
+
+  // a and b may only share the vertices opposite their edge
+  u32 numCommon = 0;
+  for (u32 k = 0; k < numNeighbours; ++k) {
+    for (u32 i = vertexFaceStart[b]; i < vertexFaceStart[b+1]; ++i) {
+      Face *f = &faces[vertexFaces[i]];
+      if (f->v[0] == neighbours[k] || f->v[1] == neighbours[k] || f->v[2] == neighbours[k]) {
+        ++numCommon;
+        break;
+      }
+    }
+  }
+  if (numCommon != numShared) return 0;
+
+  // the faces that stay mustn't turn by more than ~75 degrees, and once
+  // they're that far from their corners' normals mustn't turn further away,
+  // which the turns of successive collapses could otherwise add up to
+  for (u32 i = vertexFaceStart[a]; i < vertexFaceStart[a+1]; ++i) {
+    Face *f = &faces[vertexFaces[i]];
+    if (f->v[0] == (int)b || f->v[1] == (int)b || f->v[2] == (int)b) continue;
+    Vec3 p[3];
+    Vec3 oldShading = makeVec3(0, 0, 0), newShading = makeVec3(0, 0, 0);
+    for (int j = 0; j < 3; ++j) {
+      p[j] = positions[f->v[j]];
+      int corner = f->v[j] == (int)a ? vn : f->vn[j];
+      if (f->vn[j] >= 0) oldShading = addVec3(oldShading, normals[f->vn[j]]);
+      if (corner >= 0) newShading = addVec3(newShading, normals[corner]);
+    }
+    Vec3 oldNormal = crossVec3(subVec3(p[1], p[0]), subVec3(p[2], p[0]));
+    for (int j = 0; j < 3; ++j) {
+      if (f->v[j] == (int)a) p[j] = positions[b];
+    }
+    Vec3 newNormal = crossVec3(subVec3(p[1], p[0]), subVec3(p[2], p[0]));
+    if (dotVec3(oldNormal, newNormal) <= 0.25f*lengthVec3(oldNormal)*lengthVec3(newNormal)) return 0;
+    float oldFacing = dotVec3(oldNormal, oldShading), newFacing = dotVec3(newNormal, newShading);
+    float oldLength = lengthVec3(oldNormal)*lengthVec3(oldShading), newLength = lengthVec3(newNormal)*lengthVec3(newShading);
+    if (newFacing <= 0.25f*newLength && newFacing*oldLength < oldFacing*newLength) return 0;
+  }
+
+  for (u32 i = vertexFaceStart[a]; i < vertexFaceStart[a+1]; ++i) {
+    Face *f = &faces[vertexFaces[i]];
+    if (f->v[0] == (int)b || f->v[1] == (int)b || f->v[2] == (int)b) {
+      f->v[0] = -1;
+      continue;
+    }
+    for (int j = 0; j < 3; ++j) {
+      if (f->v[j] == (int)a) {
+        f->v[j] = b;
+        f->vt[j] = vt;
+        f->vn[j] = vn;
+      }
+    }
+  }
+  return numShared;
+}
+
+// Distance from p to the triangle abc.
+float getPointTriangleDistance(Vec3 p, Vec3 a, Vec3 b, Vec3 c) {
+  Vec3 ab = subVec3(b, a), ac = subVec3(c, a), ap = subVec3(p, a);
+  float d1 = dotVec3(ab, ap), d2 = dotVec3(ac, ap);
+  if (d1 <= 0 && d2 <= 0) return lengthVec3(ap);
+  Vec3 bp = subVec3(p, b);
+  float d3 = dotVec3(ab, bp), d4 = dotVec3(ac, bp);
+  if (d3 >= 0 && d4 <= d3) return lengthVec3(bp);
+  Vec3 cp = subVec3(p, c);
+  float d5 = dotVec3(ab, cp), d6 = dotVec3(ac, cp);
+  if (d6 >= 0 && d5 <= d6) return lengthVec3(cp);
+
+  // closest to an edge, or else inside
+  Vec3 closest;
+  float vc = d1*d4 - d3*d2, vb = d5*d2 - d1*d6, va = d3*d6 - d5*d4;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    closest = addVec3(a, scaleVec3(ab, d1/(d1 - d3)));
+  } else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    closest = addVec3(a, scaleVec3(ac, d2/(d2 - d6)));
+  } else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+    closest = addVec3(b, scaleVec3(subVec3(c, b), (d4 - d3)/((d4 - d3) + (d5 - d6))));
+  } else {
+    float sum = va + vb + vc;
+    if (sum == 0) return lengthVec3(ap);
+    closest = addVec3(a, addVec3(scaleVec3(ab, vb/sum), scaleVec3(ac, vc/sum)));
+  }
+  return lengthVec3(subVec3(p, closest));
+}
+
+// The largest distance from a vertex of the full mesh to the faces around
+// the vertex it was merged into (mergedInto[v] == v for those still there),
+// which bounds its distance from the simplified surface. Updates mergedInto
+// to point straight at the vertices that are left.
+float getLodDeviation(Vec3 *positions, u32 numPositions, Face *faces, u32 *vertexFaceStart, u32 *vertexFaces, u32 *mergedInto) {
+  float deviation = 0;
+  for (u32 v = 0; v < numPositions; ++v) {
+    u32 target = mergedInto[v];
+    while (mergedInto[target] != target) target = mergedInto[target];
+    mergedInto[v] = target;
+    if (target == v || vertexFaceStart[target] == vertexFaceStart[target+1]) continue;
+    float distance = FLT_MAX;
+    for (u32 i = vertexFaceStart[target]; i < vertexFaceStart[target+1]; ++i) {
+      Face *f = &faces[vertexFaces[i]];
+      float d = getPointTriangleDistance(positions[v], positions[f->v[0]], positions[f->v[1]], positions[f->v[2]]);
+      if (d < distance) distance = d;
+    }
+    if (distance > deviation) deviation = distance;
+  }
+  return deviation;
+}
+
+// A mesh of faces over source's texcoords and normals, with a copy of just
+// the positions they use.
+Mesh makeLodMesh(Mesh *source, Face *faces, u32 numFaces, float error) {
+  Mesh lod = {0};
+  u32 *newIndex = malloc((source->numPositions + 1)*sizeof(u32));
+  memset(newIndex, 0xFF, (source->numPositions + 1)*sizeof(u32));
+  lod.positions = malloc(source->numPositions*sizeof(*lod.positions) + 1);
+  lod.faces = malloc(numFaces*sizeof(*lod.faces) + 1);
+  for (u32 i = 0; i < numFaces; ++i) {
+    Face *f = &lod.faces[i];
+    *f = faces[i];
+    for (int j = 0; j < 3; ++j) {
+      u32 *index = &newIndex[f->v[j]];
+      if (*index == UINT32_MAX) {
+        *index = lod.numPositions++;
+        lod.positions[*index] = source->positions[f->v[j]];
+      }
+      f->v[j] = *index;
+    }
+  }
+  lod.numFaces = numFaces;
+  lod.numTexCoords = source->numTexCoords;
+  lod.texCoords = source->texCoords;
+  lod.numNormals = source->numNormals;
+  lod.normals = source->normals;
+  lod.lodError = error;
+  buildMeshlets(&lod);
+  buildPositionsSoA(&lod);
+  free(newIndex);
+  return lod;
+}
+
+// Builds the mesh's LOD chain, each level with about half the faces of the
+// one before, down to LOD_MIN_FACES or until nothing more can be collapsed.
+void buildLodChain(Mesh *mesh) {
+  assert(!mesh->lods);
+  f64 startTime = platformGetSeconds();
+  u32 numPositions = mesh->numPositions;
+  u32 numFaces = mesh->numFaces;
+  Vec3 *positions = mesh->positions;
+  Face *faces = malloc((numFaces + 1)*sizeof(*faces));
+  memcpy(faces, mesh->faces, numFaces*sizeof(*faces));
+
+  // area weighted face planes
+  Quadric *quadrics = calloc(numPositions + 1, sizeof(*quadrics));
+  for (u32 i = 0; i < numFaces; ++i) {
+    Face *f = &faces[i];
+    Vec3 p0 = positions[f->v[0]];
+    Vec3 n = crossVec3(subVec3(positions[f->v[1]], p0), subVec3(positions[f->v[2]], p0));
+    float length = lengthVec3(n);
+    if (length == 0) continue;
+    n = scaleVec3(n, 1.0f/length);
+    for (int j = 0; j < 3; ++j) addPlaneToQuadric(&quadrics[f->v[j]], n, -dotVec3(n, p0), 0.5*length);
+  }
+
+  u32 *vertexFaceStart = malloc((numPositions + 1)*sizeof(u32));
+  u32 *vertexFaces = malloc((3*numFaces + 1)*sizeof(u32));
+  bool *touched = malloc(numPositions + 1);
+  EdgeCollapse *collapses = malloc((numPositions + 1)*sizeof(*collapses));
+  u32 *mergedInto = malloc((numPositions + 1)*sizeof(u32));
+  for (u32 i = 0; i < numPositions; ++i) mergedInto[i] = i;
+
+  mesh->lods = malloc(MESH_MAX_LODS*sizeof(*mesh->lods));
+  mesh->lods[0] = *mesh;
+  mesh->lods[0].lods = NULL;
+  mesh->numLods = 1;
+  mesh->lodError = 0;
+  u32 levelFaces = numFaces;
+  float error = 0;
+  while (mesh->numLods < MESH_MAX_LODS && levelFaces/2 >= LOD_MIN_FACES) {
+    u32 targetFaces = levelFaces/2;
+    getVertexFaces(faces, numFaces, numPositions, vertexFaceStart, vertexFaces);
+
+    // every free vertex's cheapest neighbour to merge into
+    u32 numCollapses = 0;
+    for (u32 a = 0; a < numPositions; ++a) {
+      touched[a] = false;
+      if (vertexFaceStart[a] == vertexFaceStart[a+1]) continue;
+      if (isVertexLocked(faces, vertexFaceStart, vertexFaces, a)) continue;
+      EdgeCollapse best = {FLT_MAX, a, a};
+      for (u32 i = vertexFaceStart[a]; i < vertexFaceStart[a+1]; ++i) {
+        Face *f = &faces[vertexFaces[i]];
+        for (int j = 0; j < 3; ++j) {
+          u32 b = f->v[j];
+          if (b == a) continue;
+          Quadric sum = quadrics[a];
+          addQuadric(&sum, &quadrics[b]);
+          float collapseError = getQuadricError(&sum, positions[b]);
+          if (collapseError < best.error) {
+            best.error = collapseError;
+            best.target = b;
+          }
+        }
+      }
+      if (best.target != a) collapses[numCollapses++] = best;
+    }
+    qsort(collapses, numCollapses, sizeof(*collapses), compareEdgeCollapses);
+
+    // a collapse changes the faces around a and its neighbours, whose lists
+    // are stale until the next pass
+    u32 numRemoved = 0;
+    for (u32 i = 0; i < numCollapses && numFaces - numRemoved > targetFaces; ++i) {
+      u32 a = collapses[i].vertex, b = collapses[i].target;
+      if (touched[a] || touched[b]) continue;
+      u32 removed = collapseEdge(faces, positions, mesh->normals, vertexFaceStart, vertexFaces, a, b);
+      if (!removed) continue;
+      numRemoved += removed;
+      addQuadric(&quadrics[b], &quadrics[a]);
+      mergedInto[a] = b;
+      for (u32 k = vertexFaceStart[a]; k < vertexFaceStart[a+1]; ++k) {
+        Face *f = &faces[vertexFaces[k]];
+        if (f->v[0] < 0) continue;
+        for (int j = 0; j < 3; ++j) touched[f->v[j]] = true;
+      }
+      touched[a] = touched[b] = true;
+    }
+
+    u32 numLive = 0;
+    for (u32 i = 0; i < numFaces; ++i) {
+      if (faces[i].v[0] >= 0) faces[numLive++] = faces[i];
+    }
+    numFaces = numLive;
+
+    // stuck: keep what there is if it's still well short of the last level
+    bool done = !numRemoved;
+    if (numFaces <= targetFaces || (done && numFaces <= levelFaces*3/4)) {
+      // coarser levels never claim to be closer than finer ones
+      getVertexFaces(faces, numFaces, numPositions, vertexFaceStart, vertexFaces);
+      float deviation = getLodDeviation(positions, numPositions, faces, vertexFaceStart, vertexFaces, mergedInto);
+      if (deviation > error) error = deviation;
+      mesh->lods[mesh->numLods++] = makeLodMesh(mesh, faces, numFaces, error);
+      levelFaces = numFaces;
+    }
+    if (done) break;
+  }
+
+  free(faces);
+  free(quadrics);
+  free(vertexFaceStart);
+  free(vertexFaces);
+  free(touched);
+  free(collapses);
+  free(mergedInto);
+
+  f64 buildTime = platformGetSeconds() - startTime;
+  debugPrint("LOD chain of %d levels down to %u faces in %.2f ms\n", mesh->numLods,
+             mesh->lods[mesh->numLods-1].numFaces, buildTime*1000.0);
+}
+
+//
+// OBJ loading. The file is mapped and cut into chunks at line boundaries.
+// Workers parse the chunks into their own growable arrays, then each chunk
+// is copied into the mesh behind the ones before it, which is when relative
+// (negative) indices and missing texcoord/normal indices get resolved.
+// Polygons are fan triangulated, so they're expected to be convex.
+//
+
+#define OBJ_CHUNK_SIZE (4 << 20)
+#define OBJ_MISSING_INDEX INT32_MIN
+
+typedef struct {
+  char *start;
+  char *end;
+
+  Vec3 *positions;
+  Vec3 *texCoords;
+  Vec3 *normals;
+  Face *faces;
+  u32 numPositions, maxPositions;
+  u32 numTexCoords, maxTexCoords;
+  u32 numNormals, maxNormals;
+  u32 numFaces, maxFaces;
+  // face*9 + slot (Face viewed as int[9]) of indices relative to this chunk
+  u32 *relativeSlots;
+  u32 numRelativeSlots, maxRelativeSlots;
+  bool hasMissingTexCoords;
+  bool hasMissingNormals;
+  // the first line that didn't parse, and whether merging found a face
+  // index out of range
+  char *badLine;
+  bool hasBadIndex;
+
+  // where this chunk's elements start in the mesh
+  u32 firstPosition;
+  u32 firstTexCoord;
+  u32 firstNormal;
+  u32 firstFace;
+} ObjChunk;
+
+typedef struct {
+  ObjChunk *chunks;
+  int numChunks;
+  volatile i32 nextChunk;
+  Mesh *mesh;
+  int defaultTexCoord;
+  int defaultNormal;
+} ObjParseJob;
+
+double powersOf10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+char *skipObjSpaces(char *p, char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+  return p;
+}
+
+// Parses a decimal float the way strtof does, but stops at end and ignores
+// the locale. Returns the position after the number, or NULL if there's none.
+char *parseObjFloat(char *p, char *end, float *result) {
+  char *start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *(p++) == '-';
+
+  u64 mantissa = 0;
+  int numDigits = 0;
+  int exponent = 0;
+  bool hasDigits = false;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    hasDigits = true;
+    if (numDigits < 19) {
+      mantissa = mantissa*10 + (*p - '0');
+      if (mantissa) ++numDigits;
+    } else {
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+      hasDigits = true;
+      if (numDigits < 19) {
+        mantissa = mantissa*10 + (*p - '0');
+        if (mantissa) ++numDigits;
+        --exponent;
+      }
+    }
+  }
+  if (!hasDigits) return NULL;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    char *e = p + 1;
+    bool negativeExponent = false;
+    if (e < end && (*e == '-' || *e == '+')) negativeExponent = *(e++) == '-';
+    if (e < end && *e >= '0' && *e <= '9') {
+      int value = 0;
+      for (; e < end && *e >= '0' && *e <= '9'; ++e) {
+        if (value < 10000) value = value*10 + (*e - '0');
+      }
+      exponent += negativeExponent ? -value : value;
+      p = e;
+    }
+  }
+
+  double value;
+  if (mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+    // both operands are exact, so this rounds correctly
+    value = (double)mantissa;
+    value = exponent < 0 ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+  } else {
+    char buffer[64];
+    size_t length = p - start;
+    if (length >= sizeof(buffer)) length = sizeof(buffer)-1;
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    value = fabs(strtod(buffer, NULL));
+  }
+  *result = (float)(negative ? -value : value);
+  return p;
+}
+
+char *parseObjInt(char *p, char *end, int *result) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *(p++) == '-';
+  if (p == end || *p < '0' || *p > '9') return NULL;
+  i64 value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    if (value <= INT32_MAX) value = value*10 + (*p - '0');
+  }
+  if (value > INT32_MAX) return NULL;
+  *result = (int)(negative ? -value : value);
+  return p;
+}
+
+// Parses up to maxValues floats; returns how many there were.
+int parseObjFloats(char *p, char *end, float *values, int maxValues) {
+  int count = 0;
+  for (; count < maxValues; ++count) {
+    p = skipObjSpaces(p, end);
+    p = parseObjFloat(p, end, &values[count]);
+    if (!p) break;
+  }
+  return count;
+}
+
+// Turns a 1-based or negative OBJ index into a 0-based one. Negative ones
+// count back from the elements this chunk has seen so far and get recorded
+// so the merge can add the elements of the chunks before.
+int resolveObjIndex(ObjChunk *chunk, int index, u32 count, u32 slot) {
+  if (index == OBJ_MISSING_INDEX) return index;
+  // 0 is out of range either way, which merging catches
+  if (index >= 0) return index - 1;
+  RESERVE_ONE(chunk->relativeSlots, chunk->numRelativeSlots, chunk->maxRelativeSlots);
+  chunk->relativeSlots[chunk->numRelativeSlots++] = chunk->numFaces*9 + slot;
+  return (int)count + index;
+}
+
+// Stops at the first malformed line, leaving it in chunk->badLine.
+void parseObjChunk(ObjChunk *chunk) {
+  char *p = chunk->start;
+  char *end = chunk->end;
+  while (p < end) {
+    char *lineEnd = memchr(p, '\n', end - p);
+    if (!lineEnd) lineEnd = end;
+    char *lineStart = p;
+    p = skipObjSpaces(p, lineEnd);
+
+    if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+      float xyz[3];
+      if (parseObjFloats(p + 2, lineEnd, xyz, 3) != 3) {
+        chunk->badLine = lineStart;
+        return;
+      }
+      RESERVE_ONE(chunk->positions, chunk->numPositions, chunk->maxPositions);
+      chunk->positions[chunk->numPositions++] = makeVec3(xyz[0], xyz[1], xyz[2]);
+    }
+    else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+      float uvw[3] = {0, 0, 0};
+      if (parseObjFloats(p + 3, lineEnd, uvw, 3) < 1) {
+        chunk->badLine = lineStart;
+        return;
+      }
+      RESERVE_ONE(chunk->texCoords, chunk->numTexCoords, chunk->maxTexCoords);
+      chunk->texCoords[chunk->numTexCoords++] = makeVec3(uvw[0], uvw[1], uvw[2]);
+    }
+    else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+      float xyz[3];
+      if (parseObjFloats(p + 3, lineEnd, xyz, 3) != 3) {
+        chunk->badLine = lineStart;
+        return;
+      }
+      RESERVE_ONE(chunk->normals, chunk->numNormals, chunk->maxNormals);
+      chunk->normals[chunk->numNormals++] = makeVec3(xyz[0], xyz[1], xyz[2]);
+    }
+    else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+      // corners are v, v/vt, v//vn or v/vt/vn; a fan of triangles around the
+      // first one covers polygons
+      int corners[3][3];
+      int numCorners = 0;
+      char *q = p + 2;
+      for (;;) {
+        int *corner = corners[numCorners < 2 ? numCorners : 2];
+        q = skipObjSpaces(q, lineEnd);
+        q = parseObjInt(q, lineEnd, &corner[0]);
+        if (!q) break;
+        corner[1] = OBJ_MISSING_INDEX;
+        corner[2] = OBJ_MISSING_INDEX;
+        if (q < lineEnd && *q == '/') {
+          ++q;
+          if (q < lineEnd && *q != '/') q = parseObjInt(q, lineEnd, &corner[1]);
+          if (q && q < lineEnd && *q == '/') q = parseObjInt(q + 1, lineEnd, &corner[2]);
+          if (!q) {
+            chunk->badLine = lineStart;
+            return;
+          }
+        }
+        if (corner[1] == OBJ_MISSING_INDEX) chunk->hasMissingTexCoords = true;
+        if (corner[2] == OBJ_MISSING_INDEX) chunk->hasMissingNormals = true;
+
+        if (++numCorners >= 3) {
+          RESERVE_ONE(chunk->faces, chunk->numFaces, chunk->maxFaces);
+          Face *f = &chunk->faces[chunk->numFaces];
+          for (int j = 0; j < 3; ++j) {
+            f->v[j] = resolveObjIndex(chunk, corners[j][0], chunk->numPositions, 0 + j);
+            f->vt[j] = resolveObjIndex(chunk, corners[j][1], chunk->numTexCoords, 3 + j);
+            f->vn[j] = resolveObjIndex(chunk, corners[j][2], chunk->numNormals, 6 + j);
+          }
+          ++chunk->numFaces;
+          memcpy(corners[1], corners[2], sizeof(corners[1]));
+        }
+      }
+      if (numCorners < 3) {
+        chunk->badLine = lineStart;
+        return;
+      }
+    }
+
+    p = lineEnd + 1;
+  }
+}
+
+void parseObjChunksWork(void *data, int workerIndex) {
+  ObjParseJob *job = data;
+  for (;;) {
+    int index = platformAtomicIncrement(&job->nextChunk) - 1;
+    if (index >= job->numChunks) break;
+    parseObjChunk(&job->chunks[index]);
+  }
+}
+
+void freeObjChunk(ObjChunk *chunk) {
+  free(chunk->positions);
+  free(chunk->texCoords);
+  free(chunk->normals);
+  free(chunk->faces);
+  free(chunk->relativeSlots);
+}
+
+void mergeObjChunksWork(void *data, int workerIndex) {
+  ObjParseJob *job = data;
+  Mesh *mesh = job->mesh;
+  for (;;) {
+    int index = platformAtomicIncrement(&job->nextChunk) - 1;
+    if (index >= job->numChunks) break;
+    ObjChunk *chunk = &job->chunks[index];
+
+    memcpy(mesh->positions + chunk->firstPosition, chunk->positions, chunk->numPositions*sizeof(*chunk->positions));
+    memcpy(mesh->texCoords + chunk->firstTexCoord, chunk->texCoords, chunk->numTexCoords*sizeof(*chunk->texCoords));
+    memcpy(mesh->normals + chunk->firstNormal, chunk->normals, chunk->numNormals*sizeof(*chunk->normals));
+
+    Face *faces = mesh->faces + chunk->firstFace;
+    memcpy(faces, chunk->faces, chunk->numFaces*sizeof(*chunk->faces));
+    int firstIndices[3] = {(int)chunk->firstPosition, (int)chunk->firstTexCoord, (int)chunk->firstNormal};
+    for (u32 i = 0; i < chunk->numRelativeSlots; ++i) {
+      u32 slot = chunk->relativeSlots[i];
+      ((int *)&faces[slot/9])[slot%9] += firstIndices[(slot%9)/3];
+    }
+
+    for (u32 i = 0; i < chunk->numFaces; ++i) {
+      Face *f = &faces[i];
+      for (int j = 0; j < 3; ++j) {
+        if (f->vt[j] == OBJ_MISSING_INDEX) f->vt[j] = job->defaultTexCoord;
+        if (f->vn[j] == OBJ_MISSING_INDEX) f->vn[j] = job->defaultNormal;
+        if ((u32)f->v[j] >= mesh->numPositions || (u32)f->vt[j] >= mesh->numTexCoords || (u32)f->vn[j] >= mesh->numNormals) {
+          chunk->hasBadIndex = true;
+        }
+      }
+    }
+    freeObjChunk(chunk);
+  }
+}
+
+// Reports why filePath didn't load and returns the empty mesh the loaders fail
+// with.
+Mesh failMeshLoad(char *filePath, char *reason, PlatformFile file) {
+  debugPrint("%s: %s\n", filePath, reason);
+  if (file.contents) platformUnmapFile(file);
+  Mesh empty = {0};
+  return empty;
+}
+
+// Files that don't parse give a mesh with no faces.
+Mesh readObjFile(char *filePath) {
+  Mesh mesh = {0};
+  f64 startTime = platformGetSeconds();
+
+  PlatformFile file = platformMapFile(filePath);
+  if (!file.contents) return failMeshLoad(filePath, "can't open", file);
+  char *fileStart = file.contents;
+  char *fileEnd = fileStart + file.size;
+
+  ObjParseJob job = {0};
+  job.mesh = &mesh;
+  job.numChunks = file.size/OBJ_CHUNK_SIZE + 1;
+  job.chunks = calloc(job.numChunks, sizeof(*job.chunks));
+  for (int i = 0; i < job.numChunks; ++i) {
+    ObjChunk *chunk = &job.chunks[i];
+    chunk->start = i ? job.chunks[i-1].end : fileStart;
+    chunk->end = fileEnd;
+    if (i < job.numChunks-1) {
+      // end just after the first newline past the nominal split
+      char *split = fileStart + (u64)file.size*(i+1)/job.numChunks;
+      if (split < chunk->start) split = chunk->start;
+      char *newline = memchr(split, '\n', fileEnd - split);
+      if (newline) chunk->end = newline + 1;
+    }
+  }
+  job.nextChunk = 0;
+  platformRunOnWorkers(parseObjChunksWork, &job);
+  for (int i = 0; i < job.numChunks; ++i) {
+    char *line = job.chunks[i].badLine;
+    if (!line) continue;
+    char *lineEnd = memchr(line, '\n', fileEnd - line);
+    int length = (int)((lineEnd ? lineEnd : fileEnd) - line);
+    debugPrint("%s: can't parse \"%.*s\"\n", filePath, length < 80 ? length : 80, line);
+    for (int j = 0; j < job.numChunks; ++j) freeObjChunk(&job.chunks[j]);
+    free(job.chunks);
+    return failMeshLoad(filePath, "malformed OBJ", file);
+  }
+
+  bool hasMissingTexCoords = false;
+  bool hasMissingNormals = false;
+  for (int i = 0; i < job.numChunks; ++i) {
+    ObjChunk *chunk = &job.chunks[i];
+    chunk->firstPosition = mesh.numPositions;
+    chunk->firstTexCoord = mesh.numTexCoords;
+    chunk->firstNormal = mesh.numNormals;
+    chunk->firstFace = mesh.numFaces;
+    mesh.numPositions += chunk->numPositions;
+    mesh.numTexCoords += chunk->numTexCoords;
+    mesh.numNormals += chunk->numNormals;
+    mesh.numFaces += chunk->numFaces;
+    hasMissingTexCoords |= chunk->hasMissingTexCoords;
+    hasMissingNormals |= chunk->hasMissingNormals;
+  }
+  // corners without a texcoord or normal share one zero entry at the end
+  job.defaultTexCoord = mesh.numTexCoords;
+  job.defaultNormal = mesh.numNormals;
+  mesh.numTexCoords += hasMissingTexCoords;
+  mesh.numNormals += hasMissingNormals;
+
+  mesh.positions = malloc(mesh.numPositions*sizeof(*mesh.positions) + 1);
+  mesh.texCoords = malloc(mesh.numTexCoords*sizeof(*mesh.texCoords) + 1);
+  mesh.normals = malloc(mesh.numNormals*sizeof(*mesh.normals) + 1);
+  mesh.faces = malloc(mesh.numFaces*sizeof(*mesh.faces) + 1);
+  if (hasMissingTexCoords) mesh.texCoords[job.defaultTexCoord] = makeVec3(0, 0, 0);
+  if (hasMissingNormals) mesh.normals[job.defaultNormal] = makeVec3(0, 0, 0);
+
+  job.nextChunk = 0;
+  platformRunOnWorkers(mergeObjChunksWork, &job);
+  bool hasBadIndex = false;
+  for (int i = 0; i < job.numChunks; ++i) hasBadIndex |= job.chunks[i].hasBadIndex;
+  free(job.chunks);
+  if (hasBadIndex) {
+    free(mesh.positions);
+    free(mesh.texCoords);
+    free(mesh.normals);
+    free(mesh.faces);
+    return failMeshLoad(filePath, "face index out of range", file);
+  }
+  platformUnmapFile(file);
+  buildMeshlets(&mesh);
+  buildPositionsSoA(&mesh);
+
+  f64 parseTime = platformGetSeconds() - startTime;
+  debugPrint("%s: %u vertices, %u faces, %.1f MB parsed in %.2f ms (%.0f MB/s)\n", filePath, mesh.numPositions, mesh.numFaces,
+             file.size/1e6, parseTime*1000.0, file.size/1e6/parseTime);
+  return mesh;
+}
+
+//
+// Binary mesh file: a header followed by the raw streams, each starting at a
+// MESH_STREAM_ALIGN byte boundary so they can be used in place once mapped.
+// Little endian, in exactly the in-memory layout of Mesh's streams.
+//
+
+#define MESH_FILE_MAGIC 0x4853454D // "MESH"
+#define MESH_FILE_VERSION 3
+#define MESH_STREAM_ALIGN 64
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 numPositions;
+  u32 numTexCoords;
+  u32 numNormals;
+  u32 numFaces;
+  u32 numMeshlets;
+  Bounds bounds;
+  // byte offsets from the start of the file
+  u32 positionsOffset;
+  u32 positionsSoAOffset;
+  u32 texCoordsOffset;
+  u32 normalsOffset;
+  u32 facesOffset;
+  u32 meshletsOffset;
+} MeshFileHeader;
+
+// The stream at offset, or NULL if it's misaligned or runs past the file.
+void *getMeshStream(PlatformFile file, u32 offset, u32 count, u32 elementSize) {
+  if (offset % MESH_STREAM_ALIGN != 0) return NULL;
+  if (offset > file.size || (u64)count*elementSize > file.size - offset) return NULL;
+  return (u8 *)file.contents + offset;
+}
+
+// Maps a .mesh file and checks its streams and indices; files that don't
+// hold up give a mesh with no faces.
+Mesh readMeshFile(char *filePath) {
+  Mesh mesh = {0};
+  PlatformFile file = platformMapFile(filePath);
+  if (!file.contents) return failMeshLoad(filePath, "can't open", file);
+  if (file.size < sizeof(MeshFileHeader)) return failMeshLoad(filePath, "truncated header", file);
+
+  MeshFileHeader *header = file.contents;
+  if (header->magic != MESH_FILE_MAGIC) return failMeshLoad(filePath, "not a mesh file", file);
+  if (header->version != MESH_FILE_VERSION) return failMeshLoad(filePath, "unsupported version", file);
+  mesh.numPositions = header->numPositions;
+  mesh.numTexCoords = header->numTexCoords;
+  mesh.numNormals = header->numNormals;
+  mesh.numFaces = header->numFaces;
+  mesh.positions = getMeshStream(file, header->positionsOffset, mesh.numPositions, sizeof(*mesh.positions));
+  mesh.positionsSoA = getMeshStream(file, header->positionsSoAOffset, 3*getSoACount(mesh.numPositions), sizeof(float));
+  mesh.texCoords = getMeshStream(file, header->texCoordsOffset, mesh.numTexCoords, sizeof(*mesh.texCoords));
+  mesh.normals = getMeshStream(file, header->normalsOffset, mesh.numNormals, sizeof(*mesh.normals));
+  mesh.faces = getMeshStream(file, header->facesOffset, mesh.numFaces, sizeof(*mesh.faces));
+  mesh.numMeshlets = header->numMeshlets;
+  mesh.meshlets = getMeshStream(file, header->meshletsOffset, mesh.numMeshlets, sizeof(*mesh.meshlets));
+  mesh.bounds = header->bounds;
+  mesh.mappedFile = file;
+  if (!mesh.positions || !mesh.positionsSoA || !mesh.texCoords || !mesh.normals || !mesh.faces || !mesh.meshlets) {
+    return failMeshLoad(filePath, "stream out of bounds", file);
+  }
+
+  for (u32 i = 0; i < mesh.numFaces; ++i) {
+    Face *f = &mesh.faces[i];
+    for (int j = 0; j < 3; ++j) {
+      if ((u32)f->v[j] >= mesh.numPositions || (u32)f->vt[j] >= mesh.numTexCoords || (u32)f->vn[j] >= mesh.numNormals) {
+        return failMeshLoad(filePath, "face index out of range", file);
+      }
+    }
+  }
+  for (u32 i = 0; i < mesh.numMeshlets; ++i) {
+    Meshlet *meshlet = &mesh.meshlets[i];
+    if (meshlet->firstFace > mesh.numFaces || meshlet->numFaces > mesh.numFaces - meshlet->firstFace ||
+        meshlet->vertexEnd > mesh.numPositions) {
+      return failMeshLoad(filePath, "meshlet out of range", file);
+    }
+    for (u32 j = meshlet->firstFace; j < meshlet->firstFace + meshlet->numFaces; ++j) {
+      for (int k = 0; k < 3; ++k) {
+        if ((u32)mesh.faces[j].v[k] < meshlet->firstVertex || (u32)mesh.faces[j].v[k] >= meshlet->vertexEnd) {
+          return failMeshLoad(filePath, "meshlet vertex range doesn't cover its faces", file);
+        }
+      }
+    }
+  }
+  return mesh;
+}
+
+u32 alignMeshOffset(u32 offset) {
+  return (offset + MESH_STREAM_ALIGN-1) & ~(u32)(MESH_STREAM_ALIGN-1);
+}
+
+bool writeMeshFile(char *filePath, Mesh *mesh) {
+  MeshFileHeader header = {0};
+  header.magic = MESH_FILE_MAGIC;
+  header.version = MESH_FILE_VERSION;
+  header.numPositions = mesh->numPositions;
+  header.numTexCoords = mesh->numTexCoords;
+  header.numNormals = mesh->numNormals;
+  header.numFaces = mesh->numFaces;
+  header.positionsOffset = alignMeshOffset(sizeof(header));
+  header.positionsSoAOffset = alignMeshOffset(header.positionsOffset + mesh->numPositions*sizeof(*mesh->positions));
+  header.texCoordsOffset = alignMeshOffset(header.positionsSoAOffset + 3*getSoACount(mesh->numPositions)*sizeof(float));
+  header.normalsOffset = alignMeshOffset(header.texCoordsOffset + mesh->numTexCoords*sizeof(*mesh->texCoords));
+  header.facesOffset = alignMeshOffset(header.normalsOffset + mesh->numNormals*sizeof(*mesh->normals));
+  header.numMeshlets = mesh->numMeshlets;
+  header.bounds = mesh->bounds;
+  header.meshletsOffset = alignMeshOffset(header.facesOffset + mesh->numFaces*sizeof(*mesh->faces));
+  u32 size = header.meshletsOffset + mesh->numMeshlets*sizeof(*mesh->meshlets);
+
+  u8 *contents = calloc(size, 1);
+  memcpy(contents, &header, sizeof(header));
+  memcpy(contents + header.positionsOffset, mesh->positions, mesh->numPositions*sizeof(*mesh->positions));
+  memcpy(contents + header.positionsSoAOffset, mesh->positionsSoA, 3*getSoACount(mesh->numPositions)*sizeof(float));
+  memcpy(contents + header.texCoordsOffset, mesh->texCoords, mesh->numTexCoords*sizeof(*mesh->texCoords));
+  memcpy(contents + header.normalsOffset, mesh->normals, mesh->numNormals*sizeof(*mesh->normals));
+  memcpy(contents + header.facesOffset, mesh->faces, mesh->numFaces*sizeof(*mesh->faces));
+  memcpy(contents + header.meshletsOffset, mesh->meshlets, mesh->numMeshlets*sizeof(*mesh->meshlets));
+  bool success = platformWriteEntireFile(filePath, contents, size);
+  free(contents);
+  return success;
+}
+
+// Loads .mesh files with readMeshFile and anything else as OBJ. The mesh has
+// no faces if the file couldn't be read.
+Mesh readMesh(char *filePath) {
+  size_t length = strlen(filePath);
+  if (length >= 5 && !strcmp(filePath + length - 5, ".mesh")) {
+    return readMeshFile(filePath);
+  }
+  return readObjFile(filePath);
+}
+
+void freeMesh(Mesh *mesh) {
+  for (int i = 1; i < mesh->numLods; ++i) {
+    // the texcoords and normals are the mesh's
+    Mesh *lod = &mesh->lods[i];
+    free(lod->positions);
+    freeAligned(lod->positionsSoA);
+    free(lod->faces);
+    free(lod->meshlets);
+  }
+  free(mesh->lods);
+  if (mesh->mappedFile.contents) {
+    platformUnmapFile(mesh->mappedFile);
+  } else {
+    free(mesh->positions);
+    freeAligned(mesh->positionsSoA);
+    free(mesh->texCoords);
+    free(mesh->normals);
+    free(mesh->faces);
+    free(mesh->meshlets);
+  }
+  memset(mesh, 0, sizeof(*mesh));
+}
+
+
+Mat4 getLookAtMat(Vec3 eye, Vec3 center, Vec3 up) {
+  Vec3 z = normalizeVec3(subVec3(eye, center));
+  Vec3 x = normalizeVec3(crossVec3(up, z));
+  Vec3 y = crossVec3(z, x);
+  Mat4 mInv = makeMat4(x.x, x.y, x.z, 0,
+                       y.x, y.y, y.z, 0,
+                       z.x, z.y, z.z, 0,
+                         0,   0,   0, 1);
+  Mat4 tr = makeMat4(1, 0, 0, -center.x,
+                     0, 1, 0, -center.y,
+                     0, 0, 1, -center.z,
+                     0, 0, 0,         1);
+  return mulMat4(mInv, tr);
+}
+
+void drawTexture(Texture texture, bool stretch) {
+  for (u32 i = 0; i < texture.width*texture.height; ++i) {
+    if (stretch) {
+      f32 tx = (f32)(i % texture.width) / (texture.width-1);
+      f32 ty = (f32)(i / texture.width) / (texture.height-1);
+      u32 x = (u32)(tx*(backbufferWidth-1));
+      u32 y = (u32)(ty*(backbufferHeight-1));
+      Vec3 color = texture.pixels[getTexelIndex(&texture, i % texture.width, i / texture.width)];
+      setPixel(x, y, color);
+    } else {
+      int x = i % texture.width;
+      int y = i / texture.width;
+      Vec3 color = texture.pixels[getTexelIndex(&texture, x, y)];
+      setPixel(x, y, color);
+    }
+  }
+}
+
+// The font is a grid of GLYPH_WIDTH x GLYPH_HEIGHT glyphs for the characters
+// 0-255, baked at load into one bitmask per glyph row (bit j is column j), so
+// drawing text reads 16 bytes per glyph instead of the float texture.
+#define GLYPH_WIDTH 8
+#define GLYPH_HEIGHT 16
+#define TEXT_COLOR 0xFFFFFFFF
+
+typedef struct {
+  u8 rows[256][GLYPH_HEIGHT];
+} GlyphAtlas;
+
+GlyphAtlas fontAtlas;
+int charWidth = GLYPH_WIDTH;
+int charHeight = GLYPH_HEIGHT;
+
+// Reads a font BMP into fontAtlas. Glyph pixels are the white ones.
+void loadFont(char *filePath) {
+  Texture font = readBMPFile(filePath);
+  int numCols = font.width / GLYPH_WIDTH;
+  assert(numCols > 0);
+  memset(&fontAtlas, 0, sizeof(fontAtlas));
+  for (int letter = 0; letter < 256; ++letter) {
+    int row = letter / numCols;
+    int col = letter % numCols;
+    if ((row+1)*GLYPH_HEIGHT > (int)font.height) break;
+    for (int i = 0; i < GLYPH_HEIGHT; ++i) {
+      // BMP rows go bottom-up
+      Vec3 *texels = font.pixels + (font.height-1 - (row*GLYPH_HEIGHT + i))*font.width + col*GLYPH_WIDTH;
+      u8 mask = 0;
+      for (int j = 0; j < GLYPH_WIDTH; ++j) {
+        if (texels[j].x == 1.0f) mask |= 1 << j;
+      }
+      fontAtlas.rows[letter][i] = mask;
+    }
+  }
+  free(font.pixels);
+}
+
+// Strings drawText has queued for flushText.
+#define TEXT_MAX_RUNS 256
+#define TEXT_MAX_CHARS 16384
+
+typedef struct {
+  int x, y; // top left, y counting down from the top of the screen
+  int start;
+  int length;
+} TextRun;
+
+typedef struct {
+  TextRun runs[TEXT_MAX_RUNS];
+  int numRuns;
+  char chars[TEXT_MAX_CHARS];
+  int numChars;
+} TextBatch;
+
+TextBatch textBatch;
+
+void flushText(void);
+
+// Queues a formatted string with its top left at (destX, destY) from the top
+// left of the screen. Nothing is drawn until flushText.
+void drawText(int destX, int destY, char *format, ...) {
+  TextBatch *batch = &textBatch;
+  if (batch->numRuns == TEXT_MAX_RUNS) flushText();
+  for (;;) {
+    int space = TEXT_MAX_CHARS - batch->numChars;
+    va_list argptr;
+    va_start(argptr, format);
+    int length = vsnprintf(batch->chars + batch->numChars, space, format, argptr);
+    va_end(argptr);
+    if (length < 0) return;
+    if (length >= space) {
+      if (batch->numChars > 0) {
+        flushText();
+        continue;
+      }
+      // longer than the whole batch
+      length = space-1;
+    }
+    TextRun *run = &batch->runs[batch->numRuns++];
+    run->x = destX;
+    run->y = destY;
+    run->start = batch->numChars;
+    run->length = length;
+    batch->numChars += length;
+    return;
+  }
+}
+
+// Sets the pixels of a glyph row, GLYPH_WIDTH from dest on, where mask's bits
+// are, four pixels per masked store.
+FORCE_INLINE void blitGlyphRow(u32 *dest, u32 mask) {
+#if SIMD_X86 && (defined(__SSE2__) || defined(_M_X64))
+  __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+  __m128i color = _mm_set1_epi32((int)TEXT_COLOR);
+  for (int j = 0; j < GLYPH_WIDTH; j += 4) {
+    __m128i m = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)(mask >> j)), bits), bits);
+    __m128i *p = (__m128i *)(dest + j);
+    _mm_storeu_si128(p, _mm_or_si128(_mm_andnot_si128(m, _mm_loadu_si128(p)), _mm_and_si128(m, color)));
+  }
+#else
+  for (int j = 0; j < GLYPH_WIDTH; ++j) {
+    if (mask & (1 << j)) dest[j] = TEXT_COLOR;
+  }
+#endif
+}
+
+// Draws glyph row i of the run into the backbuffer row.
+void drawTextRunRow(u32 *row, TextRun *run, u8 *chars, int i) {
+  for (int ch = 0; ch < run->length; ++ch) {
+    u32 mask = fontAtlas.rows[chars[ch]][i];
+    if (!mask) continue;
+    int x = run->x + ch*GLYPH_WIDTH;
+    if (x >= 0 && x + GLYPH_WIDTH <= backbufferWidth) {
+      blitGlyphRow(row + x, mask);
+    } else {
+      for (int j = 0; j < GLYPH_WIDTH; ++j) {
+        if ((mask & (1 << j)) && x + j >= 0 && x + j < backbufferWidth) row[x + j] = TEXT_COLOR;
+      }
+    }
+  }
+}
+
+// Draws the queued text into the backbuffer and empties the batch. Only the
+// drawing is batched: every drawText call still formats its string, as the
+// HUD's numbers change from frame to frame. The runs are sorted by their top
+// and drawn a screen row at a time across all of them, so each backbuffer row
+// is visited once however many runs share it.
+void flushText(void) {
+  TextBatch *batch = &textBatch;
+  int order[TEXT_MAX_RUNS];
+  for (int r = 0; r < batch->numRuns; ++r) {
+    int j = r;
+    while (j > 0 && batch->runs[order[j-1]].y > batch->runs[r].y) {
+      order[j] = order[j-1];
+      --j;
+    }
+    order[j] = r;
+  }
+
+  // order[first] to order[last-1] are the runs over text row textY
+  int first = 0, last = 0, textY = 0;
+  while (first < batch->numRuns) {
+    if (first == last) textY = batch->runs[order[last]].y;
+    while (last < batch->numRuns && batch->runs[order[last]].y <= textY) ++last;
+    // the backbuffer's rows go bottom-up
+    int y = backbufferHeight-1 - textY;
+    if (y >= 0 && y < backbufferHeight) {
+      u32 *row = backbuffer + y*backbufferWidth;
+      for (int k = first; k < last; ++k) {
+        TextRun *run = &batch->runs[order[k]];
+        drawTextRunRow(row, run, (u8 *)batch->chars + run->start, textY - run->y);
+      }
+    }
+    ++textY;
+    while (first < last && batch->runs[order[first]].y + GLYPH_HEIGHT <= textY) ++first;
+  }
+  batch->numRuns = 0;
+  batch->numChars = 0;
+}
+
+// Writes an uncompressed 32-bit TGA. Rows go bottom-up, same as the backbuffer.
+bool writeTGAFile(char *filePath, u32 *pixels, int width, int height) {
+  u32 pixelsSize = width * height * sizeof(*pixels);
+  u32 fileSize = sizeof(TGAHeader) + pixelsSize;
+  u8 *fileContents = malloc(fileSize);
+
+  TGAHeader *header = (TGAHeader *)fileContents;
+  memset(header, 0, sizeof(*header));
+  header->imageType = TGADT_TC;
+  header->imageSpec.width = (u16)width;
+  header->imageSpec.height = (u16)height;
+  header->imageSpec.bitsPerPixel = 32;
+  header->imageSpec.descriptor = 8; // 8 alpha bits, bottom-left origin
+  // 0xAARRGGBB stored little-endian is exactly TGA's BGRA order
+  memcpy(fileContents + sizeof(TGAHeader), pixels, pixelsSize);
+
+  bool success = platformWriteEntireFile(filePath, fileContents, fileSize);
+  free(fileContents);
+  return success;
+}
+
+//
+// Sort-middle tile renderer: renderScene transforms every face into a
+// RasterTriangle and bins it into the screen tiles its bounding box touches,
+// then the workers grab whole tiles and clear and rasterize them. A tile is
+// only ever touched by one worker, so no locking is needed on the color or
+// depth buffers, and each bin keeps submission order so the image is the
+// same as a single-threaded render.
+//
+
+typedef struct {
+  int tilesX;
+  int tilesY;
+
+  TriangleSetup *triangles;
+  int numTriangles;
+  int maxTriangles;
+
+  // one byte per tile coordinate: minimum x and y in the low two bytes,
+  // maximum x and y in the high two
+  u32 *triangleTileRects;
+
+  u32 *binCounts;
+  u32 *binOffsets;
+  u32 *binnedTriangles;
+  u32 maxBinnedTriangles;
+
+  // per tile ShadingStats, summed after rasterization
+  ShadingStats *tileShadingStats;
+
+  // one per worker, allocated when MSAA is first used
+  MsaaTile **msaaTiles;
+  int numMsaaTiles;
+
+  // triangles use the DrawState last added before them
+  DrawState *draws;
+  u32 numDraws;
+  u32 maxDraws;
+
+  ShadeMode shadeMode;
+  ColorResolve colorResolve;
+  Vec3 clearColor;
+  u32 clearPixel; // clearColor resolved
+  volatile i32 nextTile;
+} TileBins;
+
+TileBins tileBins;
+
+void resetTileBins(TileBins *bins) {
+  int tilesX = (backbufferWidth + TILE_SIZE-1) / TILE_SIZE;
+  int tilesY = (backbufferHeight + TILE_SIZE-1) / TILE_SIZE;
+  if (tilesX != bins->tilesX || tilesY != bins->tilesY) {
+    bins->tilesX = tilesX;
+    bins->tilesY = tilesY;
+    free(bins->binCounts);
+    free(bins->binOffsets);
+    free(bins->tileShadingStats);
+    bins->binCounts = malloc(tilesX*tilesY*sizeof(*bins->binCounts));
+    bins->binOffsets = malloc(tilesX*tilesY*sizeof(*bins->binOffsets));
+    bins->tileShadingStats = malloc(tilesX*tilesY*sizeof(*bins->tileShadingStats));
+  }
+  memset(bins->binCounts, 0, tilesX*tilesY*sizeof(*bins->binCounts));
+  bins->numTriangles = 0;
+  bins->numDraws = 0;
+}
+
+void addDrawState(TileBins *bins, Material *material, Vec3 lightDir) {
+  RESERVE_ONE(bins->draws, bins->numDraws, bins->maxDraws);
+  DrawState *draw = &bins->draws[bins->numDraws++];
+  draw->material = material;
+  draw->lightDir = lightDir;
+}
+
+// Finds the tiles covered by the triangle's (screen-clamped) bounding box.
+u32 getTriangleTileRect(TriangleSetup *t) {
+  u32 minTileX = t->minX / TILE_SIZE;
+  u32 minTileY = t->minY / TILE_SIZE;
+  u32 maxTileX = t->maxX / TILE_SIZE;
+  u32 maxTileY = t->maxY / TILE_SIZE;
+  return minTileX | (minTileY << 8) | (maxTileX << 16) | (maxTileY << 24);
+}
+
+// Returns false if setupTriangle rejects the triangle.
+bool addTriangleToBins(TileBins *bins, RasterTriangle *t) {
+  if (bins->numTriangles == bins->maxTriangles) {
+    // clipping can turn one face into several triangles
+    bins->maxTriangles = bins->maxTriangles ? 2*bins->maxTriangles : 1024;
+    bins->triangles = realloc(bins->triangles, bins->maxTriangles*sizeof(*bins->triangles));
+    bins->triangleTileRects = realloc(bins->triangleTileRects, bins->maxTriangles*sizeof(*bins->triangleTileRects));
+  }
+  int index = bins->numTriangles;
+  TriangleSetup *setup = &bins->triangles[index];
+  if (!setupTriangle(t, setup)) return false;
+  assert(bins->numDraws > 0);
+  setup->draw = bins->numDraws-1;
+  u32 rect = getTriangleTileRect(setup);
+  bins->triangleTileRects[index] = rect;
+  ++bins->numTriangles;
+  for (u32 ty = (rect >> 8) & 0xFF; ty <= (rect >> 24); ++ty) {
+    for (u32 tx = rect & 0xFF; tx <= ((rect >> 16) & 0xFF); ++tx) {
+      ++bins->binCounts[tx + ty*bins->tilesX];
+    }
+  }
+  return true;
+}
+
+//
+// Clipping. Vertices come in after transformMat, before the divide by w, so
+// screen pixel (x, y) is at (x*w, y*w). Triangles entirely outside one of the
+// screen edges or the near plane are dropped. Everything else only needs
+// clipping if it pokes out of the guard band, a box much larger than the
+// screen whose coordinates setupTriangle can still handle; the pixels
+// between the screen and the guard band are rejected by bounding boxes and
+// tile classification instead. In practice that means only triangles
+// crossing the near plane or very close to the camera get clipped.
+//
+
+// MAX_BACKBUFFER_SIZE keeps the screen inside it
+#define GUARD_BAND (RASTER_COORD_LIMIT - 1024.0f)
+#define NEAR_W 0.01f
+
+typedef struct {
+  Vec4 pos;
+  float u, v;
+} ClipVertex;
+
+typedef enum {
+  CLIP_NEAR   = 1 << 0,
+  CLIP_LEFT   = 1 << 1,
+  CLIP_RIGHT  = 1 << 2,
+  CLIP_BOTTOM = 1 << 3,
+  CLIP_TOP    = 1 << 4,
+  CLIP_PLANE_COUNT = 5,
+} ClipPlane;
+
+// Signed distance to a plane, positive inside. The screen planes are at
+// [left, right] x [bottom, top].
+float getClipDistance(Vec4 p, int plane, float left, float right, float bottom, float top) {
+  switch (plane) {
+    case CLIP_NEAR:   return p.w - NEAR_W;
+    case CLIP_LEFT:   return p.x - left*p.w;
+    case CLIP_RIGHT:  return right*p.w - p.x;
+    case CLIP_BOTTOM: return p.y - bottom*p.w;
+    case CLIP_TOP:    return top*p.w - p.y;
+  }
+  assert(!"unknown clip plane");
+  return 0;
+}
+
+u32 getOutCode(Vec4 p, float left, float right, float bottom, float top) {
+  u32 code = 0;
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) {
+    // NaN-safe: a NaN distance counts as outside
+    if (!(getClipDistance(p, 1 << i, left, right, bottom, top) >= 0)) code |= 1 << i;
+  }
+  return code;
+}
+
+void addClippedTriangleToBins(TileBins *bins, ClipVertex *v0, ClipVertex *v1, ClipVertex *v2) {
+  ClipVertex *v[3] = {v0, v1, v2};
+  RasterTriangle t;
+  for (int i = 0; i < 3; ++i) {
+    t.x[i] = v[i]->pos.x / v[i]->pos.w;
+    t.y[i] = v[i]->pos.y / v[i]->pos.w;
+    t.z[i] = v[i]->pos.z / v[i]->pos.w;
+    t.u[i] = v[i]->u;
+    t.v[i] = v[i]->v;
+  }
+  addTriangleToBins(bins, &t);
+}
+
+void clipAndBinTriangle(TileBins *bins, ClipVertex *v0, ClipVertex *v1, ClipVertex *v2) {
+  float screenRight = (float)(backbufferWidth-1);
+  float screenTop = (float)(backbufferHeight-1);
+  u32 screenOut0 = getOutCode(v0->pos, 0, screenRight, 0, screenTop);
+  u32 screenOut1 = getOutCode(v1->pos, 0, screenRight, 0, screenTop);
+  u32 screenOut2 = getOutCode(v2->pos, 0, screenRight, 0, screenTop);
+  if (screenOut0 & screenOut1 & screenOut2) return;
+
+  u32 guardOut0 = getOutCode(v0->pos, -GUARD_BAND, GUARD_BAND, -GUARD_BAND, GUARD_BAND);
+  u32 guardOut1 = getOutCode(v1->pos, -GUARD_BAND, GUARD_BAND, -GUARD_BAND, GUARD_BAND);
+  u32 guardOut2 = getOutCode(v2->pos, -GUARD_BAND, GUARD_BAND, -GUARD_BAND, GUARD_BAND);
+  u32 clipPlanes = guardOut0 | guardOut1 | guardOut2;
+  if (!clipPlanes) {
+    addClippedTriangleToBins(bins, v0, v1, v2);
+    return;
+  }
+
+  // Sutherland-Hodgman against each plane the triangle crosses. Each plane
+  // adds at most one vertex.
+  ClipVertex buffers[2][3 + CLIP_PLANE_COUNT];
+  ClipVertex *in = buffers[0], *out = buffers[1];
+  int numIn = 3;
+  in[0] = *v0;
+  in[1] = *v1;
+  in[2] = *v2;
+
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) {
+    int plane = 1 << i;
+    if (!(clipPlanes & plane)) continue;
+
+    int numOut = 0;
+    for (int j = 0; j < numIn; ++j) {
+      ClipVertex *a = &in[j];
+      ClipVertex *b = &in[(j+1) % numIn];
+      float da = getClipDistance(a->pos, plane, -GUARD_BAND, GUARD_BAND, -GUARD_BAND, GUARD_BAND);
+      float db = getClipDistance(b->pos, plane, -GUARD_BAND, GUARD_BAND, -GUARD_BAND, GUARD_BAND);
+      if (da >= 0) out[numOut++] = *a;
+      if ((da >= 0) != (db >= 0)) {
+        float t = da / (da - db);
+        ClipVertex *c = &out[numOut++];
+        c->pos.x = a->pos.x + (b->pos.x - a->pos.x)*t;
+        c->pos.y = a->pos.y + (b->pos.y - a->pos.y)*t;
+        c->pos.z = a->pos.z + (b->pos.z - a->pos.z)*t;
+        c->pos.w = a->pos.w + (b->pos.w - a->pos.w)*t;
+        c->u = a->u + (b->u - a->u)*t;
+        c->v = a->v + (b->v - a->v)*t;
+      }
+    }
+    if (numOut < 3) return;
+
+    ClipVertex *temp = in;
+    in = out;
+    out = temp;
+    numIn = numOut;
+  }
+
+  for (int i = 1; i+1 < numIn; ++i) {
+    addClippedTriangleToBins(bins, &in[0], &in[i], &in[i+1]);
+  }
+}
+
+// Second binning pass: turns the per-tile counts into offsets and scatters
+// triangle indices into one flat array, in submission order.
+void fillTileBins(TileBins *bins) {
+  int numTiles = bins->tilesX*bins->tilesY;
+  u32 total = 0;
+  for (int i = 0; i < numTiles; ++i) {
+    bins->binOffsets[i] = total;
+    total += bins->binCounts[i];
+    bins->binCounts[i] = 0;
+  }
+  if (total > bins->maxBinnedTriangles) {
+    bins->maxBinnedTriangles = total;
+    free(bins->binnedTriangles);
+    bins->binnedTriangles = malloc(total*sizeof(*bins->binnedTriangles));
+  }
+  for (int i = 0; i < bins->numTriangles; ++i) {
+    u32 rect = bins->triangleTileRects[i];
+    for (u32 ty = (rect >> 8) & 0xFF; ty <= (rect >> 24); ++ty) {
+      for (u32 tx = rect & 0xFF; tx <= ((rect >> 16) & 0xFF); ++tx) {
+        u32 tile = tx + ty*bins->tilesX;
+        bins->binnedTriangles[bins->binOffsets[tile] + bins->binCounts[tile]++] = i;
+      }
+    }
+  }
+}
+
+FORCE_INLINE void shadeSpanTrilinear(ColorTile *color, int c, int i, int count, Texture *texture, Texture *normalMap,
+                                     Vec3 lightDir, int mipLevel, float mipBlend, ShadeMode mode) {
+  for (int end = i + count; i < end; ++i, ++c) {
+    storeColor(color, c, shadeTrilinear(texture, normalMap, lightDir, mipLevel, mipBlend, visU[i], visV[i], mode));
+  }
+}
+
+// Shades a run of pixels from render target index i (ColorTile index c) on
+// that all show the same triangle, with the mip levels drawTriangleBarycentric picks for it in
+// forward mode.
+void shadeTriangleSpan(TileBins *bins, TriangleSetup *t, ColorTile *color, int c, int i, int count) {
+  DrawState *draw = &bins->draws[t->draw];
+  Texture *texture = &draw->material->texture, *normalMap = &draw->material->normalMap;
+  Vec3 lightDir = draw->lightDir;
+  ShadeMode mode = bins->shadeMode;
+  switch (textureFilter) {
+    case TEXTURE_FILTER_NEAREST:
+      shadeSpan[mode](color, c, i, count, texture, normalMap, lightDir);
+      break;
+    case TEXTURE_FILTER_MIPMAP: {
+      int level = (int)(getTriangleLod(t, texture) + 0.5f);
+      Texture textureLevel = getMipLevel(texture, level);
+      Texture normalMapLevel = getMipLevel(normalMap, level);
+      shadeSpan[mode](color, c, i, count, &textureLevel, &normalMapLevel, lightDir);
+    } break;
+    case TEXTURE_FILTER_TRILINEAR: {
+      float lod = getTriangleLod(t, texture);
+      int mipLevel = (int)lod;
+      float mipBlend = mipLevel+1 < texture->numMips ? lod - (float)mipLevel : 0.0f;
+      // constant modes, so each call inlines a specialized loop
+      switch (mode) {
+        case SHADE_TEXTURE_LIT: shadeSpanTrilinear(color, c, i, count, texture, normalMap, lightDir, mipLevel, mipBlend, SHADE_TEXTURE_LIT); break;
+        case SHADE_TEXTURE: shadeSpanTrilinear(color, c, i, count, texture, normalMap, lightDir, mipLevel, mipBlend, SHADE_TEXTURE); break;
+        case SHADE_LIT: shadeSpanTrilinear(color, c, i, count, texture, normalMap, lightDir, mipLevel, mipBlend, SHADE_LIT); break;
+        default: assert(!"unknown shade mode");
+      }
+    } break;
+    default:
+      assert(!"unknown texture filter");
+  }
+}
+
+void rasterizeTile(TileBins *bins, int tile, int workerIndex) {
+  int minX = (tile % bins->tilesX) * TILE_SIZE;
+  int minY = (tile / bins->tilesX) * TILE_SIZE;
+  int maxX = minX + TILE_SIZE-1;
+  int maxY = minY + TILE_SIZE-1;
+  if (maxX >= backbufferWidth) maxX = backbufferWidth-1;
+  if (maxY >= backbufferHeight) maxY = backbufferHeight-1;
+
+  ColorTile color;
+  MsaaTile *msaa = msaaSamples > 1 ? bins->msaaTiles[workerIndex] : NULL;
+  TileAddress address = getTileAddress(tile % bins->tilesX, tile / bins->tilesX, &color, msaa);
+
+  ShadingStats *stats = &bins->tileShadingStats[tile];
+  memset(stats, 0, sizeof(*stats));
+
+  if (!bins->binCounts[tile]) {
+    // nothing to draw, so only the backbuffer needs clearing
+    PROFILE_BEGIN(clear, workerIndex);
+    for (int y = minY; y <= maxY; ++y) fill32(backbuffer + minX + y*backbufferWidth, bins->clearPixel, maxX - minX + 1);
+    PROFILE_END(clear, workerIndex);
+    return;
+  }
+
+  PROFILE_BEGIN(clear, workerIndex);
+  int blockMinX = minX / HIZ_BLOCK_SIZE, blockMaxX = maxX / HIZ_BLOCK_SIZE;
+  int blockMinY = minY / HIZ_BLOCK_SIZE, blockMaxY = maxY / HIZ_BLOCK_SIZE;
+  for (int by = blockMinY; by <= blockMaxY; ++by) {
+    fill32(hiZ + blockMinX + by*hiZWidth, getFloatBits(-9999.0f), blockMaxX - blockMinX + 1);
+    memset(hiZClearTags + blockMinX + by*hiZWidth, 1, blockMaxX - blockMinX + 1);
+  }
+  if (msaa) fill32(msaa->state, MSAA_PIXEL_CLEAR, TILE_SIZE*TILE_SIZE);
+  PROFILE_END(clear, workerIndex);
+
+  PROFILE_BEGIN(raster, workerIndex);
+  u32 *binned = bins->binnedTriangles + bins->binOffsets[tile];
+  for (u32 i = 0; i < bins->binCounts[tile]; ++i) {
+    TriangleSetup *t = &bins->triangles[binned[i]];
+    clearTaggedBlocks(address, t->minX > minX ? t->minX : minX, t->minY > minY ? t->minY : minY,
+                      t->maxX < maxX ? t->maxX : maxX, t->maxY < maxY ? t->maxY : maxY, bins->clearColor);
+    drawTriangleBarycentric(t, binned[i], &bins->draws[t->draw], bins->shadeMode, stats, address, minX, minY, maxX, maxY);
+  }
+  // blocks no triangle reached only need their color (or visibility) cleared
+  for (int by = blockMinY; by <= blockMaxY; ++by) {
+    for (int bx = blockMinX; bx <= blockMaxX; ++bx) {
+      u8 *tag = &hiZClearTags[bx + by*hiZWidth];
+      if (!*tag) continue;
+      *tag = 0;
+      TriangleRect block;
+      getHiZBlockRect(bx, by, &block);
+      int width = block.maxX - block.minX + 1;
+      for (int y = block.minY; y <= block.maxY; ++y) {
+        int i = block.minX + y*address.pitch + address.offset;
+        if (deferredShading) {
+          fill32(visTriangles + i, VIS_NONE, width);
+        } else {
+          int c = block.minX + y*TILE_SIZE + address.colorOffset;
+          fill32(color.r + c, getFloatBits(bins->clearColor.x), width);
+          fill32(color.g + c, getFloatBits(bins->clearColor.y), width);
+          fill32(color.b + c, getFloatBits(bins->clearColor.z), width);
+        }
+      }
+    }
+  }
+  PROFILE_END(raster, workerIndex);
+
+  if (deferredShading) {
+    PROFILE_BEGIN(shade, workerIndex);
+    for (int y = minY; y <= maxY; ++y) {
+      int rowStart = y*address.pitch + address.offset;
+      int colorRowStart = y*TILE_SIZE + address.colorOffset;
+      u32 *row = visTriangles + rowStart;
+      for (int x = minX; x <= maxX;) {
+        int end = x + 1;
+        while (end <= maxX && row[end] == row[x]) ++end;
+        if (row[x] != VIS_NONE) {
+          shadeTriangleSpan(bins, &bins->triangles[row[x]], &color, x + colorRowStart, x + rowStart, end - x);
+          stats->shadedPixels += end - x;
+        } else {
+          for (int i = x; i < end; ++i) storeColor(&color, i + colorRowStart, bins->clearColor);
+        }
+        x = end;
+      }
+    }
+    stats->pixelsCovered = stats->shadedPixels;
+    PROFILE_END(shade, workerIndex);
+  }
+
+  // resolve the finished tile while it's still in the cache
+  PROFILE_BEGIN(resolve, workerIndex);
+  for (int y = minY; y <= maxY; ++y) {
+    if (msaa) resolveMsaaRow(&color, msaa, minX + y*TILE_SIZE + address.colorOffset, maxX - minX + 1, msaaSamples);
+    resolveRow(backbuffer + minX + y*backbufferWidth, &color, minX + y*TILE_SIZE + address.colorOffset, maxX - minX + 1,
+               bins->colorResolve);
+  }
+  PROFILE_END(resolve, workerIndex);
+}
+
+//
+// Vertex stage: every position of a mesh instance is transformed once per
+// frame into a post-transform vertex buffer that triangle assembly reads
+// through the face indices, so vertex work scales with the vertex count, not
+// the face count. The instances of one mesh are culled together, then
+// transformed and assembled a chunk at a time, all reading the mesh's one
+// copy of the streams.
+//
+
+#define VERTEX_BATCH_SIZE 1024
+// vertices transformed before they're assembled, so they're still cached
+#define VERTEX_CHUNK_SIZE 16384
+
+// An instance that survived culling.
+typedef struct {
+  Mat4 transform; // object space to screen
+  Vec3 lightDir;  // lightDir in object space
+  // its entries in VertexStage.visibleMeshlets
+  u32 firstMeshlet;
+  u32 numMeshlets;
+  // where its vertices start in the post-transform streams
+  u32 vertexBase;
+} StageInstance;
+
+// Post-transform vertex buffer in SoA form: clip space positions, their
+// screen projections (only meaningful where guardOut is 0) and outcodes
+// against the screen and the guard band. Every stream holds
+// getSoACount(numPositions) entries per instance of the chunk being
+// transformed and is SOA_ALIGN aligned.
+typedef struct {
+  float *clipX, *clipY, *clipZ, *clipW;
+  float *screenX, *screenY, *screenZ;
+  u32 *screenOut, *guardOut;
+  u32 maxVertices;
+
+  // which SOA_PADDING groups of vertices to transform, numGroups per
+  // instance, see cullMeshlets
+  u8 *groupVisible;
+  u32 maxGroups;
+  u32 *visibleMeshlets;
+  u32 numVisibleMeshlets;
+  u32 maxMeshlets;
+  StageInstance *instances;
+  u32 numInstances;
+  u32 maxInstances;
+
+  Mesh *mesh;
+  // the chunk transformVertices is working on
+  u32 firstInstance;
+  u32 numChunkInstances;
+  volatile i32 nextBatch;
+} VertexStage;
+
+VertexStage vertexStage;
+
+// Transforms count vertices of stage->mesh starting at first, both multiples
+// of SOA_PADDING, by instance->transform (w = 1) into the streams from
+// instance->vertexBase on.
+typedef void VertexKernel(VertexStage *stage, StageInstance *instance, u32 first, u32 count);
+
+void transformVertexBatchScalar(VertexStage *stage, StageInstance *instance, u32 first, u32 count) {
+  Mat4 *m = &instance->transform;
+  u32 stride = getSoACount(stage->mesh->numPositions);
+  u32 base = instance->vertexBase;
+  float *inX = stage->mesh->positionsSoA;
+  float *inY = inX + stride;
+  float *inZ = inY + stride;
+  float screenRight = (float)(backbufferWidth-1);
+  float screenTop = (float)(backbufferHeight-1);
+  for (u32 i = first; i < first + count; ++i) {
+    float x = inX[i], y = inY[i], z = inZ[i];
+    Vec4 clip;
+    clip.x = m->d[0][0]*x + m->d[0][1]*y + m->d[0][2]*z + m->d[0][3];
+    clip.y = m->d[1][0]*x + m->d[1][1]*y + m->d[1][2]*z + m->d[1][3];
+    clip.z = m->d[2][0]*x + m->d[2][1]*y + m->d[2][2]*z + m->d[2][3];
+    clip.w = m->d[3][0]*x + m->d[3][1]*y + m->d[3][2]*z + m->d[3][3];
+    stage->clipX[base + i] = clip.x;
+    stage->clipY[base + i] = clip.y;
+    stage->clipZ[base + i] = clip.z;
+    stage->clipW[base + i] = clip.w;
+    stage->screenX[base + i] = clip.x / clip.w;
+    stage->screenY[base + i] = clip.y / clip.w;
+    stage->screenZ[base + i] = clip.z / clip.w;
+    stage->screenOut[base + i] = getOutCode(clip, 0, screenRight, 0, screenTop);
+    stage->guardOut[base + i] = getOutCode(clip, -GUARD_BAND, GUARD_BAND, -GUARD_BAND, GUARD_BAND);
+  }
+}
+
+#include "vertex_simd.c"
+
+void transformVerticesWork(void *data, int workerIndex) {
+  VertexStage *stage = data;
+  u32 count = getSoACount(stage->mesh->numPositions);
+  int instanceBatches = (count + VERTEX_BATCH_SIZE-1) / VERTEX_BATCH_SIZE;
+  int numBatches = instanceBatches*stage->numChunkInstances;
+  for (;;) {
+    int batch = platformAtomicIncrement(&stage->nextBatch) - 1;
+    if (batch >= numBatches) break;
+    u32 instanceIndex = stage->firstInstance + batch / instanceBatches;
+    StageInstance *instance = &stage->instances[instanceIndex];
+    u8 *groupVisible = stage->groupVisible + instanceIndex*(count / SOA_PADDING);
+    u32 first = (batch % instanceBatches)*VERTEX_BATCH_SIZE;
+    u32 end = first + VERTEX_BATCH_SIZE < count ? first + VERTEX_BATCH_SIZE : count;
+    // runs of visible groups
+    for (u32 runStart = first; runStart < end;) {
+      if (!groupVisible[runStart / SOA_PADDING]) {
+        runStart += SOA_PADDING;
+        continue;
+      }
+      u32 runEnd = runStart + SOA_PADDING;
+      while (runEnd < end && groupVisible[runEnd / SOA_PADDING]) runEnd += SOA_PADDING;
+      transformVertexBatch(stage, instance, runStart, runEnd - runStart);
+      runStart = runEnd;
+    }
+  }
+}
+
+//
+// Culling. Meshes and meshlets whose bounding sphere is outside a frustum
+// plane, or whose normal cone faces away from the viewer, are dropped before
+// the vertex stage, which then only transforms the SOA_PADDING vertex groups
+// the remaining meshlets use. Triangle assembly drops faces outside the
+// screen and back faces.
+//
+
+bool backfaceCullingEnabled = true;
+
+typedef struct {
+  u32 meshes, meshesCulled;
+  u32 meshlets, meshletsOutside, meshletsBackfacing;
+  u32 vertices, verticesTransformed;
+  u32 faces, facesInCulledMeshlets, facesOutside, facesBackfacing, facesDegenerate, facesClipped;
+  u32 trianglesBinned;
+  // instances drawn with a simplified LOD, and the faces all instances have
+  // at full detail
+  u32 meshesSimplified, facesFullDetail;
+} CullStats;
+
+// counts for the last renderScene
+CullStats cullStats;
+
+typedef enum {
+  CULL_NONE,
+  CULL_OUTSIDE,
+  CULL_BACKFACING,
+} CullResult;
+
+// The screen and near planes in object space, inside where
+// dot(plane.xyz, p) + plane.w >= 0, and the viewer: its position with w = 1,
+// or for orthographic views the direction towards it with w = 0.
+typedef struct {
+  Vec4 planes[CLIP_PLANE_COUNT];
+  float planeLengths[CLIP_PLANE_COUNT];
+  Vec4 viewer;
+} CullView;
+
+CullView makeCullView(Mat4 transform, Vec4 viewer) {
+  CullView view;
+  float right = (float)(backbufferWidth-1);
+  float top = (float)(backbufferHeight-1);
+  // the same planes as getClipDistance, as rows of the transform
+  for (int i = 0; i < 4; ++i) {
+    float x = transform.d[0][i], y = transform.d[1][i], w = transform.d[3][i];
+    float nearW = i == 3 ? NEAR_W : 0;
+    float *p[CLIP_PLANE_COUNT] = {&view.planes[0].x, &view.planes[1].x, &view.planes[2].x, &view.planes[3].x, &view.planes[4].x};
+    p[0][i] = w - nearW;
+    p[1][i] = x;
+    p[2][i] = right*w - x;
+    p[3][i] = y;
+    p[4][i] = top*w - y;
+  }
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) {
+    Vec4 p = view.planes[i];
+    view.planeLengths[i] = sqrtf(p.x*p.x + p.y*p.y + p.z*p.z);
+  }
+  view.viewer = viewer;
+  return view;
+}
+
+CullResult cullBounds(CullView *view, Bounds *bounds) {
+  Vec3 c = bounds->center;
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) {
+    Vec4 p = view->planes[i];
+    if (p.x*c.x + p.y*c.y + p.z*c.z + p.w < -bounds->radius*view->planeLengths[i]) return CULL_OUTSIDE;
+  }
+  if (backfaceCullingEnabled && bounds->coneCutoff < 1.0f) {
+    Vec4 v = view->viewer;
+    if (v.w) {
+      Vec3 d = subVec3(c, makeVec3(v.x, v.y, v.z));
+      if (dotVec3(d, bounds->coneAxis) >= bounds->coneCutoff*lengthVec3(d) + bounds->radius) return CULL_BACKFACING;
+    } else {
+      Vec3 d = makeVec3(-v.x, -v.y, -v.z);
+      if (dotVec3(d, bounds->coneAxis) >= bounds->coneCutoff) return CULL_BACKFACING;
+    }
+  }
+  return CULL_NONE;
+}
+
+// Starts culling instances of mesh, dropping the stage's previous ones.
+void beginVertexStage(VertexStage *stage, Mesh *mesh) {
+  stage->mesh = mesh;
+  stage->numInstances = 0;
+  stage->numVisibleMeshlets = 0;
+}
+
+// Culls an instance and its meshlets, and unless the whole instance is culled
+// adds it to the stage with the vertex groups its visible meshlets need
+// marked. The view is in the instance's object space.
+void cullMeshlets(VertexStage *stage, CullView *view, StageInstance *instance, CullStats *stats) {
+  Mesh *mesh = stage->mesh;
+  u32 numGroups = getSoACount(mesh->numPositions) / SOA_PADDING;
+  ++stats->meshes;
+  stats->meshlets += mesh->numMeshlets;
+  stats->vertices += mesh->numPositions;
+  stats->faces += mesh->numFaces;
+  if (cullBounds(view, &mesh->bounds) != CULL_NONE) {
+    ++stats->meshesCulled;
+    stats->facesInCulledMeshlets += mesh->numFaces;
+    return;
+  }
+
+  if ((stage->numInstances+1)*numGroups > stage->maxGroups) {
+    stage->maxGroups = 2*(stage->numInstances+1)*numGroups;
+    stage->groupVisible = realloc(stage->groupVisible, stage->maxGroups);
+  }
+  if (stage->numVisibleMeshlets + mesh->numMeshlets > stage->maxMeshlets) {
+    stage->maxMeshlets = 2*(stage->numVisibleMeshlets + mesh->numMeshlets);
+    stage->visibleMeshlets = realloc(stage->visibleMeshlets, stage->maxMeshlets*sizeof(*stage->visibleMeshlets));
+  }
+  RESERVE_ONE(stage->instances, stage->numInstances, stage->maxInstances);
+  u8 *groupVisible = stage->groupVisible + stage->numInstances*numGroups;
+  memset(groupVisible, 0, numGroups);
+  instance->firstMeshlet = stage->numVisibleMeshlets;
+
+  for (u32 i = 0; i < mesh->numMeshlets; ++i) {
+    Meshlet *meshlet = &mesh->meshlets[i];
+    CullResult result = cullBounds(view, &meshlet->bounds);
+    if (result != CULL_NONE) {
+      if (result == CULL_OUTSIDE) ++stats->meshletsOutside;
+      else ++stats->meshletsBackfacing;
+      stats->facesInCulledMeshlets += meshlet->numFaces;
+      continue;
+    }
+    stage->visibleMeshlets[stage->numVisibleMeshlets++] = i;
+    if (meshlet->firstVertex < meshlet->vertexEnd) {
+      u32 firstGroup = meshlet->firstVertex / SOA_PADDING;
+      u32 lastGroup = (meshlet->vertexEnd - 1) / SOA_PADDING;
+      memset(groupVisible + firstGroup, 1, lastGroup - firstGroup + 1);
+    }
+  }
+  for (u32 i = 0; i < numGroups; ++i) {
+    if (!groupVisible[i]) continue;
+    u32 end = (i+1)*SOA_PADDING < mesh->numPositions ? (i+1)*SOA_PADDING : mesh->numPositions;
+    stats->verticesTransformed += end - i*SOA_PADDING;
+  }
+  instance->numMeshlets = stage->numVisibleMeshlets - instance->firstMeshlet;
+  stage->instances[stage->numInstances++] = *instance;
+}
+
+// Transforms the vertex groups cullMeshlets marked for count instances from
+// first on, the first of them to the start of the streams.
+void transformVertices(VertexStage *stage, u32 first, u32 count) {
+  u32 stride = getSoACount(stage->mesh->numPositions);
+  if (count*stride > stage->maxVertices) {
+    stage->maxVertices = count*stride;
+    freeAligned(stage->clipX);
+    // one block for all nine 4-byte streams
+    float *block = allocAligned(9*(size_t)stage->maxVertices*sizeof(float), SOA_ALIGN);
+    u32 size = stage->maxVertices;
+    stage->clipX = block;
+    stage->clipY = block + size;
+    stage->clipZ = block + 2*size;
+    stage->clipW = block + 3*size;
+    stage->screenX = block + 4*size;
+    stage->screenY = block + 5*size;
+    stage->screenZ = block + 6*size;
+    stage->screenOut = (u32 *)(block + 7*size);
+    stage->guardOut = (u32 *)(block + 8*size);
+  }
+  for (u32 i = 0; i < count; ++i) stage->instances[first + i].vertexBase = i*stride;
+  stage->firstInstance = first;
+  stage->numChunkInstances = count;
+  stage->nextBatch = 0;
+  platformRunOnWorkers(transformVerticesWork, stage);
+}
+
+// Bins the visible meshlets' faces of the instances transformVertices just
+// transformed, each shaded with material. Triangles inside the guard band go
+// straight to binning, the rest through the clipper.
+void assembleTriangles(TileBins *bins, VertexStage *stage, Material *material, CullStats *stats) {
+  Mesh *mesh = stage->mesh;
+  for (u32 k = stage->firstInstance; k < stage->firstInstance + stage->numChunkInstances; ++k) {
+    StageInstance *instance = &stage->instances[k];
+    addDrawState(bins, material, instance->lightDir);
+    u32 base = instance->vertexBase;
+    for (u32 m = instance->firstMeshlet; m < instance->firstMeshlet + instance->numMeshlets; ++m) {
+      Meshlet *meshlet = &mesh->meshlets[stage->visibleMeshlets[m]];
+      for (u32 i = meshlet->firstFace; i < meshlet->firstFace + meshlet->numFaces; ++i) {
+        Face *f = &mesh->faces[i];
+        u32 v0 = base + f->v[0], v1 = base + f->v[1], v2 = base + f->v[2];
+        if (stage->screenOut[v0] & stage->screenOut[v1] & stage->screenOut[v2]) {
+          ++stats->facesOutside;
+          continue;
+        }
+
+        Vec3 *vt[3] = {&mesh->texCoords[f->vt[0]], &mesh->texCoords[f->vt[1]], &mesh->texCoords[f->vt[2]]};
+        if (!(stage->guardOut[v0] | stage->guardOut[v1] | stage->guardOut[v2])) {
+          RasterTriangle t;
+          for (int j = 0; j < 3; ++j) {
+            u32 v = base + f->v[j];
+            t.x[j] = stage->screenX[v];
+            t.y[j] = stage->screenY[v];
+            t.z[j] = stage->screenZ[v];
+            t.u[j] = vt[j]->x;
+            t.v[j] = vt[j]->y;
+          }
+          // all w > 0 here, so the screen winding gives the facing; front
+          // faces are counter-clockwise
+          float area = (t.x[1] - t.x[0])*(t.y[2] - t.y[0]) - (t.x[2] - t.x[0])*(t.y[1] - t.y[0]);
+          if (backfaceCullingEnabled && area < 0) {
+            ++stats->facesBackfacing;
+            continue;
+          }
+          if (!addTriangleToBins(bins, &t)) ++stats->facesDegenerate;
+        } else {
+          ClipVertex c[3];
+          for (int j = 0; j < 3; ++j) {
+            u32 v = base + f->v[j];
+            c[j].pos = makeVec4(stage->clipX[v], stage->clipY[v], stage->clipZ[v], stage->clipW[v]);
+            c[j].u = vt[j]->x;
+            c[j].v = vt[j]->y;
+          }
+          ++stats->facesClipped;
+          clipAndBinTriangle(bins, &c[0], &c[1], &c[2]);
+        }
+      }
+    }
+  }
+}
+
+void rasterizeTilesWork(void *data, int workerIndex) {
+  TileBins *bins = data;
+  int numTiles = bins->tilesX*bins->tilesY;
+  for (;;) {
+    int tile = platformAtomicIncrement(&bins->nextTile) - 1;
+    if (tile >= numTiles) break;
+    rasterizeTile(bins, tile, workerIndex);
+  }
+}
+
+typedef struct {
+  Vec3 pos;
+  Vec3 target;
+  bool perspectiveEnabled;
+  bool isCameraEnabled;
+} Camera;
+
+//
+// Scenes. Meshes and materials are added once and referred to by handle, and
+// every frame the caller submits instanced draws: a mesh and a material with
+// any number of model matrices. renderScene renders them in submission order.
+// Instances share their mesh's streams and meshlets, so nothing is copied per
+// instance; only the positions are transformed for each one. Model matrices
+// should be rotations, translations and uniform scales, which keep the normal
+// cones and the lighting in object space valid.
+//
+
+typedef u32 MeshHandle;
+typedef u32 MaterialHandle;
+#define MATERIAL_NONE 0xFFFFFFFF
+
+typedef struct {
+  MeshHandle mesh;
+  MaterialHandle material;
+  // its model matrices in Scene.instances
+  u32 firstInstance;
+  u32 numInstances;
+} Draw;
+
+typedef struct {
+  Mesh **meshes;
+  u32 numMeshes;
+  u32 maxMeshes;
+  Material *materials;
+  u32 numMaterials;
+  u32 maxMaterials;
+
+  // submitted since the last clearSceneDraws
+  Draw *draws;
+  u32 numDraws;
+  u32 maxDraws;
+  Mat4 *instances;
+  u32 numInstances;
+  u32 maxInstances;
+
+  // the LOD renderScene picked for each instance
+  u8 *instanceLods;
+  u32 maxInstanceLods;
+} Scene;
+
+// The mesh has to stay alive and unchanged while the scene uses it.
+MeshHandle addSceneMesh(Scene *scene, Mesh *mesh) {
+  RESERVE_ONE(scene->meshes, scene->numMeshes, scene->maxMeshes);
+  scene->meshes[scene->numMeshes] = mesh;
+  return scene->numMeshes++;
+}
+
+// Normal map texels are looked up with the texture's indices, so the two
+// need the same size and layout.
+bool hasMatchingNormalMap(Material *material) {
+  return material->normalMap.width == material->texture.width &&
+         material->normalMap.height == material->texture.height &&
+         material->normalMap.layout == material->texture.layout;
+}
+
+// Returns MATERIAL_NONE if the normal map doesn't match the texture.
+MaterialHandle addSceneMaterial(Scene *scene, Texture texture, Texture normalMap) {
+  Material candidate = {texture, normalMap};
+  if (!hasMatchingNormalMap(&candidate)) {
+    debugPrint("normal map is %ux%u %s, its texture %ux%u %s\n", normalMap.width, normalMap.height,
+               textureLayoutNames[normalMap.layout], texture.width, texture.height, textureLayoutNames[texture.layout]);
+    return MATERIAL_NONE;
+  }
+  RESERVE_ONE(scene->materials, scene->numMaterials, scene->maxMaterials);
+  Material *material = &scene->materials[scene->numMaterials];
+  material->texture = texture;
+  material->normalMap = normalMap;
+  return scene->numMaterials++;
+}
+
+// Draws numInstances copies of the mesh with the material, models[i] placing
+// copy i in the world.
+void drawMeshInstanced(Scene *scene, MeshHandle mesh, MaterialHandle material, Mat4 *models, u32 numInstances) {
+  assert(mesh < scene->numMeshes);
+  assert(material < scene->numMaterials);
+  RESERVE_ONE(scene->draws, scene->numDraws, scene->maxDraws);
+  Draw *draw = &scene->draws[scene->numDraws++];
+  draw->mesh = mesh;
+  draw->material = material;
+  draw->firstInstance = scene->numInstances;
+  draw->numInstances = numInstances;
+  for (u32 i = 0; i < numInstances; ++i) {
+    RESERVE_ONE(scene->instances, scene->numInstances, scene->maxInstances);
+    scene->instances[scene->numInstances++] = models[i];
+  }
+}
+
+void clearSceneDraws(Scene *scene) {
+  scene->numDraws = 0;
+  scene->numInstances = 0;
+}
+
+// Largest error in pixels of a LOD renderScene may pick for an instance.
+float lodPixelError = 1.0f;
+
+// Picks the coarsest of the mesh's LODs whose error stays under
+// lodPixelError where the instance's bounding sphere comes closest to the
+// camera. Screen x and y are clip x and y over w, at half the backbuffer
+// size in pixels per unit; scale is the model matrix's.
+int selectMeshLod(Mesh *mesh, Mat4 transform, float scale) {
+  if (mesh->numLods < 2) return 0;
+  Bounds *bounds = &mesh->bounds;
+  Vec4 center = mulMatVec4(transform, makeVec4(bounds->center.x, bounds->center.y, bounds->center.z, 1));
+  float wSlope = lengthVec3(makeVec3(transform.d[3][0], transform.d[3][1], transform.d[3][2]));
+  float w = center.w - bounds->radius*wSlope;
+  if (w < NEAR_W) return 0;
+  int size = backbufferWidth > backbufferHeight ? backbufferWidth : backbufferHeight;
+  float pixelsPerUnit = 0.5f*(float)size*scale/w;
+  int level = 0;
+  while (level+1 < mesh->numLods && mesh->lods[level+1].lodError*pixelsPerUnit <= lodPixelError) ++level;
+  return level;
+}
+
+void renderScene(Camera *camera, Scene *scene) {
+  assert(backbufferWidth <= MAX_BACKBUFFER_SIZE && backbufferHeight <= MAX_BACKBUFFER_SIZE);
+  TileBins *bins = &tileBins;
+  resetTileBins(bins);
+  bins->shadeMode = getShadeMode();
+  bins->colorResolve = colorResolve;
+  bins->clearColor = makeVec3(135.0f/255.0f, 181.0f/255.0f, 218.0f/255.0f);
+  bins->clearPixel = resolvePixel(bins->clearColor.x, bins->clearColor.y, bins->clearColor.z, bins->colorResolve);
+  if (msaaSamples > 1) {
+    assert(!deferredShading && "MSAA needs forward shading");
+    getMsaaPattern(msaaSamples);
+    int numWorkers = platformGetWorkerCount();
+    if (numWorkers > bins->numMsaaTiles) {
+      bins->msaaTiles = realloc(bins->msaaTiles, numWorkers*sizeof(*bins->msaaTiles));
+      for (int i = bins->numMsaaTiles; i < numWorkers; ++i) {
+        bins->msaaTiles[i] = allocAligned(sizeof(MsaaTile), FRAMEBUFFER_ALIGN);
+      }
+      bins->numMsaaTiles = numWorkers;
+    }
+  }
+
+  float cameraZ = lengthVec3(subVec3(camera->pos, camera->target));
+  float r = camera->perspectiveEnabled ? -1.0f/cameraZ : 0.0f;
+  Mat4 projectionMatrix = makeMat4(1,0,0,0,
+                                   0,1,0,0,
+                                   0,0,1,0,
+                                   0,0,r,1);
+  Mat4 viewMat = camera->isCameraEnabled ? getLookAtMat(camera->pos, camera->target, makeVec3(0, 1, 0)) : getIdentityMat4();
+
+  Mat4 viewportMat;
+  {
+    float w = (float)(backbufferWidth-1);
+    float h = (float)(backbufferHeight-1);
+    float d = 255.0f; //map z from [-1,1] to [0,255]
+    viewportMat = makeMat4(w/2.0f,      0,      0, w/2.0f,
+                                0, h/2.0f,      0, h/2.0f,
+                                0,      0, d/2.0f, d/2.0f,
+                                0,      0,      0,      1);
+  }
+
+  Mat4 transformMat = mulMat4(viewportMat, mulMat4(projectionMatrix, viewMat));
+  /* Mat4 normalTransformMat = invertMat4(transposeMat4(transformMat)); */
+
+  // the viewer in world space: the projection's center, or for orthographic
+  // views the direction back along the view axis
+  Mat4 invViewMat = invertMat4(viewMat);
+  Vec4 viewer = mulMatVec4(invViewMat, camera->perspectiveEnabled ? makeVec4(0, 0, cameraZ, 1) : makeVec4(0, 0, 1, 0));
+
+  CullStats *stats = &cullStats;
+  memset(stats, 0, sizeof(*stats));
+  VertexStage *stage = &vertexStage;
+  if (scene->numInstances > scene->maxInstanceLods) {
+    scene->maxInstanceLods = scene->maxInstances;
+    scene->instanceLods = realloc(scene->instanceLods, scene->maxInstanceLods);
+  }
+  PROFILE_BEGIN(lod, 0);
+  for (u32 d = 0; d < scene->numDraws; ++d) {
+    Draw *draw = &scene->draws[d];
+    Mesh *mesh = scene->meshes[draw->mesh];
+    for (u32 i = 0; i < draw->numInstances; ++i) {
+      Mat4 model = scene->instances[draw->firstInstance + i];
+      float scale = lengthVec3(makeVec3(model.d[0][0], model.d[1][0], model.d[2][0]));
+      int level = selectMeshLod(mesh, mulMat4(transformMat, model), scale);
+      scene->instanceLods[draw->firstInstance + i] = (u8)level;
+      stats->meshesSimplified += level > 0;
+      stats->facesFullDetail += mesh->numFaces;
+    }
+  }
+  PROFILE_END(lod, 0);
+
+  for (u32 d = 0; d < scene->numDraws; ++d) {
+    Draw *draw = &scene->draws[d];
+    Mesh *mesh = scene->meshes[draw->mesh];
+    Material *material = &scene->materials[draw->material];
+
+    // each level in use is a stage of its own
+    u32 levelsUsed = 0;
+    for (u32 i = 0; i < draw->numInstances; ++i) levelsUsed |= 1u << scene->instanceLods[draw->firstInstance + i];
+    for (int level = 0; level < MESH_MAX_LODS; ++level) {
+      if (!(levelsUsed & (1u << level))) continue;
+      Mesh *lod = level ? &mesh->lods[level] : mesh;
+      PROFILE_BEGIN(cull, 0);
+      beginVertexStage(stage, lod);
+      for (u32 i = 0; i < draw->numInstances; ++i) {
+        if (scene->instanceLods[draw->firstInstance + i] != level) continue;
+        Mat4 model = scene->instances[draw->firstInstance + i];
+        // culling and lighting happen in object space
+        Mat4 invModel = invertAffineMat4(model);
+        StageInstance instance;
+        instance.transform = mulMat4(transformMat, model);
+        Vec4 light = mulMatVec4(invModel, makeVec4(lightDir.x, lightDir.y, lightDir.z, 0));
+        instance.lightDir = normalizeVec3(makeVec3(light.x, light.y, light.z));
+        CullView cullView = makeCullView(instance.transform, mulMatVec4(invModel, viewer));
+        cullMeshlets(stage, &cullView, &instance, stats);
+      }
+      PROFILE_END(cull, 0);
+
+      u32 chunkInstances = VERTEX_CHUNK_SIZE / getSoACount(lod->numPositions);
+      if (chunkInstances < 1) chunkInstances = 1;
+      for (u32 first = 0; first < stage->numInstances; first += chunkInstances) {
+        u32 count = stage->numInstances - first < chunkInstances ? stage->numInstances - first : chunkInstances;
+        PROFILE_BEGIN(transform, 0);
+        transformVertices(stage, first, count);
+        PROFILE_END(transform, 0);
+        PROFILE_BEGIN(setup, 0);
+        assembleTriangles(bins, stage, material, stats);
+        PROFILE_END(setup, 0);
+      }
+    }
+  }
+  stats->trianglesBinned = bins->numTriangles;
+
+  PROFILE_BEGIN(bin, 0);
+  fillTileBins(bins);
+  PROFILE_END(bin, 0);
+  PROFILE_BEGIN(tiles, 0);
+  bins->nextTile = 0;
+  platformRunOnWorkers(rasterizeTilesWork, bins);
+  PROFILE_END(tiles, 0);
+
+  memset(&shadingStats, 0, sizeof(shadingStats));
+  for (int i = 0; i < bins->tilesX*bins->tilesY; ++i) {
+    ShadingStats *tileStats = &bins->tileShadingStats[i];
+    shadingStats.pixelsTested += tileStats->pixelsTested;
+    shadingStats.depthWrites += tileStats->depthWrites;
+    shadingStats.shadedPixels += tileStats->shadedPixels;
+    shadingStats.pixelsCovered += tileStats->pixelsCovered;
+  }
+
+  PROFILE_COUNTER(trianglesSubmitted, stats->faces);
+  PROFILE_COUNTER(trianglesCulled, stats->facesInCulledMeshlets + stats->facesOutside + stats->facesBackfacing + stats->facesDegenerate);
+  PROFILE_COUNTER(pixelsTested, shadingStats.pixelsTested);
+  PROFILE_COUNTER(depthPasses, shadingStats.depthWrites);
+  PROFILE_COUNTER(pixelsCovered, shadingStats.pixelsCovered);
+  PROFILE_COUNTER(overdraw, shadingStats.pixelsCovered ? (f64)shadingStats.depthWrites / shadingStats.pixelsCovered : 0.0);
+}
+
+// A scene of the one mesh, untransformed. It's left empty if the normal map
+// doesn't match the texture.
+Scene singleMeshScene;
+
+void renderFrame(Camera *camera, Mesh *mesh, Texture texture, Texture normalMap) {
+  Scene *scene = &singleMeshScene;
+  scene->numMeshes = 0;
+  scene->numMaterials = 0;
+  clearSceneDraws(scene);
+  Mat4 model = getIdentityMat4();
+  MaterialHandle material = addSceneMaterial(scene, texture, normalMap);
+  if (material != MATERIAL_NONE) drawMeshInstanced(scene, addSceneMesh(scene, mesh), material, &model, 1);
+  renderScene(camera, scene);
+}
+
+// The stats overlay: frame time, culling and shading stats and, if
+// showProfile, the last complete frame's profile.
+void drawHud(f32 dt, bool showProfile) {
+  drawText(0, 0, "dt: %f", dt);
+  drawText(0, charHeight, "fps: %f", 1.0f/dt);
+  drawText(0, 2*charHeight, "meshlets: %u/%u tris: %u/%u", cullStats.meshlets - cullStats.meshletsOutside - cullStats.meshletsBackfacing,
+           cullStats.meshlets, cullStats.trianglesBinned, cullStats.faces);
+  if (deferredShading) {
+    drawText(0, 3*charHeight, "shaded: %u overdraw skipped: %u", shadingStats.shadedPixels,
+             shadingStats.depthWrites - shadingStats.shadedPixels);
+  }
+  if (showProfile) {
+    // the last complete frame, as this one's hud and present haven't ended
+    ProfileStage stages[PROFILE_MAX_STAGES];
+    int numStages = getProfileStages(profileFrame-1, stages, PROFILE_MAX_STAGES);
+    for (int i = 0; i < numStages; ++i) {
+      ProfileStage *stage = &stages[i];
+      int y = (4+i)*charHeight;
+      if (stage->isCounter) drawText(0, y, "%s: %.2f", stage->name, stage->seconds);
+      else drawText(8*stage->depth, y, "%s: %.3f ms", stage->name, stage->seconds*1000.0);
+    }
+  }
+  flushText();
+}
@@ -0,0 +1,78 @@
+//
+// CPU feature detection shared by the SIMD code paths (pixel kernels, texture
+// decoding). On x86 the intrinsics header is included here and the TARGET_*
+// macros let single functions use instructions the rest of the build doesn't.
+//
+
+typedef enum {
+  SIMD_AUTO,
+  SIMD_SCALAR,
+  SIMD_SSE4,
+  SIMD_AVX2,
+  SIMD_AVX512,
+  SIMD_COUNT,
+} SimdLevel;
+
+char *simdLevelNames[SIMD_COUNT] = {"auto", "scalar", "sse4", "avx2", "avx512"};
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SIMD_X86 1
+#endif
+
+// For helpers that kernels must not pay a call for, and for kernel bodies
+// that are specialized by passing them constant arguments.
+#if defined(_MSC_VER)
+#define FORCE_INLINE static __forceinline
+#else
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
+#if SIMD_X86
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_SSE4
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+SimdLevel getCpuSimdLevel(void) {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool hasSSE4 = (info[2] & (1 << 19)) != 0;
+  bool hasOSXSave = (info[2] & (1 << 27)) != 0;
+  bool hasAVX = (info[2] & (1 << 28)) != 0;
+  bool hasAVX2 = false;
+  bool hasAVX512 = false;
+  // the OS has to save the ymm (and for AVX-512 the zmm and mask) registers too
+  if (hasOSXSave && hasAVX && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    hasAVX2 = (info[1] & (1 << 5)) != 0;
+    hasAVX512 = (info[1] & (1 << 16)) != 0 && (_xgetbv(0) & 0xE6) == 0xE6;
+  }
+#else
+  __builtin_cpu_init();
+  bool hasSSE4 = __builtin_cpu_supports("sse4.1");
+  bool hasAVX2 = __builtin_cpu_supports("avx2");
+  bool hasAVX512 = __builtin_cpu_supports("avx512f");
+#endif
+  if (hasAVX512 && hasAVX2) return SIMD_AVX512;
+  if (hasAVX2) return SIMD_AVX2;
+  if (hasSSE4) return SIMD_SSE4;
+  return SIMD_SCALAR;
+}
+
+#else
+
+SimdLevel getCpuSimdLevel(void) {
+  return SIMD_SCALAR;
+}
+
+#endif
@@ -0,0 +1,97 @@
+// Compares the texture memory layouts. Walks straight lines across the
+// texture at several angles, like a rasterizer does for a rotated triangle,
+// and then renders a ring of views with each layout. Run from the repo root.
+
+#include "posix_platform.c"
+
+#define WALK_ANGLES 8
+#define WALK_SAMPLES (1 << 22)
+
+// Nearest samples along parallel lines at the given angle, covering the whole
+// texture the way scanlines cover a triangle. Returns a checksum so the loads
+// can't be dropped.
+float walkTexture(Texture *texture, float angle, int numSamples) {
+  float dirX = cosf(angle), dirY = sinf(angle);
+  float scaleX = (float)(texture->width-1), scaleY = (float)(texture->height-1);
+  int samplesPerLine = (int)texture->width;
+  float sum = 0;
+  for (int i = 0; i < numSamples; i += samplesPerLine) {
+    // lines one texel apart, perpendicular to the walk, wrapped into the texture
+    float line = (float)(i / samplesPerLine) / (float)texture->height;
+    float u = 0.5f - 0.5f*dirX - dirY*(line - 0.5f);
+    float v = 0.5f - 0.5f*dirY + dirX*(line - 0.5f);
+    float du = dirX / (float)samplesPerLine, dv = dirY / (float)samplesPerLine;
+    for (int j = 0; j < samplesPerLine; ++j, u += du, v += dv) {
+      float wu = u - floorf(u), wv = v - floorf(v);
+      u32 tx = (u32)(wu*scaleX);
+      u32 ty = (u32)(wv*scaleY);
+      sum += texture->pixels[getTexelIndex(texture, tx, ty)].x;
+    }
+  }
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  char *texturePath = argc > 1 ? argv[1] : "african_head_diffuse.tga";
+  int repeat = 5;
+
+  Mesh mesh = readMesh("african_head.obj");
+  if (!mesh.faces) return 1;
+  initWorkers((int)sysconf(_SC_NPROCESSORS_ONLN));
+  SimdLevel simdLevel = initPixelKernels(SIMD_AUTO);
+  initVertexKernels(SIMD_AUTO);
+  if (!initBackbuffer(500, 500)) return 1;
+
+  Camera cameras[8];
+  for (int i = 0; i < 8; ++i) {
+    float angle = 2.0f*3.14159265f*(float)i/8.0f;
+    cameras[i].pos = makeVec3(4.1f*sinf(angle), 1.0f, 4.1f*cosf(angle));
+    cameras[i].target = makeVec3(0, 0, 0);
+    cameras[i].perspectiveEnabled = true;
+    cameras[i].isCameraEnabled = true;
+  }
+
+  printf("%s, %s kernel\n", texturePath, simdLevelNames[simdLevel]);
+  printf("%-8s", "layout");
+  for (int a = 0; a < WALK_ANGLES; ++a) printf(" %5d deg", a*180/WALK_ANGLES);
+  printf("   render\n");
+
+  for (int layout = 0; layout < TEXTURE_LAYOUT_COUNT; ++layout) {
+    textureLayout = layout;
+    Texture texture = readTGAFile(texturePath);
+    Texture normalMap = readTGAFile(texturePath);
+    if (!texture.pixels || !normalMap.pixels) return 1;
+    if (texture.layout != (TextureLayout)layout) {
+      printf("%-8s not supported for %ux%u\n", textureLayoutNames[layout], texture.width, texture.height);
+      continue;
+    }
+
+    printf("%-8s", textureLayoutNames[layout]);
+    float checksum = 0;
+    for (int a = 0; a < WALK_ANGLES; ++a) {
+      float angle = 3.14159265f*(float)a/(float)WALK_ANGLES;
+      f64 best = DBL_MAX;
+      for (int j = 0; j < repeat; ++j) {
+        f64 start = platformGetSeconds();
+        checksum += walkTexture(&texture, angle, WALK_SAMPLES);
+        f64 time = platformGetSeconds() - start;
+        if (time < best) best = time;
+      }
+      printf(" %6.2f ns", best*1e9/WALK_SAMPLES);
+    }
+
+    f64 renderTime = 0;
+    for (int i = 0; i < 8; ++i) {
+      f64 best = DBL_MAX;
+      for (int j = 0; j < repeat; ++j) {
+        f64 start = platformGetSeconds();
+        renderFrame(&cameras[i], &mesh, texture, normalMap);
+        f64 time = platformGetSeconds() - start;
+        if (time < best) best = time;
+      }
+      renderTime += best;
+    }
+    printf("  %6.3f ms  (checksum %g)\n", renderTime*1000.0/8, checksum);
+  }
+  return 0;
+}
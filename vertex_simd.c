@@ -0,0 +1,198 @@
+//
+// SSE4.1 (4 wide), AVX2 (8 wide) and AVX-512 (16 wide) versions of
+// transformVertexBatchScalar, and the runtime choice between them. Lanes are
+// consecutive vertices of the SoA streams; loads and stores are aligned.
+// Like the pixel kernels they do the scalar kernel's float operations in the
+// same order without FMA, so the vertex buffer is identical at every level.
+//
+
+VertexKernel *transformVertexBatch = transformVertexBatchScalar;
+
+#if SIMD_X86
+
+TARGET_SSE4 void transformVertexBatchSSE4(VertexStage *stage, StageInstance *instance, u32 first, u32 count) {
+  __m128 m[4][4];
+  for (int r = 0; r < 4; ++r) {
+    for (int c = 0; c < 4; ++c) m[r][c] = _mm_set1_ps(instance->transform.d[r][c]);
+  }
+  u32 stride = getSoACount(stage->mesh->numPositions);
+  u32 base = instance->vertexBase;
+  float *inX = stage->mesh->positionsSoA;
+  float *inY = inX + stride;
+  float *inZ = inY + stride;
+  __m128 zero = _mm_setzero_ps();
+  __m128 nearW = _mm_set1_ps(NEAR_W);
+  __m128 screenRight = _mm_set1_ps((float)(backbufferWidth-1));
+  __m128 screenTop = _mm_set1_ps((float)(backbufferHeight-1));
+  __m128 guardBand = _mm_set1_ps(GUARD_BAND);
+  __m128 negGuardBand = _mm_set1_ps(-GUARD_BAND);
+  __m128 bits[CLIP_PLANE_COUNT];
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) bits[i] = _mm_castsi128_ps(_mm_set1_epi32(1 << i));
+
+  for (u32 i = first; i < first + count; i += 4) {
+    __m128 x = _mm_load_ps(inX + i);
+    __m128 y = _mm_load_ps(inY + i);
+    __m128 z = _mm_load_ps(inZ + i);
+    __m128 clip[4];
+    for (int r = 0; r < 4; ++r) {
+      clip[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y)), _mm_mul_ps(m[r][2], z)), m[r][3]);
+    }
+    __m128 cx = clip[0], cy = clip[1], cz = clip[2], cw = clip[3];
+    _mm_store_ps(stage->clipX + base + i, cx);
+    _mm_store_ps(stage->clipY + base + i, cy);
+    _mm_store_ps(stage->clipZ + base + i, cz);
+    _mm_store_ps(stage->clipW + base + i, cw);
+    _mm_store_ps(stage->screenX + base + i, _mm_div_ps(cx, cw));
+    _mm_store_ps(stage->screenY + base + i, _mm_div_ps(cy, cw));
+    _mm_store_ps(stage->screenZ + base + i, _mm_div_ps(cz, cw));
+
+    // same distances as getClipDistance, NaN counts as outside
+    __m128 near = _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(cw, nearW), zero), bits[0]);
+    __m128 screenOut = _mm_or_ps(near, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(cx, _mm_mul_ps(zero, cw)), zero), bits[1]));
+    screenOut = _mm_or_ps(screenOut, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(_mm_mul_ps(screenRight, cw), cx), zero), bits[2]));
+    screenOut = _mm_or_ps(screenOut, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(cy, _mm_mul_ps(zero, cw)), zero), bits[3]));
+    screenOut = _mm_or_ps(screenOut, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(_mm_mul_ps(screenTop, cw), cy), zero), bits[4]));
+    __m128 guardOut = _mm_or_ps(near, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(cx, _mm_mul_ps(negGuardBand, cw)), zero), bits[1]));
+    guardOut = _mm_or_ps(guardOut, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(_mm_mul_ps(guardBand, cw), cx), zero), bits[2]));
+    guardOut = _mm_or_ps(guardOut, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(cy, _mm_mul_ps(negGuardBand, cw)), zero), bits[3]));
+    guardOut = _mm_or_ps(guardOut, _mm_and_ps(_mm_cmpnge_ps(_mm_sub_ps(_mm_mul_ps(guardBand, cw), cy), zero), bits[4]));
+    _mm_store_ps((float *)stage->screenOut + base + i, screenOut);
+    _mm_store_ps((float *)stage->guardOut + base + i, guardOut);
+  }
+}
+
+TARGET_AVX2 void transformVertexBatchAVX2(VertexStage *stage, StageInstance *instance, u32 first, u32 count) {
+  __m256 m[4][4];
+  for (int r = 0; r < 4; ++r) {
+    for (int c = 0; c < 4; ++c) m[r][c] = _mm256_set1_ps(instance->transform.d[r][c]);
+  }
+  u32 stride = getSoACount(stage->mesh->numPositions);
+  u32 base = instance->vertexBase;
+  float *inX = stage->mesh->positionsSoA;
+  float *inY = inX + stride;
+  float *inZ = inY + stride;
+  __m256 zero = _mm256_setzero_ps();
+  __m256 nearW = _mm256_set1_ps(NEAR_W);
+  __m256 screenRight = _mm256_set1_ps((float)(backbufferWidth-1));
+  __m256 screenTop = _mm256_set1_ps((float)(backbufferHeight-1));
+  __m256 guardBand = _mm256_set1_ps(GUARD_BAND);
+  __m256 negGuardBand = _mm256_set1_ps(-GUARD_BAND);
+  __m256 bits[CLIP_PLANE_COUNT];
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) bits[i] = _mm256_castsi256_ps(_mm256_set1_epi32(1 << i));
+
+#define OUTSIDE(distance, bit) _mm256_and_ps(_mm256_cmp_ps((distance), zero, _CMP_NGE_UQ), bits[bit])
+  for (u32 i = first; i < first + count; i += 8) {
+    __m256 x = _mm256_load_ps(inX + i);
+    __m256 y = _mm256_load_ps(inY + i);
+    __m256 z = _mm256_load_ps(inZ + i);
+    __m256 clip[4];
+    for (int r = 0; r < 4; ++r) {
+      clip[r] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[r][0], x), _mm256_mul_ps(m[r][1], y)), _mm256_mul_ps(m[r][2], z)), m[r][3]);
+    }
+    __m256 cx = clip[0], cy = clip[1], cz = clip[2], cw = clip[3];
+    _mm256_store_ps(stage->clipX + base + i, cx);
+    _mm256_store_ps(stage->clipY + base + i, cy);
+    _mm256_store_ps(stage->clipZ + base + i, cz);
+    _mm256_store_ps(stage->clipW + base + i, cw);
+    _mm256_store_ps(stage->screenX + base + i, _mm256_div_ps(cx, cw));
+    _mm256_store_ps(stage->screenY + base + i, _mm256_div_ps(cy, cw));
+    _mm256_store_ps(stage->screenZ + base + i, _mm256_div_ps(cz, cw));
+
+    __m256 near = OUTSIDE(_mm256_sub_ps(cw, nearW), 0);
+    __m256 screenOut = _mm256_or_ps(near, OUTSIDE(_mm256_sub_ps(cx, _mm256_mul_ps(zero, cw)), 1));
+    screenOut = _mm256_or_ps(screenOut, OUTSIDE(_mm256_sub_ps(_mm256_mul_ps(screenRight, cw), cx), 2));
+    screenOut = _mm256_or_ps(screenOut, OUTSIDE(_mm256_sub_ps(cy, _mm256_mul_ps(zero, cw)), 3));
+    screenOut = _mm256_or_ps(screenOut, OUTSIDE(_mm256_sub_ps(_mm256_mul_ps(screenTop, cw), cy), 4));
+    __m256 guardOut = _mm256_or_ps(near, OUTSIDE(_mm256_sub_ps(cx, _mm256_mul_ps(negGuardBand, cw)), 1));
+    guardOut = _mm256_or_ps(guardOut, OUTSIDE(_mm256_sub_ps(_mm256_mul_ps(guardBand, cw), cx), 2));
+    guardOut = _mm256_or_ps(guardOut, OUTSIDE(_mm256_sub_ps(cy, _mm256_mul_ps(negGuardBand, cw)), 3));
+    guardOut = _mm256_or_ps(guardOut, OUTSIDE(_mm256_sub_ps(_mm256_mul_ps(guardBand, cw), cy), 4));
+    _mm256_store_ps((float *)stage->screenOut + base + i, screenOut);
+    _mm256_store_ps((float *)stage->guardOut + base + i, guardOut);
+  }
+#undef OUTSIDE
+}
+
+TARGET_AVX512 void transformVertexBatchAVX512(VertexStage *stage, StageInstance *instance, u32 first, u32 count) {
+  __m512 m[4][4];
+  for (int r = 0; r < 4; ++r) {
+    for (int c = 0; c < 4; ++c) m[r][c] = _mm512_set1_ps(instance->transform.d[r][c]);
+  }
+  u32 stride = getSoACount(stage->mesh->numPositions);
+  u32 base = instance->vertexBase;
+  float *inX = stage->mesh->positionsSoA;
+  float *inY = inX + stride;
+  float *inZ = inY + stride;
+  __m512 zero = _mm512_setzero_ps();
+  __m512 nearW = _mm512_set1_ps(NEAR_W);
+  __m512 screenRight = _mm512_set1_ps((float)(backbufferWidth-1));
+  __m512 screenTop = _mm512_set1_ps((float)(backbufferHeight-1));
+  __m512 guardBand = _mm512_set1_ps(GUARD_BAND);
+  __m512 negGuardBand = _mm512_set1_ps(-GUARD_BAND);
+  __m512i bits[CLIP_PLANE_COUNT];
+  for (int i = 0; i < CLIP_PLANE_COUNT; ++i) bits[i] = _mm512_set1_epi32(1 << i);
+
+  // mask compares set the plane's bit in the lanes that are outside
+#define ADD_OUTSIDE(code, distance, bit) \
+  code = _mm512_mask_or_epi32(code, _mm512_cmp_ps_mask((distance), zero, _CMP_NGE_UQ), code, bits[bit])
+  for (u32 i = first; i < first + count; i += 16) {
+    __m512 x = _mm512_load_ps(inX + i);
+    __m512 y = _mm512_load_ps(inY + i);
+    __m512 z = _mm512_load_ps(inZ + i);
+    __m512 clip[4];
+    for (int r = 0; r < 4; ++r) {
+      clip[r] = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[r][0], x), _mm512_mul_ps(m[r][1], y)), _mm512_mul_ps(m[r][2], z)), m[r][3]);
+    }
+    __m512 cx = clip[0], cy = clip[1], cz = clip[2], cw = clip[3];
+    _mm512_store_ps(stage->clipX + base + i, cx);
+    _mm512_store_ps(stage->clipY + base + i, cy);
+    _mm512_store_ps(stage->clipZ + base + i, cz);
+    _mm512_store_ps(stage->clipW + base + i, cw);
+    _mm512_store_ps(stage->screenX + base + i, _mm512_div_ps(cx, cw));
+    _mm512_store_ps(stage->screenY + base + i, _mm512_div_ps(cy, cw));
+    _mm512_store_ps(stage->screenZ + base + i, _mm512_div_ps(cz, cw));
+
+    __m512i near = _mm512_setzero_si512();
+    ADD_OUTSIDE(near, _mm512_sub_ps(cw, nearW), 0);
+    __m512i screenOut = near;
+    ADD_OUTSIDE(screenOut, _mm512_sub_ps(cx, _mm512_mul_ps(zero, cw)), 1);
+    ADD_OUTSIDE(screenOut, _mm512_sub_ps(_mm512_mul_ps(screenRight, cw), cx), 2);
+    ADD_OUTSIDE(screenOut, _mm512_sub_ps(cy, _mm512_mul_ps(zero, cw)), 3);
+    ADD_OUTSIDE(screenOut, _mm512_sub_ps(_mm512_mul_ps(screenTop, cw), cy), 4);
+    __m512i guardOut = near;
+    ADD_OUTSIDE(guardOut, _mm512_sub_ps(cx, _mm512_mul_ps(negGuardBand, cw)), 1);
+    ADD_OUTSIDE(guardOut, _mm512_sub_ps(_mm512_mul_ps(guardBand, cw), cx), 2);
+    ADD_OUTSIDE(guardOut, _mm512_sub_ps(cy, _mm512_mul_ps(negGuardBand, cw)), 3);
+    ADD_OUTSIDE(guardOut, _mm512_sub_ps(_mm512_mul_ps(guardBand, cw), cy), 4);
+    _mm512_store_si512(stage->screenOut + base + i, screenOut);
+    _mm512_store_si512(stage->guardOut + base + i, guardOut);
+  }
+#undef ADD_OUTSIDE
+}
+
+#endif
+
+// Picks the vertex kernel like initPixelKernels does. Returns the level
+// actually used.
+SimdLevel initVertexKernels(SimdLevel requested) {
+  SimdLevel supported = getCpuSimdLevel();
+  SimdLevel level = (requested == SIMD_AUTO || requested > supported) ? supported : requested;
+  switch (level) {
+#if SIMD_X86
+    case SIMD_AVX512:
+      transformVertexBatch = transformVertexBatchAVX512;
+      break;
+    case SIMD_AVX2:
+      transformVertexBatch = transformVertexBatchAVX2;
+      break;
+    case SIMD_SSE4:
+      transformVertexBatch = transformVertexBatchSSE4;
+      break;
+#endif
+    default:
+      level = SIMD_SCALAR;
+      transformVertexBatch = transformVertexBatchScalar;
+      break;
+  }
+  return level;
+}